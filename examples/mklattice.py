@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+"""Write an argon fcc lattice of 4*n^3 atoms as argon_<natoms>.inp/.rest.
+
+usage: mklattice.py n [lattice constant in A] [temperature in K] [seed]
+
+The restart is written line by line, so that lattices of 10^7 and more
+atoms need no memory. The velocities are drawn in +v/-v pairs, so that
+the total momentum is zero without a second pass.
+"""
+
+import math
+import random
+import sys
+
+kboltz = 0.0019872067     # boltzman constant in kcal/mol/K
+mvsq2e = 2390.05736153349 # m*v^2 in kcal/mol
+mass = 39.948
+
+basis = ((0.0, 0.0, 0.0), (0.5, 0.5, 0.0), (0.5, 0.0, 0.5), (0.0, 0.5, 0.5))
+
+
+def main():
+  if len(sys.argv) < 2:
+    sys.exit(__doc__)
+  n = int(sys.argv[1])
+  a = float(sys.argv[2]) if len(sys.argv) > 2 else 5.7193
+  temp = float(sys.argv[3]) if len(sys.argv) > 3 else 100.0
+  random.seed(int(sys.argv[4]) if len(sys.argv) > 4 else 12345)
+
+  natoms = 4 * n * n * n
+  box = n * a
+  name = "argon_%d" % natoms
+  sigma = math.sqrt(kboltz * temp / mvsq2e / mass)
+
+  with open(name + ".rest", "w") as rest:
+    for i in range(n):
+      for j in range(n):
+        for k in range(n):
+          for b in basis:
+            rest.write("%22.14f%22.14f%22.14f\n" % ((i + b[0]) * a - 0.5 * box,
+                                                  (j + b[1]) * a - 0.5 * box,
+                                                  (k + b[2]) * a - 0.5 * box))
+    for i in range(natoms // 2):
+      v = (random.gauss(0.0, sigma), random.gauss(0.0, sigma), random.gauss(0.0, sigma))
+      rest.write("%22.14f%22.14f%22.14f\n" % v)
+      rest.write("%22.14f%22.14f%22.14f\n" % (-v[0], -v[1], -v[2]))
+
+  with open(name + ".inp", "w") as inp:
+    inp.write("%-17d # natoms\n" % natoms)
+    inp.write("%-17g # mass in AMU\n" % mass)
+    inp.write("0.2379            # epsilon in kcal/mol\n")
+    inp.write("3.405             # sigma in angstrom\n")
+    inp.write("8.5               # rcut in angstrom\n")
+    inp.write("%-17.6f # box length (in angstrom)\n" % box)
+    inp.write("%-17s # restart\n" % (name + ".rest"))
+    inp.write("%-17s # trajectory\n" % (name + ".xyz"))
+    inp.write("%-17s # energies\n" % (name + ".dat"))
+    inp.write("10                # nr MD steps\n")
+    inp.write("5.0               # MD time step (in fs)\n")
+    inp.write("10                # output print frequency\n")
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+"""Run an ljmd-cl input as many short segments in process, with the ljmd module.
+
+usage: segments.py input [segments] [steps per segment] [device] [nthreads]
+
+After every segment the positions, velocities and forces are read as
+numpy arrays on the engine's own storage, without copies, and the mean
+square displacement from the start, the center of mass velocity and the
+largest force are printed with the energies. Build the module with
+`make python` and run from the directory of the input, with the module
+on PYTHONPATH.
+"""
+
+import sys
+import time
+
+import numpy as np
+
+import ljmd
+
+
+def main():
+  if len(sys.argv) < 2:
+    sys.exit(__doc__)
+  nseg = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+  nsteps = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+  device = sys.argv[4] if len(sys.argv) > 4 else "cpu"
+  nthreads = int(sys.argv[5]) if len(sys.argv) > 5 else 0
+
+  engine = ljmd.Engine(sys.argv[1], device, nthreads)
+  # views of the engine: they follow every run() without being fetched again
+  r = np.asarray(engine.positions)
+  image = np.asarray(engine.images)
+  v = np.asarray(engine.velocities)
+  f = np.asarray(engine.forces)
+  box = engine.box
+  start = r + box * image
+
+  print("%d atoms, zero-copy %s, %d segments of %d steps" % (engine.natoms, engine.zerocopy, nseg, nsteps))
+  print("     NFI         TEMP            ETOT          MSD       VCOM        FMAX")
+  t0 = time.time()
+  for s in range(nseg):
+    engine.run(nsteps)
+    e = engine.energies
+    msd = np.mean(np.sum((r + box * image - start) ** 2, axis=0))
+    vcom = np.linalg.norm(v.mean(axis=1))
+    fmax = np.abs(f).max()
+    print("%8d %12.6f %15.8f %12.6f %10.3g %11.6f" % (e["nfi"], e["temp"], e["etot"], msd, vcom, fmax))
+  t = time.time() - t0
+  print("%d segments in %.3f s, %.1f segments/s, %.1f steps/s" % (nseg, t, nseg / t, nseg * nsteps / t))
+
+
+if __name__ == "__main__":
+  main()
@@ -1,4 +1,53 @@
 #ifndef __OPENCL_DATA__
 #define __OPENCL_DATA__
 
+#include "OpenCL_utils.h"
+
+#ifdef _USE_FLOAT
+#define FPTYPE float
+#define ZERO  0.0f
+#define HALF  0.5f
+#define ONE   1.0f
+#define TWO   2.0f
+#define THREE 3.0f
+#else
+#define FPTYPE double
+#define ZERO  0.0
+#define HALF  0.5
+#define ONE   1.0
+#define TWO   2.0
+#define THREE 3.0
+#endif
+
+/** generic file- or pathname buffer length */
+#define BLEN 200
+
+/** structure to hold the complete information
+    about the MD system */
+struct _mdsys {
+    int natoms,nfi,nsteps;
+    FPTYPE dt, mass, epsilon, sigma, box, rcut;
+    FPTYPE ekin, epot, temp, virial, press;
+    FPTYPE *rx, *ry, *rz;
+    FPTYPE *vx, *vy, *vz;
+    FPTYPE *fx, *fy, *fz;
+    cl_int *ix, *iy, *iz;   /* periodic images of the positions, wrapped into the box */
+};
+typedef struct _mdsys mdsys_t;
+
+/** structure to hold the complete information
+    about the MD system on a OpenCL device. the per-atom
+    arrays are split in chunks (see atom_chunks.h) */
+struct _cl_mdsys {
+    int natoms,nfi,nsteps;
+    FPTYPE dt, mass, epsilon, sigma, box, rcut;
+    FPTYPE ekin, epot, temp, virial, press;
+    cl_mem *rx, *ry, *rz;
+    cl_mem *vx, *vy, *vz;
+    cl_mem *fx, *fy, *fz;
+    cl_mem *ax, *ay, *az;   /* fixed point force sums, or fx, fy, fz */
+    cl_mem *ix, *iy, *iz;   /* periodic image counters */
+};
+typedef struct _cl_mdsys cl_mdsys_t;
+
 #endif
@@ -13,8 +13,9 @@
 #include <ctype.h>
 #include <sys/types.h>
 
-/* This section contains the timing function */
+/* This section contains the timing functions */
 double second();
+double cpusecond();
 
 //#define CL_DEVICE_KIND CL_DEVICE_TYPE_CPU
 //#define CL_DEVICE_KIND CL_DEVICE_TYPE_ALL
@@ -22,7 +23,9 @@ double second();
 
 #define STRINGSIZE 2048
 
-cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_context ** contexts, cl_command_queue ** cmdQueues , cl_uint * ngpu );
+/* device_type: cpu | gpu[n] (first platform with the type), all[:cpu|gpu|acc] or
+   p:d[@w],... (a pool across platforms); weights are the relative atom shares */
+cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_context ** contexts, cl_command_queue ** cmdQueues , cl_uint * ngpu, double ** weights );
 
 char * source2string( char * filename );
 
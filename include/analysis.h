@@ -0,0 +1,51 @@
+#ifndef __ANALYSIS__
+#define __ANALYSIS__
+
+#include "OpenCL_data.h"
+
+/** radial distribution function: the force kernel of the sampled steps counts
+    the pair distances below the cutoff in nbins bins on the device (built with
+    -D_RDF=nbins), the counts are downloaded and g(r) is rewritten every
+    "every" samples */
+struct _rdf {
+    int nbins;              /* number of bins up to rcut, 0 if no g(r) is computed */
+    int every;              /* samples between two downloads of the counts */
+    int nsamples;           /* samples accumulated in hist */
+    char file[BLEN];        /* "r g(r)" output */
+    double *hist;           /* ordered pair counts of all samples */
+    cl_uint *counts;        /* staging of the device counts */
+};
+typedef struct _rdf rdf_t;
+
+/* parses "rdf <nbins> <file> [every]" */
+int ReadRdfOption( const char * line, rdf_t * rdf );
+
+/* allocates the host histograms */
+int InitRdf( rdf_t * rdf );
+
+/* normalizes the histogram to g(r) of nsamples samples and rewrites the file */
+int WriteRdf( const rdf_t * rdf, const mdsys_t * sys );
+
+void FreeRdf( rdf_t * rdf );
+
+/** time correlation functions: every "every" steps the positions and velocities
+    of device 0 are stored in a ring of nlags origins per atom, and the mean
+    square displacement and velocity autocorrelation from all stored origins are
+    added to per-thread partials on the device. only these partials are
+    downloaded, at the end of the run */
+struct _corr {
+    int nlags;              /* origins in the ring, 0 if nothing is correlated */
+    int every;              /* steps between two samples */
+    int nsamples;           /* samples taken, the first one at step 0 */
+    char file[BLEN];        /* "t msd vacf" output */
+};
+typedef struct _corr corr_t;
+
+/* parses "correlation <nlags> <every> <file>" */
+int ReadCorrOption( const char * line, corr_t * corr );
+
+/* averages the nparts partials of 2*nlags values over the atoms and origins
+   and writes the curves with the diffusion coefficients they give */
+int WriteCorr( const corr_t * corr, const mdsys_t * sys, const FPTYPE * acc, int nparts );
+
+#endif
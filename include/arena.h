@@ -0,0 +1,70 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include "OpenCL_data.h"
+
+/** the buffers of one device as sub-buffers of a few large blocks. the sizes
+    are reserved first, one slot per buffer, then CommitArena creates the
+    blocks and the sub-buffers of all slots. a block is at most
+    CL_DEVICE_MAX_MEM_ALLOC_SIZE bytes and every slot starts at a multiple of
+    CL_DEVICE_MEM_BASE_ADDR_ALIGN. the initial contents of the slots are
+    collected on the host by ArenaWrite and uploaded by FlushArena with one
+    write per block */
+struct _arena {
+    cl_context context;
+    cl_mem_flags flags;     /* of the blocks, CL_MEM_READ_WRITE and the host access */
+    size_t align;           /* bytes, slot origins are multiples of it */
+    size_t maxalloc;        /* largest block */
+    int nslots, maxslots;
+    int nblocks;
+    int *blockof;           /* block of every slot */
+    size_t *origin, *size;  /* of every slot inside its block */
+    size_t *used;           /* bytes of every block */
+    cl_mem *block;
+    cl_mem *buffer;         /* sub-buffer of every slot, consecutive slots are an array */
+    char **stage;           /* per block: host copy of the bytes lo .. hi-1 to upload */
+    size_t *lo, *hi;
+};
+typedef struct _arena arena_t;
+
+/** host storage of the run in one allocation, every piece aligned to and
+    padded to whole pages, as the CL_MEM_USE_HOST_PTR buffers want them */
+struct _host_arena {
+    char *base;
+    size_t size, align;
+};
+typedef struct _host_arena host_arena_t;
+
+/* the arena of a device. flags are added to CL_MEM_READ_WRITE for the blocks */
+void InitArena( arena_t * arena, cl_context context, cl_device_id device, cl_mem_flags flags );
+
+/* a slot of bytes bytes, returns its index */
+int ArenaReserve( arena_t * arena, size_t bytes );
+
+/* allocates the blocks and creates the sub-buffers of all slots */
+cl_int CommitArena( arena_t * arena );
+
+/* the buffer of a slot, and the array of buffers starting at it */
+cl_mem ArenaBuffer( const arena_t * arena, int slot );
+cl_mem * ArenaBuffers( arena_t * arena, int slot );
+
+/* bytes bytes of data for the start of a buffer of the arena, uploaded by the
+   next FlushArena */
+int ArenaWrite( arena_t * arena, cl_mem buffer, const void * data, size_t bytes );
+
+/* uploads what ArenaWrite collected, one blocking write per block */
+cl_int FlushArena( cl_command_queue queue, arena_t * arena );
+
+/* device memory of the blocks */
+size_t ArenaBytes( const arena_t * arena );
+
+/* the sub-buffers, the blocks and the host copies */
+void ReleaseArena( arena_t * arena );
+
+/* offset of a piece of bytes bytes, then the single allocation of all of them */
+size_t HostArenaReserve( host_arena_t * host, size_t bytes );
+int CommitHostArena( host_arena_t * host );
+#define HostArenaPointer(host,offset) ((void *) ((host)->base + (offset)))
+void ReleaseHostArena( host_arena_t * host );
+
+#endif
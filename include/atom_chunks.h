@@ -0,0 +1,79 @@
+#ifndef __ATOM_CHUNKS__
+#define __ATOM_CHUNKS__
+
+#include "OpenCL_data.h"
+#include "arena.h"
+
+/** largest chunk, so that all indices inside a kernel fit in an int */
+#define CHUNK_MAX_ATOMS (1 << 30)
+
+/** layout of the per-atom device arrays: natoms atoms in nchunks buffers
+    of chunk atoms each (the last one may be shorter), so that no buffer
+    is larger than CL_DEVICE_MAX_MEM_ALLOC_SIZE. the layout is the same
+    on every device */
+struct _chunk_layout {
+    int natoms;     /* total number of atoms */
+    int chunk;      /* atoms per chunk */
+    int nchunks;    /* number of chunks */
+    size_t align;   /* bytes, chunk starts and host backed buffer sizes are multiples of it */
+};
+typedef struct _chunk_layout chunk_layout_t;
+
+/* chunk size for buffers of at most maxalloc bytes, a multiple of align bytes */
+int SetChunkLayout( chunk_layout_t * lay, int natoms, cl_ulong maxalloc, size_t align );
+
+/* number of atoms in chunk c */
+int ChunkAtoms( const chunk_layout_t * lay, int c );
+
+/* number of chunks spanned by the atoms first .. first+n-1 */
+int ChunkPieces( const chunk_layout_t * lay, int first, int n );
+
+/* the part of the atoms first .. first+n-1 that lies in chunk c:
+   returns the number of atoms and their offset inside the chunk */
+int ChunkPiece( const chunk_layout_t * lay, int first, int n, int c, int * offset );
+
+/* one buffer per chunk. with host != NULL the buffers use the host storage
+   (CL_MEM_USE_HOST_PTR), chunk c starting at host + c*chunk, and are padded
+   to whole align bytes, that the host storage must provide */
+cl_mem * CreateChunkedArray( cl_context context, const chunk_layout_t * lay, cl_mem_flags flags,
+                             FPTYPE * host, cl_int * status );
+
+/* one slot per chunk in the arena of a device, returns the slot of chunk 0:
+   once the arena is committed ArenaBuffers( arena, slot ) is the array */
+int ReserveChunkedArray( arena_t * arena, const chunk_layout_t * lay );
+
+void ReleaseChunkedArray( const chunk_layout_t * lay, cl_mem * array );
+
+/* zeroes every chunk on the device, before the host writes any of it: the
+   pages of a CPU (sub-)device are then first touched by its own threads */
+cl_int TouchChunkedArray( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array );
+
+/* transfers of the atoms first .. first+n-1, host points to the data of atom first.
+   the wait list applies to the first piece, the event is the one of the last */
+cl_int ReadAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                  FPTYPE * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event );
+
+cl_int WriteAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   const FPTYPE * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event );
+
+/* maps the atoms first .. first+n-1, one pointer per piece in ptr[] */
+cl_int MapAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                 cl_map_flags flags, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event,
+                 FPTYPE ** ptr );
+
+cl_int UnmapAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   FPTYPE ** ptr );
+
+/* the periodic image counters of the atoms, one cl_int per atom in the same
+   chunks: reserved in the arena, zeroed and transferred like the arrays above */
+int ReserveImageArray( arena_t * arena, const chunk_layout_t * lay );
+
+cl_int ZeroImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array );
+
+cl_int ReadImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   cl_int * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event );
+
+cl_int WriteImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                    const cl_int * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event );
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __COUNTERS__
+#define __COUNTERS__
+
+#include "OpenCL_data.h"
+
+/** counters of the force kernels (layout must match opencl_kernels.cl) */
+#define CN_PAIRS   0        /* pairs whose distance is computed */
+#define CN_CUTOFF  1        /* pairs within the cutoff */
+#define CN_IMAGE   2        /* pairs moved by the minimum image */
+#define CN_IATOMS  3        /* i atoms */
+#define CN_NCOUNT  4
+
+/** kernel sets: opencl_force (energy) and opencl_force_noepot */
+#define CN_FORCE   0
+#define CN_NOEPOT  1
+#define CN_NSETS   2
+
+/** work model of the pair loop of the generic kernel: flops of a computed
+    distance (difference, minimum image, square), of the force of a pair
+    within the cutoff and of its energy and virial; the bytes loaded are a
+    j position per pair and the i position and the force sum per i atom */
+#define CN_FLOP_PAIR    20
+#define CN_FLOP_CUTOFF  17
+#define CN_FLOP_ENERGY  8
+#define CN_BYTES_PAIR   ( 3 * sizeof(FPTYPE) )
+#define CN_BYTES_IATOM  ( 9 * sizeof(FPTYPE) )
+
+/** work counted by the force kernels and their time. every work-item adds
+    its counts to 64-bit sums on the device, that are downloaded once at
+    the end of the run. the force launches of every "every"-th step (the
+    step after the metrics probes, or the next one when a metrics probe
+    takes it) carry profiling events; as with the metrics the events are
+    read at the next probe */
+struct _counters {
+    int every;              /* steps between two timings, 0 without counters */
+    int ndevices, nthreads;
+    double total[CN_NSETS][CN_NCOUNT];  /* counts of all devices */
+    long steps[CN_NSETS];   /* steps that ran each set */
+    double ktime[CN_NSETS]; /* summed force time of the timed steps, and their number */
+    long ntimed[CN_NSETS];
+    cl_event *kstart, *kend;  /* events of the probe in flight, per device */
+    int probing;            /* set of the probe in flight, -1 for none */
+    int due;                /* a timing waits for a step without a metrics probe */
+};
+typedef struct _counters counters_t;
+
+/* parses "counters [every]" */
+int ReadCountersOption( const char * line, counters_t * c );
+
+/* the device sums are bytes long, for nthreads work-items */
+int InitCounters( counters_t * c, int ndevices, int nthreads );
+size_t CountersBytes( const counters_t * c );
+
+/* empties the device sums of the first forces, before the MD loop */
+cl_int ZeroCounters( counters_t * c, cl_command_queue * queues, cl_mem * buffers );
+
+/* reads the events of the probe in flight */
+cl_int CollectCounters( counters_t * c );
+
+/* 1 if the force of step nfi, of kernel set "set", is timed: the last probe is
+   collected first. busy is 1 when a metrics probe times the step, the timing
+   then moves to the next step */
+int CountersProbe( counters_t * c, int nfi, int busy, int set );
+
+/* downloads and adds up the device sums, then prints per kernel set the pairs,
+   the shares within the cutoff and moved by the minimum image, the flops and
+   bytes of the model and, from the timed steps, the achieved rates */
+cl_int PrintCounters( counters_t * c, cl_command_queue * queues, cl_mem * buffers, FILE * out );
+
+void FreeCounters( counters_t * c );
+
+#endif
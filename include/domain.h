@@ -0,0 +1,53 @@
+#ifndef __DOMAIN__
+#define __DOMAIN__
+
+#ifdef _MPI
+#include <mpi.h>
+#include "OpenCL_data.h"
+#include "restart.h"
+
+/** spatial decomposition of the box over the MPI ranks: rank p owns the
+    atoms whose wrapped x coordinate lies in the slab [lo,hi), and keeps a
+    copy (ghost) of the atoms of the neighbor slabs closer than halo to its
+    edges. the host arrays hold the nlocal own atoms first, then the nghost
+    ghosts; the velocities and ids exist for the own atoms only */
+struct _domain {
+    int rank, nranks;       /* this rank and the number of ranks */
+    int noderank;           /* rank among the ranks of the same node */
+    int left, right;        /* neighbor ranks along x (periodic) */
+    FPTYPE box, lo, hi;     /* box length and slab of this rank */
+    FPTYPE halo;            /* width of the ghost region */
+    int natoms;             /* atoms of the whole system */
+    int nlocal, nghost;     /* own and ghost atoms */
+    int cap;                /* capacity of the host and device arrays */
+    int *id;                /* global index of the own atoms */
+    FPTYPE *rx, *ry, *rz;   /* positions of own atoms and ghosts */
+    FPTYPE *vx, *vy, *vz;   /* velocities of own atoms */
+    cl_int *ix, *iy, *iz;   /* periodic images of own atoms */
+    double *sendbuf, *recvbuf;  /* packing buffers of 10*cap doubles */
+};
+typedef struct _domain domain_t;
+
+/* rank, neighbors and slab; returns -1 if the slabs are thinner than halo */
+int DomainInit( domain_t * dom, int natoms, FPTYPE box, FPTYPE halo );
+
+/* the input read by rank 0 from fp, as a stream every rank can read */
+FILE * DomainInput( FILE * fp );
+
+/* read the restart, keeping the own atoms, and build the ghosts */
+int DomainReadRestart( domain_t * dom, restart_t * rst );
+
+/* send the atoms that left the slab to the neighbors, then rebuild the ghosts */
+int DomainExchange( domain_t * dom );
+
+/* positions and images of all atoms, by global index, in rx/ry/rz and ix/iy/iz on rank 0 */
+void DomainGather( domain_t * dom, FPTYPE * rx, FPTYPE * ry, FPTYPE * rz, cl_int * ix, cl_int * iy, cl_int * iz );
+
+/* sum of n values over all ranks, in place */
+void DomainSum( double * val, int n );
+
+void FreeDomain( domain_t * dom );
+
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef __ENGINE__
+#define __ENGINE__
+
+#include <stdio.h>
+
+#include "OpenCL_data.h"
+
+/** pieces of the MD engine shared by ljmd-cl and the python module: the
+    input, the physical constants, the kernel choice and the arguments of
+    the kernels, so that a change of a kernel signature is made once */
+
+/** build options of every program, before the ones of the input */
+#ifdef _USE_FLOAT
+#define KERNEL_FLAGS "-D_USE_FLOAT -cl-denorms-are-zero -cl-unsafe-math-optimizations"
+#else
+#define KERNEL_FLAGS "-cl-unsafe-math-optimizations"
+#endif
+
+/** a few physical constants */
+extern const FPTYPE kboltz;     /* boltzman constant in kcal/mol/K */
+extern const FPTYPE mvsq2e;     /* m*v^2 in kcal/mol */
+extern const FPTYPE pconv;      /* kcal/mol/A^3 in bar */
+
+/** thermostat kinds (numbering must match opencl_kernels.cl) */
+#define THERMO_NONE      0
+#define THERMO_BERENDSEN 1
+#define THERMO_VRESCALE  2
+#define THERMO_LANGEVIN  3
+extern const char *thermo_names[];
+
+/** number of entries in the on-device thermostat state buffer */
+#define THERMO_NSTATE 5
+
+/** barostat kinds */
+#define BARO_NONE      0
+#define BARO_BERENDSEN 1
+extern const char *baro_names[];
+
+/** number of entries in the on-device barostat state buffer */
+#define BARO_NSTATE 6
+
+/** host access modes of the "zerocopy" keyword */
+#define ZEROCOPY_OFF  0
+#define ZEROCOPY_ON   1
+#define ZEROCOPY_AUTO 2
+extern const char *zerocopy_names[];
+
+/** parsers of the text restart, index RESTART_SCANF / RESTART_MMAP of restart.h */
+extern const char *restart_names[];
+
+/** lanes of the force kernel of the "vector" keyword: 0 is the generic kernel,
+    VECTOR_AUTO takes 8 or 16 on CPU devices */
+#define VECTOR_AUTO -1
+
+/** structure to hold the thermostat settings */
+struct _thermo {
+    int kind;
+    FPTYPE temp, tau;
+    unsigned int seed;
+};
+typedef struct _thermo thermo_t;
+
+/** structure to hold the barostat settings */
+struct _baro {
+    int kind;
+    FPTYPE press, tau;      /* bar and fs */
+    FPTYPE kappa;           /* isothermal compressibility in 1/bar */
+};
+typedef struct _baro baro_t;
+
+/** structure to hold the fcc lattice that replaces the restart file */
+struct _lattice {
+    int ncell;              /* cells per box edge, natoms = 4*ncell^3; 0 reads the restart */
+    FPTYPE density, temp;   /* g/cm^3 (0 keeps the box of the input) and K */
+    unsigned int seed;
+};
+typedef struct _lattice lattice_t;
+
+/** the file names and the print interval of the twelve mandatory lines */
+struct _input {
+    char restfile[BLEN], trajfile[BLEN], ergfile[BLEN];
+    int nprint;
+};
+typedef struct _input input_t;
+
+/* the next line of the input without comments and blanks, -1 at the end */
+int ReadInputLine( FILE * fp, char * buf );
+
+/* the next optional keyword line, skipping blank and comment lines; -1 at the end */
+int ReadInputOption( FILE * fp, char * buf );
+
+/* the twelve mandatory lines: the system into sys, the files and the print
+   interval into in. the restart line may be an fcc lattice, see ReadLattice */
+int ReadInput( FILE * fp, mdsys_t * sys, input_t * in );
+
+/* parse "thermostat <kind> <temperature> <tau> [seed]" */
+int ReadThermostat( const char * line, thermo_t * thermo );
+
+/* parse "barostat berendsen <pressure> <tau> [compressibility]" */
+int ReadBarostat( const char * line, baro_t * baro );
+
+/* parse "fcc <density> <temperature> [seed]" given instead of the restart file.
+   a density in g/cm^3 sets the box, 0 keeps the box of the input */
+int ReadLattice( const char * line, lattice_t * lat, mdsys_t * sys );
+
+/* parse "zerocopy auto|on|off", "vector auto|off|8|16" and "restart mmap|scanf" */
+int ReadZerocopyOption( const char * line, int * zerocopy );
+int ReadVectorOption( const char * line, int * vector );
+int ReadRestartOption( const char * line, int * parser );
+
+/* lanes of the force kernel of a device for the "vector" setting; generic is set
+   when the input needs the generic kernel (pair table, fixed point forces) */
+int VectorWidth( cl_device_id device, int vector, int generic );
+
+/* temperature and pressure of the kinetic energy sum of the velocities squared
+   in sys->ekin, the potential energy and the virial; sys->ekin is scaled to kcal/mol */
+void SampleEnergies( mdsys_t * sys );
+
+/** the arguments of the force kernels (opencl_force and its variants, see
+    opencl_kernels.cl): the i atoms atom1 .. atom1+natoms1-1 of the chunk r
+    (global index ioff+k) against the nj atoms of the chunk rj (global index
+    joff+j). rdfbins is the size of the local histogram */
+struct _force_args {
+    cl_mem f[3], r[3], rj[3];
+    cl_int nj;
+    cl_mem epot;
+    FPTYPE c12, c6, rcsq, boxinv, box;
+    cl_int atom1, natoms1, ioff, joff, eaccum;
+    cl_mem table;
+    FPTYPE rminsq, dsinv;
+    cl_int ntab;
+    cl_mem rdf;
+    cl_int rdfbins;
+    FPTYPE rdfscale;
+    cl_mem baro;
+    cl_mem a[3];            /* fixed point sums, or f */
+    cl_mem cnt;
+};
+typedef struct _force_args force_args_t;
+
+/** indices of the arguments that change during the run (MPI ghosts) */
+#define FORCE_ARG_NJ      9
+#define FORCE_ARG_NATOMS1 17
+#define VERLET_FIRST_ARG_NATOMS  9
+#define VERLET_SECOND_ARG_NATOMS 6
+#define EKIN_ARG_NATOMS   3
+
+/* the parameters of the pair potential and the box of sys */
+void ForceConstants( force_args_t * a, const mdsys_t * sys );
+
+cl_int SetForceArgs( cl_kernel k, const force_args_t * a );
+
+/** the arguments of the kernels of the integration of one chunk of natoms atoms
+    (global index atom0 + k) */
+struct _chunk_args {
+    cl_mem r[3], v[3], f[3], a[3], im[3];
+    cl_int natoms, atom0;
+    FPTYPE dt, dtmf, box;
+    cl_mem thermo, baro, tstate, ekin;
+};
+typedef struct _chunk_args chunk_args_t;
+
+/* opencl_verlet_first, opencl_verlet_second and opencl_ekin of a chunk */
+cl_int SetChunkArgs( cl_kernel verlet_first, cl_kernel verlet_second, cl_kernel ekin, const chunk_args_t * c );
+
+#endif
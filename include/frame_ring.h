@@ -0,0 +1,93 @@
+#ifndef __FRAME_RING__
+#define __FRAME_RING__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** the sampled frames of a run in a POSIX shared memory ring, for readers on
+    the same node. the segment holds a header and nslots frame slots; a slot is
+    a record of the energies followed by the x, y and z positions of all atoms,
+    realsize bytes each (the FPTYPE of the writer). frame n (from 1) goes to slot
+    (n-1) % nslots. its sequence number is odd while the frame is written and
+    2n once it is complete, then head becomes n. the writer never waits for the
+    readers: a reader takes the newest frame, and one that is too slow finds its
+    slot overwritten and skips to the next newest */
+
+#define FRAME_RING_MAGIC   0x474e4952454d5246ULL   /* "FRMERING" */
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS   4
+#define FRAME_NAME_LEN     256
+
+struct _frame_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t natoms, nslots, realsize;
+    uint64_t slotbytes;         /* record and positions, rounded to 64 bytes */
+    uint64_t head;              /* last complete frame, 0 before the first */
+    uint32_t closed;            /* the writer has left */
+    uint32_t pad;
+};
+typedef struct _frame_header frame_header_t;
+
+struct _frame_record {
+    uint64_t seq;
+    int64_t nfi;
+    double temp, ekin, epot, etot, press, box;
+};
+typedef struct _frame_record frame_record_t;
+
+/** the writer side, ljmd-cl */
+struct _frame_ring {
+    char name[FRAME_NAME_LEN];  /* empty without the "publish" keyword */
+    int nslots;
+    size_t bytes;
+    frame_header_t *header;
+    uint64_t nframes;
+};
+typedef struct _frame_ring frame_ring_t;
+
+/** a frame of a reader. the positions point into the shared memory: they are
+    only known to be intact if FrameValid says so after they were used */
+struct _frame_view {
+    uint64_t frame;             /* number of the frame, from 1 */
+    uint64_t missed;            /* frames skipped since the previous one */
+    int64_t nfi;
+    double temp, ekin, epot, etot, press, box;
+    int natoms, realsize;
+    const void *rx, *ry, *rz;   /* float or double, realsize bytes */
+};
+typedef struct _frame_view frame_view_t;
+
+struct _frame_reader {
+    size_t bytes;
+    const frame_header_t *header;
+    uint64_t last;
+};
+typedef struct _frame_reader frame_reader_t;
+
+/* parses "publish <name> [slots]" */
+int ReadPublishOption( const char * line, frame_ring_t * ring );
+
+/* creates the segment ring->name for natoms atoms of realsize bytes */
+int OpenFrameRing( frame_ring_t * ring, int natoms, int realsize );
+
+/* copies a frame into the next slot. rx, ry and rz hold natoms reals */
+void PublishFrame( frame_ring_t * ring, int nfi, double temp, double ekin, double epot, double press, double box,
+                   const void * rx, const void * ry, const void * rz );
+
+/* marks the ring closed and removes its name, attached readers keep their mapping */
+void CloseFrameRing( frame_ring_t * ring );
+
+/* maps an existing ring for reading, -1 if there is none (yet) */
+int AttachFrameRing( frame_reader_t * reader, const char * name );
+
+/* the newest complete frame if it is newer than the last one taken: 1 with a
+   frame, 0 without a new one, -1 once the writer has closed the ring */
+int NextFrame( frame_reader_t * reader, frame_view_t * frame );
+
+/* 1 if the writer has not started to overwrite the slot of the frame */
+int FrameValid( const frame_reader_t * reader, const frame_view_t * frame );
+
+void DetachFrameRing( frame_reader_t * reader );
+
+#endif
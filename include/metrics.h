@@ -0,0 +1,57 @@
+#ifndef __METRICS__
+#define __METRICS__
+
+#include "OpenCL_data.h"
+
+/** formats of the metrics file */
+#define METRICS_PROM 0          /* Prometheus text exposition, rewritten */
+#define METRICS_JSON 1          /* one JSON object per export, appended */
+
+/** force kernel timings in the rolling mean, and steps between two timings */
+#define METRICS_WINDOW 32
+#define METRICS_PROBE  10
+
+/** live throughput of the run, exported every "interval" seconds of wall time.
+    the force kernels of every METRICS_PROBE-th step carry profiling events on
+    their first and last launch of each device, a probe due on a sampled step
+    waits for the next unsampled one; the events of a probe are read at the
+    next probe, so the timing does not stall the queues */
+struct _metrics {
+    int format;             /* METRICS_PROM or METRICS_JSON, -1 without metrics */
+    double interval;        /* seconds between two exports */
+    char file[BLEN];        /* output, the Prometheus file is replaced through file.tmp */
+    int ndevices;
+    int nfi0, nfilast;      /* first step of the run and step of the last export */
+    double tstart, tlast;   /* wall time of the first step and of the last export */
+    double *ktime;          /* ring of METRICS_WINDOW force times per device */
+    int nktime;             /* timings taken */
+    cl_event *kstart, *kend;  /* events of the probe in flight, per device */
+    int probing;            /* a probe is in flight */
+    int due;                /* step of the probe waiting for an unsampled step, -1 for none */
+};
+typedef struct _metrics metrics_t;
+
+/* parses "metrics prom|json <file> [seconds]" */
+int ReadMetricsOption( const char * line, metrics_t * m );
+
+/* starts the clocks at step nfi */
+int InitMetrics( metrics_t * m, int ndevices, int nfi );
+
+/* reads the events of the probe in flight into the rolling mean */
+int CollectMetrics( metrics_t * m );
+
+/* 1 if the force of step nfi is timed: the last probe is collected first. sample
+   is 1 on the sampled steps, that are timed only after METRICS_PROBE-1 of them */
+int MetricsProbe( metrics_t * m, int nfi, int sample );
+
+/* 1 if an export is due */
+int MetricsDue( const metrics_t * m );
+
+/* writes steps/s, ns/day, atom-steps/s, the mean force kernel time per device, the
+   host-device bytes, the output backlog (samples downloading and bytes buffered by
+   the energy and trajectory files) and the ETA of step sys->nfi */
+int WriteMetrics( metrics_t * m, const mdsys_t * sys, double copybytes, int pending, FILE * erg, FILE * traj );
+
+void FreeMetrics( metrics_t * m );
+
+#endif
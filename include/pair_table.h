@@ -0,0 +1,40 @@
+#ifndef __PAIR_TABLE__
+#define __PAIR_TABLE__
+
+#include "OpenCL_data.h"
+
+/** modifiers applied to the tabulated potential near the cutoff */
+#define TABLE_TRUNCATE 0
+#define TABLE_SHIFT    1
+#define TABLE_SWITCH   2
+
+/** interpolation coefficients per table interval (must match opencl_kernels.cl):
+    linear: e0 de f0 df, cubic: e0 e1 e2 e3 f0 f1 f2 f3 */
+#define TABLE_NCOEF_LINEAR 4
+#define TABLE_NCOEF_CUBIC  8
+
+/** structure to hold a pair potential tabulated in r^2 */
+struct _pair_table {
+    int npoints;            /* number of table intervals */
+    int cubic;              /* cubic instead of linear interpolation */
+    int modifier;           /* TABLE_TRUNCATE, TABLE_SHIFT or TABLE_SWITCH */
+    FPTYPE ron;             /* inner radius of the switching function */
+    FPTYPE rmin;            /* first tabulated distance */
+    FPTYPE rminsq, dsinv;   /* r^2 of the first point and inverse spacing in r^2 */
+    char file[BLEN];        /* "r energy force" file, generated from epsilon/sigma if empty */
+    FPTYPE *coef;           /* npoints * ncoef interpolation coefficients */
+};
+typedef struct _pair_table pair_table_t;
+
+/* parses "potential table <npoints> linear|cubic [shift|switch <r_on>] [rmin <r>] [file <name>]" */
+int ReadPairTableOption( const char * line, pair_table_t * tab );
+
+/* tabulates the potential between rmin and sys->rcut */
+int BuildPairTable( pair_table_t * tab, const mdsys_t * sys );
+
+/* size of the coefficient array in bytes */
+size_t PairTableSize( const pair_table_t * tab );
+
+void FreePairTable( pair_table_t * tab );
+
+#endif
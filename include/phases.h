@@ -0,0 +1,92 @@
+#ifndef __PHASES__
+#define __PHASES__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** latency histogram bins: the first PHASE_SUB*2 ticks one by one, then
+    PHASE_SUB bins per power of two, i.e. 1/8 relative resolution up to 2^64 */
+#define PHASE_SUB   8
+#define PHASE_BINS  ( 2 * PHASE_SUB + 60 * PHASE_SUB )
+#define PHASE_MAX   16
+
+/** host time of the phases of a loop. the loop marks the end of every phase
+    with PhaseLap, that charges the ticks since the previous mark to the
+    phase; the marks are the time stamp counter where there is one, else
+    CLOCK_MONOTONIC in ns, and the ticks are turned into seconds by the
+    monotonic clock of the whole run when the table is printed */
+struct _phase {
+    const char *name;
+    uint64_t count, sum, min, max;  /* laps and their ticks */
+    uint32_t hist[PHASE_BINS];
+};
+typedef struct _phase phase_t;
+
+struct _phases {
+    int nphases;
+    uint64_t last;                  /* tick of the previous mark */
+    uint64_t tick0;                 /* ticks and ns of PhaseStart, for the calibration */
+    double ns0;
+    phase_t phase[PHASE_MAX];
+};
+typedef struct _phases phases_t;
+
+static inline uint64_t PhaseTicks( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static inline int PhaseBin( uint64_t t )
+{
+    int e;
+
+    if (t < 2 * PHASE_SUB) return (int) t;
+    e = 63 - __builtin_clzll( t );      /* 2^e <= t < 2^(e+1), e >= 4 */
+    return 2 * PHASE_SUB + ( e - 4 ) * PHASE_SUB + (int) ( t >> ( e - 3 ) ) - PHASE_SUB;
+}
+
+/* charges the ticks since the previous mark to phase id */
+static inline void PhaseLap( phases_t * p, int id )
+{
+    uint64_t now = PhaseTicks(), t = now - p->last;
+    phase_t * ph = p->phase + id;
+
+    p->last = now;
+    ph->count++;
+    ph->sum += t;
+    if (t < ph->min) ph->min = t;
+    if (t > ph->max) ph->max = t;
+    ph->hist[PhaseBin( t )]++;
+}
+
+/* nphases phases named names, all empty */
+void InitPhases( phases_t * p, int nphases, const char ** names );
+
+/* the first mark, also the start of the calibration */
+void PhaseStart( phases_t * p );
+
+/* count, total, share of all laps, min, mean, p50, p99 and max of every phase
+   that ran, the percentiles from the histogram */
+void PrintPhases( const phases_t * p, FILE * out );
+
+/** the marks of the MD loop, compiled out without -D__PHASES */
+#ifdef __PHASES
+#define PHASE_START(p)   PhaseStart(p)
+#define PHASE_LAP(p,id)  PhaseLap(p,id)
+#else
+#define PHASE_START(p)
+#define PHASE_LAP(p,id)
+#endif
+
+#endif
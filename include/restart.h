@@ -0,0 +1,38 @@
+#ifndef __RESTART__
+#define __RESTART__
+
+#include "OpenCL_data.h"
+
+/** parsers of the text restart */
+#define RESTART_SCANF 0
+#define RESTART_MMAP  1
+
+/** lines between two entries of the line index of the mapped file */
+#define RESTART_BLOCK 1024
+
+/** text restart file: 2*natoms lines of three numbers, the positions of all
+    atoms then their velocities. the scanf parser reads the lines in order
+    through stdio, the mmap parser maps the file and parses any range of
+    lines in parallel (OpenMP) with a locale independent number parser */
+struct _restart {
+    int natoms;             /* atoms expected in the file */
+    int parser;             /* RESTART_SCANF or RESTART_MMAP */
+    FILE *fp;               /* scanf: the open file */
+    int next;               /* scanf: next line to read */
+    char *text;             /* mmap: the mapped file */
+    size_t size;            /* mmap: its size in bytes */
+    size_t *block;          /* mmap: offset of every RESTART_BLOCK-th line */
+    double seconds;         /* wall time spent opening and parsing */
+};
+typedef struct _restart restart_t;
+
+/* opens the restart; the mmap parser checks that it has 2*natoms lines */
+int OpenRestart( restart_t * rst, const char * file, int natoms, int parser );
+
+/* the lines first .. first+n-1 in x/y/z, the velocities start at line natoms.
+   the scanf parser only reads the lines in order */
+int ReadRestart( restart_t * rst, int first, int n, FPTYPE * x, FPTYPE * y, FPTYPE * z );
+
+void CloseRestart( restart_t * rst );
+
+#endif
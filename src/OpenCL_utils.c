@@ -138,6 +138,7 @@ void PrintPlatformShort(cl_platform_id platform) {
    }
 
    for (ii = 0; ii < numDevices; ii++) {
+     printf("    device %d\n", ii);
      PrintDeviceShort(deviceList[ii]);
    }
 
@@ -209,14 +210,162 @@ cl_platform_id FindPlatformWithDeviceType(cl_platform_id * platforms_list, int n
 
 }
 
-cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_context ** contexts, cl_command_queue ** cmdQueues , cl_uint * ngpu ) {
+/// class of the devices of an "all[:class]" spec, 0 if the name is unknown
+static cl_device_type DeviceClass(const char * name) {
+	if (!*name || !strcmp(name, "all")) return CL_DEVICE_TYPE_ALL;
+	if (!strcmp(name, "cpu")) return CL_DEVICE_TYPE_CPU;
+	if (!strcmp(name, "gpu")) return CL_DEVICE_TYPE_GPU;
+	if (!strcmp(name, "acc")) return CL_DEVICE_TYPE_ACCELERATOR;
+	return 0;
+}
+
+/// appends the device to the pool, with its share of the atoms
+static void AddToPool(cl_device_id device, double weight, cl_device_id * devices, double * weights, cl_uint * ndevices) {
+	devices[*ndevices] = device;
+	weights[*ndevices] = weight;
+	(*ndevices)++;
+}
+
+/** builds a pool of devices that may span several platforms:
+      all[:cpu|gpu|acc]      every available device of the class on every platform
+      p:d[@w][,p:d[@w]...]   device d of platform p, d = * for all of them, with
+                             the weight w of its atom share (default 1)
+    the indices are the ones of the platform and device lists of get-device-info.
+    returns the number of devices, 0 if the spec is not valid */
+static cl_uint ParseDevicePool(const char * spec, cl_platform_id * platforms_list, cl_uint num_platforms,
+                               cl_device_id * devices, double * weights, cl_uint maxdevices) {
+	cl_device_id * list = (cl_device_id *) malloc(sizeof(cl_device_id) * maxdevices);
+	cl_uint p, d, k, n, ndevices = 0;
+	cl_bool available;
+
+	if (!strncmp(spec, "all", 3) && (spec[3] == 0 || spec[3] == ':')) {
+		cl_device_type kind = DeviceClass(spec[3] ? spec + 4 : "");
+
+		if (!kind) {
+			fprintf(stderr, "Unknown device class in %s, use cpu, gpu or acc.\n", spec);
+			free(list);
+			return 0;
+		}
+		/* busy or disabled devices are left out */
+		for (p = 0; p < num_platforms; p++) {
+			if (clGetDeviceIDs(platforms_list[p], kind, maxdevices, list, &n) != CL_SUCCESS) continue;
+			for (d = 0; d < n; d++)
+				if (clGetDeviceInfo(list[d], CL_DEVICE_AVAILABLE, sizeof(available), &available, NULL) == CL_SUCCESS && available)
+					AddToPool(list[d], 1.0, devices, weights, &ndevices);
+		}
+	} else {
+		const char * item = spec;
+
+		while (*item) {
+			char any[2] = "";
+			double weight = 1.0;
+			int ip, id = -1, len = strcspn(item, ",");
+			char entry[STRINGSIZE];
+
+			snprintf(entry, sizeof(entry), "%.*s", len, item);
+			if (strchr(entry, '@')) weight = atof(strchr(entry, '@') + 1);
+			if ((sscanf(entry, "%d:%d", &ip, &id) < 2 && sscanf(entry, "%d:%1[*]", &ip, any) < 2)
+			    || ip < 0 || ip >= (int) num_platforms || !(weight > 0.0)) {
+				fprintf(stderr, "Invalid device %s, use platform:device[@weight] or platform:*[@weight].\n", entry);
+				ndevices = 0;
+				break;
+			}
+			if (clGetDeviceIDs(platforms_list[ip], CL_DEVICE_TYPE_ALL, maxdevices, list, &n) != CL_SUCCESS) n = 0;
+			if (id >= (int) n) {
+				fprintf(stderr, "Platform %d has no device %d.\n", ip, id);
+				ndevices = 0;
+				break;
+			}
+			for (d = 0; d < n; d++) {
+				if (id >= 0 && d != (cl_uint) id) continue;
+				if (clGetDeviceInfo(list[d], CL_DEVICE_AVAILABLE, sizeof(available), &available, NULL) != CL_SUCCESS || !available) {
+					fprintf(stderr, "Device %d:%d is not available.\n", ip, d);
+					free(list);
+					return 0;
+				}
+				for (k = 0; k < ndevices; k++)
+					if (devices[k] == list[d]) {
+						fprintf(stderr, "Device %d:%d is listed more than once.\n", ip, d);
+						free(list);
+						return 0;
+					}
+				AddToPool(list[d], weight, devices, weights, &ndevices);
+			}
+			item += len;
+			if (*item == ',') item++;
+		}
+	}
+	free(list);
+	return ndevices;
+}
+
+/** replaces every CPU device of the pool by its sub-devices, one per NUMA node
+    ("numa") or n of equal compute units, that share the weight of the device.
+    returns the number of devices, 0 if a device cannot be partitioned */
+static cl_uint PartitionDevices(const char * how, cl_device_id ** devices, double ** weights, cl_uint ndevices) {
+	cl_device_partition_property props[3] = { 0, 0, 0 };
+	cl_device_id * all = NULL, * sub;
+	double * wall = NULL;
+	cl_uint u, k, nsub, cu, nall = 0;
+	cl_device_type type;
+	char name[255];
+
+	for (u = 0; u < ndevices; u++) {
+		clGetDeviceInfo((*devices)[u], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+		clGetDeviceInfo((*devices)[u], CL_DEVICE_NAME, sizeof(name), name, NULL);
+		nsub = 1;
+		sub = (cl_device_id *) malloc(sizeof(cl_device_id));
+		sub[0] = (*devices)[u];
+		if (type & CL_DEVICE_TYPE_CPU) {
+			if (!strcmp(how, "numa")) {
+				props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+				props[1] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+			} else {
+				int parts = strtol(how, NULL, 10);
+
+				clGetDeviceInfo((*devices)[u], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu), &cu, NULL);
+				if (parts < 1 || (cl_uint) parts > cu) {
+					fprintf(stderr, "%s: cannot split %u compute units in %s parts, use numa or 1..%u.\n", name, cu, how, cu);
+					free(sub);
+					return 0;
+				}
+				props[0] = CL_DEVICE_PARTITION_EQUALLY;
+				props[1] = cu / parts;
+			}
+			if (clCreateSubDevices((*devices)[u], props, 0, NULL, &nsub) != CL_SUCCESS || nsub < 1) {
+				fprintf(stderr, "%s cannot be partitioned by %s.\n", name, how);
+				free(sub);
+				return 0;
+			}
+			sub = (cl_device_id *) realloc(sub, sizeof(cl_device_id) * nsub);
+			clCreateSubDevices((*devices)[u], props, nsub, sub, NULL);
+		}
+		all = (cl_device_id *) realloc(all, sizeof(cl_device_id) * (nall + nsub));
+		wall = (double *) realloc(wall, sizeof(double) * (nall + nsub));
+		for (k = 0; k < nsub; k++) AddToPool(sub[k], (*weights)[u] / nsub, all, wall, &nall);
+		free(sub);
+	}
+	free(*devices);
+	free(*weights);
+	*devices = all;
+	*weights = wall;
+	return nall;
+}
+
+cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_context ** contexts, cl_command_queue ** cmdQueues , cl_uint * ngpu, double ** weights ) {
 
   cl_int status;
-  cl_uint numPlatforms, numDevices;
+  cl_uint numPlatforms, numDevices, maxDevices = 0;
   cl_device_type device_kind;
   cl_platform_id * platforms_list;
   cl_platform_id platform;
   cl_uint u;
+  char spec[STRINGSIZE], * how;
+
+  /** a /numa or /n suffix partitions the CPU devices */
+  snprintf( spec, sizeof(spec), "%s", device_type );
+  if( ( how = strchr( spec, '/' ) ) ) *how++ = 0;
+  device_type = spec;
 
   /** Initialize the Platform. Program considers a single platform. */
   if ( ( status = clGetPlatformIDs( 0, NULL, &numPlatforms ) ) != CL_SUCCESS ) {
@@ -236,8 +385,27 @@ cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_co
     exit( 1 );
   }
 
+  ///a pool holds at most every device of every platform
+  for( u = 0; u < numPlatforms; u++ )
+    if( clGetDeviceIDs( platforms_list[u], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices ) == CL_SUCCESS )
+      maxDevices += numDevices;
+
   *ngpu = 1;
-  
+
+  if( strchr( device_type, ':' ) || !strncmp( device_type, "all", 3 ) ) {
+    if (!(*devices = (cl_device_id *) malloc(sizeof(cl_device_id)*(maxDevices+1))) ||
+        !(*weights = (double *) malloc(sizeof(double)*(maxDevices+1)))) {
+      fprintf ( stderr, "unable to allocate memory for %u device ids\n", maxDevices);
+      exit( 1 );
+    }
+    *ngpu = ParseDevicePool( device_type, platforms_list, numPlatforms, *devices, *weights, maxDevices );
+    if( *ngpu == 0 ) {
+      fprintf( stderr, "No device matches %s.\n", device_type );
+      exit( 1 );
+    }
+    free(platforms_list);
+  } else {
+
   if( !strncmp( device_type, "gpu", 3 ) ) {
     if( strlen(device_type)==3 )
       fprintf( stdout, "\nUSING GPU\n" );
@@ -269,11 +437,38 @@ cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_co
   fprintf( stdout, "platform[%p]: Found a device.\n", platform );
 #endif
 
-   ///allocate memory for devices, contexts and command queues
+   ///allocate memory for devices and their equal shares of the atoms
    if (!(*devices = (cl_device_id *) malloc(sizeof(cl_device_id)*(*ngpu)))) {
      fprintf ( stderr, "unable to allocate memory for %u device ids\n", *ngpu);
      exit( 1 );
    }
+   if (!(*weights = (double *) malloc(sizeof(double)*(*ngpu)))) {
+     fprintf ( stderr, "unable to allocate memory for %u device weights\n", *ngpu);
+     exit( 1 );
+   }
+   for(u=0;u<*ngpu;u++) (*weights)[u] = 1.0;
+
+   if ((status = clGetDeviceIDs(  platform, device_kind, *ngpu, *devices, NULL)) != CL_SUCCESS) {
+     fprintf ( stderr, "platform[%p]: Unable to enumerate the devices: %s\n",  platform, CLErrString( status ) );
+     exit( 1 );
+   }
+  }
+
+   if( how && !( *ngpu = PartitionDevices( how, devices, weights, *ngpu ) ) ) exit( 1 );
+
+   if( how || spec[0] == 'a' || strchr( spec, ':' ) ) {
+     fprintf( stdout, "\nUSING %u DEVICES\n", *ngpu );
+     for( u = 0; u < *ngpu; u++ ) {
+       char name[255], pname[255];
+
+       clGetDeviceInfo( (*devices)[u], CL_DEVICE_NAME, sizeof(name), name, NULL );
+       clGetDeviceInfo( (*devices)[u], CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL );
+       clGetPlatformInfo( platform, CL_PLATFORM_NAME, sizeof(pname), pname, NULL );
+       fprintf( stdout, "    device %u: %s (%s), weight %g\n", u, name, pname, (*weights)[u] );
+     }
+   }
+
+   ///allocate memory for contexts and command queues
    if (!(*contexts = (cl_context *) malloc(sizeof(cl_context)*(*ngpu)))) {
      fprintf ( stderr, "unable to allocate memory for %u contexts\n", *ngpu);
      exit( 1 );
@@ -283,18 +478,14 @@ cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_co
      exit( 1 );
    }
 
-   if ((status = clGetDeviceIDs(  platform, device_kind, *ngpu, *devices, NULL)) != CL_SUCCESS) {
-     fprintf ( stderr, "platform[%p]: Unable to enumerate the devices: %s\n",  platform, CLErrString( status ) );
-     exit( 1 );
-   }
-
-   ///create 1 context per gpu (or cpu); supposed to be faster than having
-   ///one context for everything
+   ///create 1 context per device; supposed to be faster than having
+   ///one context for everything, and the devices of a pool may belong
+   ///to different platforms
    for(u=0;u<*ngpu;u++) {
      (*contexts)[u] = clCreateContext( NULL, 1, (*devices)+u, NULL, NULL, &status );
   
      if ( status != CL_SUCCESS ) {
-       fprintf ( stderr, "platform[%p]: Unable to init OpenCL context: %s\n", platform, CLErrString( status ) );
+       fprintf ( stderr, "device %u: Unable to init OpenCL context: %s\n", u, CLErrString( status ) );
        exit( 1 );     
      }
    }
@@ -304,7 +495,7 @@ cl_int InitOpenCLEnvironment( char * device_type, cl_device_id ** devices, cl_co
      (*cmdQueues)[u] = clCreateCommandQueue( (*contexts)[u], (*devices)[u], 0, &status );
   
      if ( status != CL_SUCCESS ) {
-       fprintf ( stderr, "platform[%p]: Unable to init OpenCL command queue: %s\n", platform, CLErrString( status ) );
+       fprintf ( stderr, "device %u: Unable to init OpenCL command queue: %s\n", u, CLErrString( status ) );
        exit( 1 );
      }
    }
@@ -404,3 +595,13 @@ double second()
     sec = tmp.tv_sec + ((double)tmp.tv_usec)/1000000.0;
     return sec;
 }
+
+double cpusecond()
+
+/** Returns the CPU seconds consumed so far by the calling thread */
+{
+
+    struct timespec tmp;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &tmp );
+    return tmp.tv_sec + ((double)tmp.tv_nsec)/1000000000.0;
+}
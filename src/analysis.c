@@ -0,0 +1,112 @@
+/** Structure and dynamics computed during the run.
+
+  The radial distribution function is counted by the force kernel of
+  the sampled steps, only the histogram leaves the device. The counts
+  include both orders of a pair, so g(r) in bin b is the count of
+  nsamples samples divided by nsamples * natoms * rho * V_b, with V_b
+  the volume of the spherical shell of the bin.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "analysis.h"
+
+int ReadRdfOption( const char * line, rdf_t * rdf )
+{
+    rdf->every = 10;
+    if (sscanf(line, "%*s %d %s %d", &rdf->nbins, rdf->file, &rdf->every) < 2 || rdf->nbins < 1 || rdf->every < 1) {
+        fprintf(stderr, "usage: rdf <nbins> <file> [samples between two outputs]\n");
+        return -1;
+    }
+    return 0;
+}
+
+int InitRdf( rdf_t * rdf )
+{
+    rdf->nsamples = 0;
+    rdf->hist = (double *) calloc(rdf->nbins, sizeof(double));
+    rdf->counts = (cl_uint *) calloc(rdf->nbins, sizeof(cl_uint));
+    return ( rdf->hist && rdf->counts ) ? 0 : -1;
+}
+
+int WriteRdf( const rdf_t * rdf, const mdsys_t * sys )
+{
+    double dr = sys->rcut / rdf->nbins;
+    double rho = sys->natoms / ( (double) sys->box * sys->box * sys->box );
+    FILE * fp;
+    int b;
+
+    if (!rdf->nsamples) return 0;
+    fp = fopen(rdf->file, "w");
+    if (!fp) {
+        perror("cannot write rdf file");
+        return -1;
+    }
+    fprintf(fp, "# g(r) of %d samples, %d bins of %g A\n", rdf->nsamples, rdf->nbins, dr);
+    for (b = 0; b < rdf->nbins; ++b) {
+        double shell = 4.0 / 3.0 * M_PI * dr * dr * dr * ( pow(b + 1.0, 3.0) - pow(b, 3.0) );
+
+        fprintf(fp, "%12.6f %14.8f\n", ( b + 0.5 ) * dr, rdf->hist[b] / ( rdf->nsamples * sys->natoms * rho * shell ));
+    }
+    fclose(fp);
+    return 0;
+}
+
+void FreeRdf( rdf_t * rdf )
+{
+    free(rdf->hist);
+    free(rdf->counts);
+    rdf->hist = NULL;
+    rdf->counts = NULL;
+}
+
+int ReadCorrOption( const char * line, corr_t * corr )
+{
+    if (sscanf(line, "%*s %d %d %s", &corr->nlags, &corr->every, corr->file) < 3 || corr->nlags < 1 || corr->every < 1) {
+        fprintf(stderr, "usage: correlation <nlags> <steps between two samples> <file>\n");
+        return -1;
+    }
+    return 0;
+}
+
+int WriteCorr( const corr_t * corr, const mdsys_t * sys, const FPTYPE * acc, int nparts )
+{
+    int nlags = ( corr->nsamples < corr->nlags ) ? corr->nsamples : corr->nlags;
+    double dt = corr->every * sys->dt, dmsd = 0.0, dvacf = 0.0;
+    double * msd, * vacf;
+    FILE * fp;
+    int d, i;
+
+    if (nlags < 1) return 0;
+    msd = (double *) calloc(2 * nlags, sizeof(double));
+    vacf = msd + nlags;
+    for (d = 0; d < nlags; ++d) {
+        double norm = (double) sys->natoms * ( corr->nsamples - d );
+
+        for (i = 0; i < nparts; ++i) {
+            msd[d] += acc[2 * ( i * corr->nlags + d )];
+            vacf[d] += acc[2 * ( i * corr->nlags + d ) + 1];
+        }
+        msd[d] /= norm;
+        vacf[d] /= norm;
+        if (d > 0) dvacf += 0.5 * dt * ( vacf[d-1] + vacf[d] ) / 3.0;
+    }
+    if (nlags > 1) dmsd = msd[nlags-1] / ( 6.0 * ( nlags - 1 ) * dt );
+
+    fp = fopen(corr->file, "w");
+    if (!fp) {
+        perror("cannot write correlation file");
+        free(msd);
+        return -1;
+    }
+    /* 1 A^2/fs = 0.1 cm^2/s */
+    fprintf(fp, "# %d samples every %g fs; D(msd) = %g cm^2/s, D(vacf) = %g cm^2/s\n", corr->nsamples, dt,
+            0.1 * dmsd, 0.1 * dvacf);
+    fprintf(fp, "# t(fs) msd(A^2) vacf(A^2/fs^2)\n");
+    for (d = 0; d < nlags; ++d)
+        fprintf(fp, "%12.4f %16.8g %16.8g\n", d * dt, msd[d], vacf[d]);
+    fclose(fp);
+    free(msd);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/** Memory arenas.
+
+  A device gets all its buffers from a few large allocations: the slots
+  are reserved while their sizes are worked out, the blocks are created
+  once, each slot becomes a sub-buffer of its block and one call releases
+  everything. Slots are placed in reservation order and a new block is
+  opened when the next slot would make the current one larger than the
+  device can allocate. The small state buffers get their initial contents
+  through a host copy of the written range of their block, uploaded in a
+  single transfer. The host side keeps its arrays in one page aligned
+  allocation as well.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+static size_t round_up( size_t n, size_t align )
+{
+    return ( (n + align - 1) / align ) * align;
+}
+
+void InitArena( arena_t * arena, cl_context context, cl_device_id device, cl_mem_flags flags )
+{
+    cl_uint bits = 0;
+    cl_ulong maxalloc = 0;
+
+    memset( arena, 0, sizeof(arena_t) );
+    clGetDeviceInfo( device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(bits), &bits, NULL );
+    clGetDeviceInfo( device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxalloc), &maxalloc, NULL );
+    arena->context = context;
+    arena->flags = CL_MEM_READ_WRITE | flags;
+    arena->align = ( bits >= 8 ) ? bits / 8 : 1;
+    arena->maxalloc = maxalloc;
+}
+
+int ArenaReserve( arena_t * arena, size_t bytes )
+{
+    int s = arena->nslots, b = arena->nblocks - 1;
+    size_t origin;
+
+    if (bytes == 0) bytes = 1;
+    if (s == arena->maxslots) {
+        arena->maxslots = arena->maxslots ? 2 * arena->maxslots : 64;
+        arena->blockof = (int *) realloc( arena->blockof, arena->maxslots * sizeof(int) );
+        arena->origin = (size_t *) realloc( arena->origin, arena->maxslots * sizeof(size_t) );
+        arena->size = (size_t *) realloc( arena->size, arena->maxslots * sizeof(size_t) );
+    }
+
+    origin = (b >= 0) ? round_up( arena->used[b], arena->align ) : 0;
+    if (b < 0 || origin + bytes > arena->maxalloc) {
+        b = arena->nblocks++;
+        arena->used = (size_t *) realloc( arena->used, arena->nblocks * sizeof(size_t) );
+        origin = 0;
+    }
+    arena->blockof[s] = b;
+    arena->origin[s] = origin;
+    arena->size[s] = bytes;
+    arena->used[b] = origin + bytes;
+    return arena->nslots++;
+}
+
+cl_int CommitArena( arena_t * arena )
+{
+    cl_int status = CL_SUCCESS, err;
+    int b, s;
+
+    arena->block = (cl_mem *) calloc( arena->nblocks, sizeof(cl_mem) );
+    arena->buffer = (cl_mem *) calloc( arena->nslots, sizeof(cl_mem) );
+    arena->stage = (char **) calloc( arena->nblocks, sizeof(char *) );
+    arena->lo = (size_t *) calloc( arena->nblocks, sizeof(size_t) );
+    arena->hi = (size_t *) calloc( arena->nblocks, sizeof(size_t) );
+
+    for (b = 0; b < arena->nblocks && status == CL_SUCCESS; ++b)
+        arena->block[b] = clCreateBuffer( arena->context, arena->flags, arena->used[b], NULL, &status );
+    for (s = 0; s < arena->nslots && status == CL_SUCCESS; ++s) {
+        cl_buffer_region region = { arena->origin[s], arena->size[s] };
+
+        arena->buffer[s] = clCreateSubBuffer( arena->block[arena->blockof[s]], CL_MEM_READ_WRITE,
+                                              CL_BUFFER_CREATE_TYPE_REGION, &region, &err );
+        status = err;
+    }
+    return status;
+}
+
+cl_mem ArenaBuffer( const arena_t * arena, int slot )
+{
+    return arena->buffer[slot];
+}
+
+cl_mem * ArenaBuffers( arena_t * arena, int slot )
+{
+    return arena->buffer + slot;
+}
+
+int ArenaWrite( arena_t * arena, cl_mem buffer, const void * data, size_t bytes )
+{
+    int b, slot;
+    size_t lo, hi;
+
+    /* the state buffers that get written are the first slots */
+    for (slot = 0; slot < arena->nslots && arena->buffer[slot] != buffer; ++slot) ;
+    if (slot == arena->nslots || bytes > arena->size[slot]) return -1;
+    b = arena->blockof[slot];
+    lo = arena->origin[slot];
+    hi = lo + bytes;
+    if (!arena->stage[b]) {
+        arena->stage[b] = (char *) malloc( bytes );
+        arena->lo[b] = lo;
+        arena->hi[b] = hi;
+    } else if (lo < arena->lo[b] || hi > arena->hi[b]) {
+        /* grow the host copy to the union of both ranges */
+        size_t nlo = (lo < arena->lo[b]) ? lo : arena->lo[b], nhi = (hi > arena->hi[b]) ? hi : arena->hi[b];
+        char * stage = (char *) calloc( nhi - nlo, 1 );
+
+        if (stage) memcpy( stage + arena->lo[b] - nlo, arena->stage[b], arena->hi[b] - arena->lo[b] );
+        free( arena->stage[b] );
+        arena->stage[b] = stage;
+        arena->lo[b] = nlo;
+        arena->hi[b] = nhi;
+    }
+    if (!arena->stage[b]) return -1;
+    memcpy( arena->stage[b] + lo - arena->lo[b], data, bytes );
+    return 0;
+}
+
+cl_int FlushArena( cl_command_queue queue, arena_t * arena )
+{
+    cl_int status = CL_SUCCESS;
+    int b;
+
+    for (b = 0; b < arena->nblocks; ++b) {
+        if (!arena->stage[b]) continue;
+        status |= clEnqueueWriteBuffer( queue, arena->block[b], CL_TRUE, arena->lo[b], arena->hi[b] - arena->lo[b],
+                                        arena->stage[b], 0, NULL, NULL );
+        free( arena->stage[b] );
+        arena->stage[b] = NULL;
+    }
+    return status;
+}
+
+size_t ArenaBytes( const arena_t * arena )
+{
+    size_t bytes = 0;
+    int b;
+
+    for (b = 0; b < arena->nblocks; ++b) bytes += arena->used[b];
+    return bytes;
+}
+
+void ReleaseArena( arena_t * arena )
+{
+    int b, s;
+
+    for (s = 0; s < arena->nslots; ++s)
+        if (arena->buffer && arena->buffer[s]) clReleaseMemObject( arena->buffer[s] );
+    for (b = 0; b < arena->nblocks; ++b) {
+        if (arena->block && arena->block[b]) clReleaseMemObject( arena->block[b] );
+        if (arena->stage) free( arena->stage[b] );
+    }
+    free( arena->blockof );
+    free( arena->origin );
+    free( arena->size );
+    free( arena->used );
+    free( arena->block );
+    free( arena->buffer );
+    free( arena->stage );
+    free( arena->lo );
+    free( arena->hi );
+    memset( arena, 0, sizeof(arena_t) );
+}
+
+size_t HostArenaReserve( host_arena_t * host, size_t bytes )
+{
+    size_t offset;
+
+    if (!host->align) host->align = sysconf( _SC_PAGESIZE );
+    offset = host->size;
+    host->size += round_up( bytes, host->align );
+    return offset;
+}
+
+int CommitHostArena( host_arena_t * host )
+{
+    void * ptr;
+
+    if (!host->align) host->align = sysconf( _SC_PAGESIZE );
+    if (posix_memalign( &ptr, host->align, host->size ? host->size : host->align )) return -1;
+    host->base = (char *) ptr;
+    return 0;
+}
+
+void ReleaseHostArena( host_arena_t * host )
+{
+    free( host->base );
+    host->base = NULL;
+    host->size = 0;
+}
@@ -0,0 +1,201 @@
+/** Chunked per-atom arrays.
+
+  A device cannot allocate a buffer larger than CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+  so large systems keep every per-atom array in several buffers of the same
+  number of atoms. The kernels work on one chunk at a time and the host
+  transfers below split a range of atoms into one piece per chunk.
+ */
+
+#include "atom_chunks.h"
+
+int SetChunkLayout( chunk_layout_t * lay, int natoms, cl_ulong maxalloc, size_t align )
+{
+    size_t step = align / sizeof(FPTYPE);
+    cl_ulong chunk = maxalloc / sizeof(FPTYPE);
+
+    if (step < 1) step = 1;
+    if (chunk > CHUNK_MAX_ATOMS) chunk = CHUNK_MAX_ATOMS;
+    chunk -= chunk % step;
+    if (chunk < 1) return -1;
+
+    lay->natoms = natoms;
+    lay->chunk = (chunk < (cl_ulong) natoms) ? (int) chunk : natoms;
+    lay->nchunks = (natoms + lay->chunk - 1) / lay->chunk;
+    lay->align = step * sizeof(FPTYPE);
+    return 0;
+}
+
+int ChunkAtoms( const chunk_layout_t * lay, int c )
+{
+    int left = lay->natoms - c * lay->chunk;
+
+    return (left < lay->chunk) ? left : lay->chunk;
+}
+
+int ChunkPieces( const chunk_layout_t * lay, int first, int n )
+{
+    if (n <= 0) return 0;
+    return (first + n - 1) / lay->chunk - first / lay->chunk + 1;
+}
+
+cl_mem * CreateChunkedArray( cl_context context, const chunk_layout_t * lay, cl_mem_flags flags,
+                             FPTYPE * host, cl_int * status )
+{
+    cl_mem * array = (cl_mem *) malloc( sizeof(cl_mem) * lay->nchunks );
+    int c;
+
+    *status = CL_SUCCESS;
+    for (c = 0; c < lay->nchunks; ++c) {
+        cl_int err;
+        size_t size = ChunkAtoms( lay, c ) * sizeof(FPTYPE);
+
+        if (host) {
+            size = ( (size + lay->align - 1) / lay->align ) * lay->align;
+            array[c] = clCreateBuffer( context, flags | CL_MEM_USE_HOST_PTR, size, host + (size_t) c * lay->chunk, &err );
+        } else
+            array[c] = clCreateBuffer( context, flags, size, NULL, &err );
+        *status |= err;
+    }
+    return array;
+}
+
+/* the helpers below work on arrays of size bytes per atom */
+static int reserve_chunks( arena_t * arena, const chunk_layout_t * lay, size_t size )
+{
+    int c, slot = ArenaReserve( arena, ChunkAtoms( lay, 0 ) * size );
+
+    for (c = 1; c < lay->nchunks; ++c) ArenaReserve( arena, ChunkAtoms( lay, c ) * size );
+    return slot;
+}
+
+static cl_int zero_chunks( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, size_t size )
+{
+    const cl_long zero = 0;
+    cl_int status = CL_SUCCESS;
+    int c;
+
+    for (c = 0; c < lay->nchunks; ++c)
+        status |= clEnqueueFillBuffer( queue, array[c], &zero, size, 0, ChunkAtoms( lay, c ) * size, 0, NULL, NULL );
+    return status | clFinish( queue );
+}
+
+int ReserveChunkedArray( arena_t * arena, const chunk_layout_t * lay )
+{
+    return reserve_chunks( arena, lay, sizeof(FPTYPE) );
+}
+
+int ReserveImageArray( arena_t * arena, const chunk_layout_t * lay )
+{
+    return reserve_chunks( arena, lay, sizeof(cl_int) );
+}
+
+cl_int TouchChunkedArray( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array )
+{
+    return zero_chunks( queue, lay, array, sizeof(FPTYPE) );
+}
+
+cl_int ZeroImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array )
+{
+    return zero_chunks( queue, lay, array, sizeof(cl_int) );
+}
+
+void ReleaseChunkedArray( const chunk_layout_t * lay, cl_mem * array )
+{
+    int c;
+
+    for (c = 0; c < lay->nchunks; ++c) clReleaseMemObject( array[c] );
+    free( array );
+}
+
+int ChunkPiece( const chunk_layout_t * lay, int first, int n, int c, int * offset )
+{
+    /* the end of the last chunk may lie beyond INT_MAX, natoms does not */
+    long lo = (long) c * lay->chunk, hi = lo + lay->chunk;
+
+    if (hi > lay->natoms) hi = lay->natoms;
+    if (lo < first) lo = first;
+    if (hi > (long) first + n) hi = (long) first + n;
+    *offset = (int) ( lo - (long) c * lay->chunk );
+    return (int) ( hi - lo );
+}
+
+static cl_int read_chunks( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                           char * host, size_t size, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    cl_int status = CL_SUCCESS;
+    int c, c0 = first / lay->chunk, c1 = c0 + ChunkPieces( lay, first, n ), offset, count;
+
+    for (c = c0; c < c1; ++c) {
+        count = ChunkPiece( lay, first, n, c, &offset );
+        status |= clEnqueueReadBuffer( queue, array[c], blocking, offset * size, count * size,
+                                       host + ( (size_t) c * lay->chunk + offset - first ) * size,
+                                       (c == c0) ? nwait : 0, (c == c0) ? wait : NULL, (c == c1-1) ? event : NULL );
+    }
+    return status;
+}
+
+static cl_int write_chunks( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                            const char * host, size_t size, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    cl_int status = CL_SUCCESS;
+    int c, c0 = first / lay->chunk, c1 = c0 + ChunkPieces( lay, first, n ), offset, count;
+
+    for (c = c0; c < c1; ++c) {
+        count = ChunkPiece( lay, first, n, c, &offset );
+        status |= clEnqueueWriteBuffer( queue, array[c], blocking, offset * size, count * size,
+                                        host + ( (size_t) c * lay->chunk + offset - first ) * size,
+                                        (c == c0) ? nwait : 0, (c == c0) ? wait : NULL, (c == c1-1) ? event : NULL );
+    }
+    return status;
+}
+
+cl_int ReadAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                  FPTYPE * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    return read_chunks( queue, lay, array, first, n, (char *) host, sizeof(FPTYPE), blocking, nwait, wait, event );
+}
+
+cl_int WriteAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   const FPTYPE * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    return write_chunks( queue, lay, array, first, n, (const char *) host, sizeof(FPTYPE), blocking, nwait, wait, event );
+}
+
+cl_int ReadImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   cl_int * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    return read_chunks( queue, lay, array, first, n, (char *) host, sizeof(cl_int), blocking, nwait, wait, event );
+}
+
+cl_int WriteImages( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                    const cl_int * host, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event )
+{
+    return write_chunks( queue, lay, array, first, n, (const char *) host, sizeof(cl_int), blocking, nwait, wait, event );
+}
+
+cl_int MapAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                 cl_map_flags flags, cl_bool blocking, cl_uint nwait, const cl_event * wait, cl_event * event,
+                 FPTYPE ** ptr )
+{
+    cl_int status = CL_SUCCESS, err;
+    int c, c0 = first / lay->chunk, c1 = c0 + ChunkPieces( lay, first, n ), offset, count;
+
+    for (c = c0; c < c1; ++c) {
+        count = ChunkPiece( lay, first, n, c, &offset );
+        ptr[c-c0] = (FPTYPE *) clEnqueueMapBuffer( queue, array[c], blocking, flags, offset * sizeof(FPTYPE), count * sizeof(FPTYPE),
+                                                   (c == c0) ? nwait : 0, (c == c0) ? wait : NULL, (c == c1-1) ? event : NULL, &err );
+        status |= err;
+    }
+    return status;
+}
+
+cl_int UnmapAtoms( cl_command_queue queue, const chunk_layout_t * lay, cl_mem * array, int first, int n,
+                   FPTYPE ** ptr )
+{
+    cl_int status = CL_SUCCESS;
+    int c, c0 = first / lay->chunk, c1 = c0 + ChunkPieces( lay, first, n );
+
+    for (c = c0; c < c1; ++c)
+        status |= clEnqueueUnmapMemObject( queue, array[c], ptr[c-c0], 0, NULL, NULL );
+    return status;
+}
@@ -0,0 +1,149 @@
+/** Work counters of the force kernels.
+
+  The kernels built with -D_COUNTERS add, per work-item, the pairs whose
+  distance they compute, the pairs within the cutoff, the pairs the
+  minimum image moved and the i atoms to 64-bit sums that stay on the
+  device for the whole run. The flops and bytes are the model of
+  counters.h applied to these counts, the time is the span from the
+  start of the first force launch to the end of the last one of the
+  slowest device, on the timed steps of each kernel. With MPI the counts
+  are summed over the ranks and the time is the one of rank 0.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "counters.h"
+#ifdef _MPI
+#include "domain.h"
+#endif
+
+static const char * set_names[CN_NSETS] = { "opencl_force", "opencl_force_noepot" };
+
+int ReadCountersOption( const char * line, counters_t * c )
+{
+    c->every = 10;
+    if (sscanf(line, "%*s %d", &c->every) == 1 && c->every < 1) {
+        fprintf(stderr, "usage: counters [steps between two timings]\n");
+        c->every = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int InitCounters( counters_t * c, int ndevices, int nthreads )
+{
+    c->ndevices = ndevices;
+    c->nthreads = nthreads;
+    c->probing = -1;
+    c->due = 0;
+    memset(c->total, 0, sizeof(c->total));
+    memset(c->steps, 0, sizeof(c->steps));
+    memset(c->ktime, 0, sizeof(c->ktime));
+    memset(c->ntimed, 0, sizeof(c->ntimed));
+    c->kstart = (cl_event *) calloc(ndevices, sizeof(cl_event));
+    c->kend = (cl_event *) calloc(ndevices, sizeof(cl_event));
+    return ( c->kstart && c->kend ) ? 0 : -1;
+}
+
+size_t CountersBytes( const counters_t * c )
+{
+    return (size_t) CN_NSETS * CN_NCOUNT * c->nthreads * sizeof(cl_ulong);
+}
+
+cl_int ZeroCounters( counters_t * c, cl_command_queue * queues, cl_mem * buffers )
+{
+    cl_ulong *zero = (cl_ulong *) calloc(CountersBytes(c), 1);
+    cl_int status = CL_SUCCESS;
+    int u;
+
+    if (!zero) return CL_OUT_OF_HOST_MEMORY;
+    for (u = 0; u < c->ndevices; u++)
+        status |= clEnqueueWriteBuffer(queues[u], buffers[u], CL_TRUE, 0, CountersBytes(c), zero, 0, NULL, NULL);
+    free(zero);
+    return status;
+}
+
+cl_int CollectCounters( counters_t * c )
+{
+    cl_ulong start, end;
+    cl_int status = CL_SUCCESS;
+    double t = 0.0;
+    int u;
+
+    if (c->probing < 0) return CL_SUCCESS;
+    for (u = 0; u < c->ndevices; u++) {
+        status |= clWaitForEvents(1, &c->kend[u]);
+        status |= clGetEventProfilingInfo(c->kstart[u], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        status |= clGetEventProfilingInfo(c->kend[u], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        if (end > start && 1.0e-9 * ( end - start ) > t) t = 1.0e-9 * ( end - start );
+        clReleaseEvent(c->kstart[u]);
+        clReleaseEvent(c->kend[u]);
+    }
+    c->ktime[c->probing] += t;
+    c->ntimed[c->probing]++;
+    c->probing = -1;
+    return status;
+}
+
+int CountersProbe( counters_t * c, int nfi, int busy, int set )
+{
+    if (nfi % c->every == 1 % c->every) c->due = 1;
+    if (!c->due || busy) return 0;
+    CollectCounters(c);
+    c->due = 0;
+    c->probing = set;
+    return 1;
+}
+
+cl_int PrintCounters( counters_t * c, cl_command_queue * queues, cl_mem * buffers, FILE * out )
+{
+    cl_ulong *sums = (cl_ulong *) malloc(CountersBytes(c));
+    cl_int status;
+    int u, s, k, i;
+
+    if (!sums) return CL_OUT_OF_HOST_MEMORY;
+    status = CollectCounters(c);
+    for (u = 0; u < c->ndevices; u++) {
+        status |= clEnqueueReadBuffer(queues[u], buffers[u], CL_TRUE, 0, CountersBytes(c), sums, 0, NULL, NULL);
+        for (s = 0; s < CN_NSETS; s++)
+            for (k = 0; k < CN_NCOUNT; k++)
+                for (i = 0; i < c->nthreads; i++) c->total[s][k] += sums[( s * CN_NCOUNT + k ) * c->nthreads + i];
+    }
+    free(sums);
+#ifdef _MPI
+    DomainSum(&c->total[0][0], CN_NSETS * CN_NCOUNT);
+#endif
+
+    fprintf(out, "Force kernel work (model: %d flop per pair, %d more within the cutoff, %d more with the energy; "
+            "%d bytes per pair, %d per i atom):\n", CN_FLOP_PAIR, CN_FLOP_CUTOFF, CN_FLOP_ENERGY, (int) CN_BYTES_PAIR,
+            (int) CN_BYTES_IATOM);
+    fprintf(out, "%-20s %8s %12s %8s %8s %11s %9s %6s %9s %9s %9s\n", "kernel", "steps", "pairs/step", "cutoff %",
+            "image %", "Mflop/step", "MB/step", "timed", "ms/step", "Gflop/s", "GB/s");
+    for (s = 0; s < CN_NSETS; s++) {
+        double pairs, flop, bytes, t;
+
+        if (!c->steps[s]) continue;
+        pairs = c->total[s][CN_PAIRS];
+        flop = CN_FLOP_PAIR * pairs + ( CN_FLOP_CUTOFF + ( s == CN_FORCE ? CN_FLOP_ENERGY : 0 ) ) * c->total[s][CN_CUTOFF];
+        bytes = CN_BYTES_PAIR * pairs + CN_BYTES_IATOM * c->total[s][CN_IATOMS];
+        fprintf(out, "%-20s %8ld %12.6g %8.3f %8.3f %11.5g %9.5g", set_names[s], c->steps[s], pairs / c->steps[s],
+                pairs ? 100.0 * c->total[s][CN_CUTOFF] / pairs : 0.0, pairs ? 100.0 * c->total[s][CN_IMAGE] / pairs : 0.0,
+                1.0e-6 * flop / c->steps[s], 1.0e-6 * bytes / c->steps[s]);
+        t = c->ntimed[s] ? c->ktime[s] / c->ntimed[s] : 0.0;
+        if (t > 0.0)
+            fprintf(out, " %6ld %9.4g %9.4g %9.4g\n", c->ntimed[s], 1.0e3 * t, 1.0e-9 * flop / c->steps[s] / t,
+                    1.0e-9 * bytes / c->steps[s] / t);
+        else
+            fprintf(out, " %6ld %9s %9s %9s\n", c->ntimed[s], "-", "-", "-");
+    }
+    return status;
+}
+
+void FreeCounters( counters_t * c )
+{
+    CollectCounters(c);
+    free(c->kstart);
+    free(c->kend);
+    c->kstart = c->kend = NULL;
+}
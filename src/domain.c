@@ -0,0 +1,310 @@
+/** Spatial decomposition over MPI ranks (built with -D_MPI).
+
+  The box is cut in nranks slabs along x. Every rank drives its own
+  device with the atoms of its slab plus the ghosts, the atoms of the
+  two neighbor slabs closer than the cutoff to its edges. The device
+  wraps the positions into the box and counts the periodic images, the
+  counters travel with the atoms; the slab of an atom is found from its
+  wrapped x coordinate all the same. Every step the atoms that left the slab are sent
+  to the neighbor they entered and the ghosts are rebuilt, so no skin is
+  needed. The slabs must be at least one cutoff wide, then the ghosts
+  only come from the two neighbors and an atom never moves further than
+  the next slab within one step.
+ */
+
+#ifdef _MPI
+
+#include <string.h>
+#include <math.h>
+
+#include "domain.h"
+
+/* values per atom in the packing buffers: migrants and ghosts */
+#define MIGRANT_SIZE 10
+#define GHOST_SIZE   3
+
+/* atoms parsed at a time from the restart */
+#define DOMAIN_READ_ATOMS 65536
+
+static int slab_of( const domain_t * dom, FPTYPE x )
+{
+    double xw = x - dom->box * floor( x / dom->box );
+    int s = (int) ( xw * dom->nranks / dom->box );
+
+    return ( s < dom->nranks ) ? s : dom->nranks - 1;
+}
+
+int DomainInit( domain_t * dom, int natoms, FPTYPE box, FPTYPE halo )
+{
+    MPI_Comm node;
+    double width, estimate;
+
+    memset( dom, 0, sizeof(domain_t) );
+    MPI_Comm_rank( MPI_COMM_WORLD, &dom->rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &dom->nranks );
+    MPI_Comm_split_type( MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, dom->rank, MPI_INFO_NULL, &node );
+    MPI_Comm_rank( node, &dom->noderank );
+    MPI_Comm_free( &node );
+
+    dom->left = ( dom->rank + dom->nranks - 1 ) % dom->nranks;
+    dom->right = ( dom->rank + 1 ) % dom->nranks;
+    dom->box = box;
+    dom->lo = box * dom->rank / dom->nranks;
+    dom->hi = box * ( dom->rank + 1 ) / dom->nranks;
+    dom->halo = halo;
+    dom->natoms = natoms;
+
+    width = box / dom->nranks;
+    if ( dom->nranks > 1 && width < halo ) return -1;
+
+    /* own atoms and ghosts of a uniform density, with a factor two of margin */
+    estimate = 2.0 * natoms / dom->nranks * ( 1.0 + 2.0 * halo / width ) + 64.0;
+    dom->cap = ( estimate < natoms ) ? (int) estimate : natoms;
+
+    dom->id = (int *) malloc( dom->cap * sizeof(int) );
+    dom->rx = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->ry = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->rz = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->vx = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->vy = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->vz = (FPTYPE *) malloc( dom->cap * sizeof(FPTYPE) );
+    dom->ix = (cl_int *) malloc( dom->cap * sizeof(cl_int) );
+    dom->iy = (cl_int *) malloc( dom->cap * sizeof(cl_int) );
+    dom->iz = (cl_int *) malloc( dom->cap * sizeof(cl_int) );
+    dom->sendbuf = (double *) malloc( MIGRANT_SIZE * dom->cap * sizeof(double) );
+    dom->recvbuf = (double *) malloc( MIGRANT_SIZE * dom->cap * sizeof(double) );
+    return 0;
+}
+
+FILE * DomainInput( FILE * fp )
+{
+    char * text = NULL;
+    long len = 0, size = 0;
+    int rank;
+
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    if ( rank == 0 ) {
+        size_t n;
+
+        do {
+            size += 4096;
+            text = (char *) realloc( text, size );
+            n = fread( text + len, 1, size - len, fp );
+            len += n;
+        } while ( n > 0 );
+    }
+    MPI_Bcast( &len, 1, MPI_LONG, 0, MPI_COMM_WORLD );
+    if ( rank != 0 ) text = (char *) malloc( len + 1 );
+    MPI_Bcast( text, len, MPI_CHAR, 0, MPI_COMM_WORLD );
+
+    /* the text stays allocated as long as the stream is read */
+    return fmemopen( text, len, "r" );
+}
+
+int DomainReadRestart( domain_t * dom, restart_t * rst )
+{
+    FPTYPE * x = (FPTYPE *) malloc( 3 * DOMAIN_READ_ATOMS * sizeof(FPTYPE) );
+    FPTYPE * y = x + DOMAIN_READ_ATOMS, * z = y + DOMAIN_READ_ATOMS;
+    int first, n, i, k, err = 0;
+
+    /* positions, then the velocities of the own atoms, whose ids are in increasing order */
+    dom->nlocal = 0;
+    for ( first = 0; first < dom->natoms && !err; first += n ) {
+        n = ( dom->natoms - first < DOMAIN_READ_ATOMS ) ? dom->natoms - first : DOMAIN_READ_ATOMS;
+        if ( ReadRestart( rst, first, n, x, y, z ) ) err = -1;
+        for ( i = 0; i < n && !err; ++i ) {
+            if ( slab_of( dom, x[i] ) != dom->rank ) continue;
+            if ( dom->nlocal == dom->cap ) err = -1;
+            else {
+                dom->id[dom->nlocal] = first + i;
+                dom->rx[dom->nlocal] = x[i];
+                dom->ry[dom->nlocal] = y[i];
+                dom->rz[dom->nlocal] = z[i];
+                dom->ix[dom->nlocal] = dom->iy[dom->nlocal] = dom->iz[dom->nlocal] = 0;
+                dom->nlocal++;
+            }
+        }
+    }
+    for ( first = 0, k = 0; first < dom->natoms && !err; first += n ) {
+        n = ( dom->natoms - first < DOMAIN_READ_ATOMS ) ? dom->natoms - first : DOMAIN_READ_ATOMS;
+        if ( ReadRestart( rst, dom->natoms + first, n, x, y, z ) ) err = -1;
+        for ( ; k < dom->nlocal && dom->id[k] < first + n && !err; ++k ) {
+            dom->vx[k] = x[dom->id[k] - first];
+            dom->vy[k] = y[dom->id[k] - first];
+            dom->vz[k] = z[dom->id[k] - first];
+        }
+    }
+    free( x );
+
+    return err ? err : DomainExchange( dom );
+}
+
+/* send n values of sendbuf to rank to, receive from rank from at recvbuf.
+   returns the number of values received */
+static int shift( double * sendbuf, int n, int to, double * recvbuf, int from )
+{
+    int nrecv;
+
+    MPI_Sendrecv( &n, 1, MPI_INT, to, 0, &nrecv, 1, MPI_INT, from, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+    MPI_Sendrecv( sendbuf, n, MPI_DOUBLE, to, 1, recvbuf, nrecv, MPI_DOUBLE, from, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+    return nrecv;
+}
+
+int DomainExchange( domain_t * dom )
+{
+    int d, i, n, nrecv;
+
+    dom->nghost = 0;
+
+    /* migration. pass 0 sends to the left and receives from the right, pass 1
+       the other way round; with two ranks both neighbors are the same rank */
+    for ( i = 0; i < dom->nlocal; ++i ) {
+        int s = slab_of( dom, dom->rx[i] );
+        if ( s != dom->rank && s != dom->left && s != dom->right ) return -1;
+    }
+    for ( d = 0; d < 2; ++d ) {
+        int to = d ? dom->right : dom->left, from = d ? dom->left : dom->right;
+        double * buf = dom->sendbuf;
+
+        for ( i = 0, n = 0; i < dom->nlocal; ) {
+            int s = slab_of( dom, dom->rx[i] );
+
+            if ( s == dom->rank || s != to ) {
+                ++i;
+                continue;
+            }
+            buf[n++] = dom->id[i];
+            buf[n++] = dom->rx[i];
+            buf[n++] = dom->ry[i];
+            buf[n++] = dom->rz[i];
+            buf[n++] = dom->vx[i];
+            buf[n++] = dom->vy[i];
+            buf[n++] = dom->vz[i];
+            buf[n++] = dom->ix[i];
+            buf[n++] = dom->iy[i];
+            buf[n++] = dom->iz[i];
+
+            /* the last own atom takes the place of the one that left */
+            dom->nlocal--;
+            dom->id[i] = dom->id[dom->nlocal];
+            dom->rx[i] = dom->rx[dom->nlocal];
+            dom->ry[i] = dom->ry[dom->nlocal];
+            dom->rz[i] = dom->rz[dom->nlocal];
+            dom->vx[i] = dom->vx[dom->nlocal];
+            dom->vy[i] = dom->vy[dom->nlocal];
+            dom->vz[i] = dom->vz[dom->nlocal];
+            dom->ix[i] = dom->ix[dom->nlocal];
+            dom->iy[i] = dom->iy[dom->nlocal];
+            dom->iz[i] = dom->iz[dom->nlocal];
+        }
+
+        nrecv = shift( dom->sendbuf, n, to, dom->recvbuf, from ) / MIGRANT_SIZE;
+        if ( dom->nlocal + nrecv > dom->cap ) return -1;
+        for ( i = 0, buf = dom->recvbuf; i < nrecv; ++i, buf += MIGRANT_SIZE ) {
+            dom->id[dom->nlocal] = buf[0];
+            dom->rx[dom->nlocal] = buf[1];
+            dom->ry[dom->nlocal] = buf[2];
+            dom->rz[dom->nlocal] = buf[3];
+            dom->vx[dom->nlocal] = buf[4];
+            dom->vy[dom->nlocal] = buf[5];
+            dom->vz[dom->nlocal] = buf[6];
+            dom->ix[dom->nlocal] = buf[7];
+            dom->iy[dom->nlocal] = buf[8];
+            dom->iz[dom->nlocal] = buf[9];
+            dom->nlocal++;
+        }
+    }
+
+    /* ghosts. pass 0 sends the atoms close to the lower edge to the left,
+       pass 1 those close to the upper edge to the right. with two ranks the
+       atoms close to both edges are sent once */
+    for ( d = 0; d < 2; ++d ) {
+        int to = d ? dom->right : dom->left, from = d ? dom->left : dom->right;
+        double * buf = dom->sendbuf;
+
+        for ( i = 0, n = 0; i < dom->nlocal; ++i ) {
+            double xw = dom->rx[i] - dom->box * floor( dom->rx[i] / dom->box );
+            int nearlo = ( xw - dom->lo < dom->halo ), nearhi = ( dom->hi - xw < dom->halo );
+
+            if ( d ? ( !nearhi || ( nearlo && dom->left == dom->right ) ) : !nearlo ) continue;
+            buf[n++] = dom->rx[i];
+            buf[n++] = dom->ry[i];
+            buf[n++] = dom->rz[i];
+        }
+
+        nrecv = shift( dom->sendbuf, n, to, dom->recvbuf, from ) / GHOST_SIZE;
+        if ( dom->nlocal + dom->nghost + nrecv > dom->cap ) return -1;
+        for ( i = 0, buf = dom->recvbuf; i < nrecv; ++i, buf += GHOST_SIZE ) {
+            n = dom->nlocal + dom->nghost++;
+            dom->rx[n] = buf[0];
+            dom->ry[n] = buf[1];
+            dom->rz[n] = buf[2];
+        }
+    }
+    return 0;
+}
+
+void DomainGather( domain_t * dom, FPTYPE * rx, FPTYPE * ry, FPTYPE * rz, cl_int * ix, cl_int * iy, cl_int * iz )
+{
+    int * counts = NULL, * displs = NULL;
+    double * all = NULL, * buf = dom->sendbuf;
+    int i, n = 7 * dom->nlocal;
+
+    for ( i = 0; i < dom->nlocal; ++i ) {
+        *buf++ = dom->id[i];
+        *buf++ = dom->rx[i];
+        *buf++ = dom->ry[i];
+        *buf++ = dom->rz[i];
+        *buf++ = dom->ix[i];
+        *buf++ = dom->iy[i];
+        *buf++ = dom->iz[i];
+    }
+    if ( dom->rank == 0 ) {
+        counts = (int *) malloc( dom->nranks * sizeof(int) );
+        displs = (int *) malloc( dom->nranks * sizeof(int) );
+        all = (double *) malloc( 7 * (size_t) dom->natoms * sizeof(double) );
+    }
+    MPI_Gather( &n, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD );
+    if ( dom->rank == 0 )
+        for ( i = 0; i < dom->nranks; ++i ) displs[i] = i ? displs[i-1] + counts[i-1] : 0;
+    MPI_Gatherv( dom->sendbuf, n, MPI_DOUBLE, all, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+
+    if ( dom->rank == 0 ) {
+        for ( i = 0, buf = all; i < dom->natoms; ++i, buf += 7 ) {
+            int k = buf[0];
+
+            rx[k] = buf[1];
+            ry[k] = buf[2];
+            rz[k] = buf[3];
+            ix[k] = buf[4];
+            iy[k] = buf[5];
+            iz[k] = buf[6];
+        }
+        free( counts );
+        free( displs );
+        free( all );
+    }
+}
+
+void DomainSum( double * val, int n )
+{
+    MPI_Allreduce( MPI_IN_PLACE, val, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+}
+
+void FreeDomain( domain_t * dom )
+{
+    free( dom->id );
+    free( dom->rx );
+    free( dom->ry );
+    free( dom->rz );
+    free( dom->vx );
+    free( dom->vy );
+    free( dom->vz );
+    free( dom->ix );
+    free( dom->iy );
+    free( dom->iz );
+    free( dom->sendbuf );
+    free( dom->recvbuf );
+}
+
+#endif
@@ -0,0 +1,265 @@
+/** The MD engine shared by ljmd-cl and the python module.
+
+  The input parsers print their usage to stderr and return -1, the callers
+  decide what to do with it. The kernel arguments are bound in the order
+  of the kernel signatures in opencl_kernels.cl, in this file only.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+
+#include "engine.h"
+#include "restart.h"
+
+const FPTYPE kboltz=0.0019872067;     /* boltzman constant in kcal/mol/K */
+const FPTYPE mvsq2e=2390.05736153349; /* m*v^2 in kcal/mol */
+const FPTYPE pconv=69476.9520;        /* kcal/mol/A^3 in bar */
+
+const char *thermo_names[] = { "none", "berendsen", "vrescale", "langevin" };
+const char *baro_names[] = { "none", "berendsen" };
+const char *zerocopy_names[] = { "off", "on", "auto" };
+const char *restart_names[] = { "scanf", "mmap" };
+
+/* cuts comments and blanks of tmp, the rest is copied to buf */
+static int strip_line( char * tmp, char * buf )
+{
+    char *ptr = strchr(tmp,'#');
+    int i;
+
+    if (ptr) *ptr= '\0';
+    i=strlen(tmp);
+    while(i>0 && isspace(tmp[i-1])) tmp[--i]='\0';
+    ptr=tmp;
+    while(isspace(*ptr)) {++ptr;}
+    strcpy(buf,ptr);
+    return *ptr != '\0';
+}
+
+int ReadInputLine( FILE * fp, char * buf )
+{
+    char tmp[BLEN];
+
+    if (!fgets(tmp,BLEN,fp)) {
+        perror("problem reading input");
+        return -1;
+    }
+    strip_line(tmp,buf);
+    return 0;
+}
+
+int ReadInputOption( FILE * fp, char * buf )
+{
+    char tmp[BLEN];
+
+    while (fgets(tmp,BLEN,fp))
+        if (strip_line(tmp,buf)) return 0;
+    return -1;
+}
+
+int ReadInput( FILE * fp, mdsys_t * sys, input_t * in )
+{
+    char line[BLEN];
+    long nread;
+
+    if (ReadInputLine(fp,line)) return -1;
+    nread=strtol(line,NULL,10);
+    if (nread < 2 || nread > INT_MAX) {
+        fprintf(stderr, "The number of atoms must be between 2 and %d.\n", INT_MAX);
+        return -1;
+    }
+    sys->natoms=nread;
+    if (ReadInputLine(fp,line)) return -1;
+    sys->mass=atof(line);
+    if (ReadInputLine(fp,line)) return -1;
+    sys->epsilon=atof(line);
+    if (ReadInputLine(fp,line)) return -1;
+    sys->sigma=atof(line);
+    if (ReadInputLine(fp,line)) return -1;
+    sys->rcut=atof(line);
+    if (ReadInputLine(fp,line)) return -1;
+    sys->box=atof(line);
+    if (ReadInputLine(fp,in->restfile)) return -1;
+    if (ReadInputLine(fp,in->trajfile)) return -1;
+    if (ReadInputLine(fp,in->ergfile)) return -1;
+    if (ReadInputLine(fp,line)) return -1;
+    sys->nsteps=atoi(line);
+    if (ReadInputLine(fp,line)) return -1;
+    sys->dt=atof(line);
+    if (ReadInputLine(fp,line)) return -1;
+    in->nprint=atoi(line);
+    return 0;
+}
+
+int ReadThermostat( const char * line, thermo_t * thermo )
+{
+    char kind[BLEN];
+    double temp, tau;
+    int i;
+
+    if (sscanf(line,"%*s %s %lf %lf %u",kind,&temp,&tau,&thermo->seed) < 3) {
+        fprintf(stderr, "usage: thermostat berendsen|vrescale|langevin <temperature> <tau> [seed]\n");
+        return -1;
+    }
+    for (i=THERMO_NONE; i<=THERMO_LANGEVIN; ++i)
+        if (!strcmp(kind,thermo_names[i])) thermo->kind=i;
+    if (strcmp(kind,thermo_names[thermo->kind]) || temp < 0.0 || tau <= 0.0) {
+        fprintf(stderr, "invalid thermostat settings: %s\n", line);
+        return -1;
+    }
+    thermo->temp=temp;
+    thermo->tau=tau;
+    return 0;
+}
+
+int ReadBarostat( const char * line, baro_t * baro )
+{
+    char kind[BLEN];
+    double press, tau, kappa = 4.5e-5;
+
+    if (sscanf(line,"%*s %s %lf %lf %lf",kind,&press,&tau,&kappa) < 3) {
+        fprintf(stderr, "usage: barostat berendsen <pressure in bar> <tau in fs> [compressibility in 1/bar]\n");
+        return -1;
+    }
+    if (strcmp(kind,baro_names[BARO_BERENDSEN]) || tau <= 0.0 || kappa <= 0.0) {
+        fprintf(stderr, "invalid barostat settings: %s\n", line);
+        return -1;
+    }
+    baro->kind=BARO_BERENDSEN;
+    baro->press=press;
+    baro->tau=tau;
+    baro->kappa=kappa;
+    return 0;
+}
+
+int ReadLattice( const char * line, lattice_t * lat, mdsys_t * sys )
+{
+    double density, temp;
+
+    if (sscanf(line,"%*s %lf %lf %u",&density,&temp,&lat->seed) < 2 || density < 0.0 || temp < 0.0) {
+        fprintf(stderr, "usage: fcc <density in g/cm^3, 0 keeps the box> <temperature> [seed]\n");
+        return -1;
+    }
+    for (lat->ncell=1; 4L*lat->ncell*lat->ncell*lat->ncell < sys->natoms; ++lat->ncell);
+    if (4L*lat->ncell*lat->ncell*lat->ncell != sys->natoms) {
+        fprintf(stderr, "an fcc lattice has 4*n^3 atoms, not %d\n", sys->natoms);
+        return -1;
+    }
+    /* volume in A^3 of natoms atoms of mass in g/mol */
+    if (density > 0.0) sys->box = cbrt(sys->natoms * sys->mass / 6.02214076e23 / density * 1.0e24);
+    lat->density = density;
+    lat->temp = temp;
+    return 0;
+}
+
+int ReadZerocopyOption( const char * line, int * zerocopy )
+{
+    char kind[BLEN] = "";
+
+    sscanf(line, "%*s %s", kind);
+    for (*zerocopy = ZEROCOPY_AUTO; *zerocopy >= ZEROCOPY_OFF; --*zerocopy)
+        if (!strcmp(kind, zerocopy_names[*zerocopy])) return 0;
+    fprintf(stderr, "usage: zerocopy auto|on|off\n");
+    return -1;
+}
+
+int ReadVectorOption( const char * line, int * vector )
+{
+    char kind[BLEN] = "";
+
+    sscanf(line, "%*s %s", kind);
+    if (!strcmp(kind, "auto")) *vector = VECTOR_AUTO;
+    else if (!strcmp(kind, "off")) *vector = 0;
+    else if (!strcmp(kind, "8") || !strcmp(kind, "16")) *vector = atoi(kind);
+    else {
+        fprintf(stderr, "usage: vector auto|off|8|16\n");
+        return -1;
+    }
+    return 0;
+}
+
+int ReadRestartOption( const char * line, int * parser )
+{
+    char kind[BLEN] = "";
+
+    sscanf(line, "%*s %s", kind);
+    for (*parser = RESTART_MMAP; *parser >= RESTART_SCANF; --*parser)
+        if (!strcmp(kind, restart_names[*parser])) return 0;
+    fprintf(stderr, "usage: restart mmap|scanf\n");
+    return -1;
+}
+
+/* auto vectorizes on CPU devices only, in 16 lanes where they prefer vectors that wide */
+int VectorWidth( cl_device_id device, int vector, int generic )
+{
+    cl_device_type type;
+    cl_uint width = 0;
+
+    if (vector != VECTOR_AUTO) return vector;
+    clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+    if (generic || !(type & CL_DEVICE_TYPE_CPU)) return 0;
+#ifdef _USE_FLOAT
+    clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(width), &width, NULL);
+#else
+    clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE, sizeof(width), &width, NULL);
+#endif
+    return (width >= 16) ? 16 : 8;
+}
+
+void SampleEnergies( mdsys_t * sys )
+{
+    sys->ekin *= HALF * mvsq2e * sys->mass;
+    sys->temp  = TWO * sys->ekin / ( THREE * sys->natoms - THREE ) / kboltz;
+    sys->press = ( TWO * sys->ekin + sys->virial ) / ( THREE * sys->box * sys->box * sys->box ) * pconv;
+}
+
+void ForceConstants( force_args_t * a, const mdsys_t * sys )
+{
+    a->c12 = 4.0 * sys->epsilon * pow( sys->sigma, 12.0);
+    a->c6  = 4.0 * sys->epsilon * pow( sys->sigma, 6.0);
+    a->rcsq = sys->rcut * sys->rcut;
+    a->boxinv = ONE / sys->box;
+    a->box = sys->box;
+}
+
+cl_int SetForceArgs( cl_kernel k, const force_args_t * a )
+{
+    cl_int status;
+
+    status = clSetMultKernelArgs( k, 0, 26,
+        KArg(a->f[0]), KArg(a->f[1]), KArg(a->f[2]),
+        KArg(a->r[0]), KArg(a->r[1]), KArg(a->r[2]),
+        KArg(a->rj[0]), KArg(a->rj[1]), KArg(a->rj[2]),
+        KArg(a->nj), KArg(a->epot),
+        KArg(a->c12), KArg(a->c6), KArg(a->rcsq), KArg(a->boxinv), KArg(a->box),
+        KArg(a->atom1), KArg(a->natoms1), KArg(a->ioff), KArg(a->joff), KArg(a->eaccum),
+        KArg(a->table), KArg(a->rminsq), KArg(a->dsinv), KArg(a->ntab),
+        KArg(a->rdf) );
+    /* the local histogram, then its scale */
+    status |= clSetKernelArg( k, 26, a->rdfbins * sizeof(cl_uint), NULL );
+    status |= clSetKernelArg( k, 27, sizeof(FPTYPE), &a->rdfscale );
+    status |= clSetMultKernelArgs( k, 28, 5, KArg(a->baro), KArg(a->a[0]), KArg(a->a[1]), KArg(a->a[2]), KArg(a->cnt) );
+    return status;
+}
+
+cl_int SetChunkArgs( cl_kernel verlet_first, cl_kernel verlet_second, cl_kernel ekin, const chunk_args_t * c )
+{
+    cl_int status;
+
+    status  = clSetMultKernelArgs( verlet_first, 0, 21,
+        KArg(c->f[0]), KArg(c->f[1]), KArg(c->f[2]),
+        KArg(c->r[0]), KArg(c->r[1]), KArg(c->r[2]),
+        KArg(c->v[0]), KArg(c->v[1]), KArg(c->v[2]),
+        KArg(c->natoms), KArg(c->dt), KArg(c->dtmf), KArg(c->thermo), KArg(c->baro), KArg(c->box),
+        KArg(c->im[0]), KArg(c->im[1]), KArg(c->im[2]), KArg(c->ekin), KArg(c->tstate), KArg(c->atom0) );
+    status |= clSetMultKernelArgs( verlet_second, 0, 16,
+        KArg(c->f[0]), KArg(c->f[1]), KArg(c->f[2]),
+        KArg(c->v[0]), KArg(c->v[1]), KArg(c->v[2]),
+        KArg(c->natoms), KArg(c->dt), KArg(c->dtmf), KArg(c->ekin), KArg(c->thermo), KArg(c->tstate), KArg(c->atom0),
+        KArg(c->a[0]), KArg(c->a[1]), KArg(c->a[2]) );
+    status |= clSetMultKernelArgs( ekin, 0, 6, KArg(c->v[0]), KArg(c->v[1]), KArg(c->v[2]), KArg(c->natoms),
+        KArg(c->ekin), KArg(c->atom0) );
+    return status;
+}
@@ -0,0 +1,64 @@
+/** This follows the frames a running ljmd-cl publishes in shared memory (input
+    keyword "publish name") and prints the energies and the center of mass of
+    every frame it gets, with the number of frames it was too slow for */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "frame_ring.h"
+
+static double sum( const void * r, int natoms, int realsize )
+{
+    double s = 0.0;
+    int i;
+
+    for( i = 0; i < natoms; i++ )
+	s += realsize == sizeof(float) ? ((const float *) r)[i] : ((const double *) r)[i];
+    return s;
+}
+
+int main( int argc, char * argv[] )
+{
+    frame_reader_t reader;
+    frame_view_t frame;
+    int wait = 0, status;
+    unsigned long nframes = 0, nmissed = 0, ntorn = 0;
+
+    if( argc < 2 ) {
+	fprintf( stderr, "usage: frame-reader name [milliseconds between two polls]\n" );
+	return 1;
+    }
+    if( argc > 2 ) wait = atoi( argv[2] );
+
+    /* the writer creates the ring when its output files are opened */
+    while( AttachFrameRing( &reader, argv[1] ) ) usleep( 100000 );
+    printf( "     NFI            ETOT         X_COM        Y_COM        Z_COM   MISSED\n" );
+
+    while( ( status = NextFrame( &reader, &frame ) ) >= 0 ) {
+	double x, y, z;
+
+	if( !status ) {
+	    usleep( 1000 );
+	    continue;
+	}
+	x = sum( frame.rx, frame.natoms, frame.realsize ) / frame.natoms;
+	y = sum( frame.ry, frame.natoms, frame.realsize ) / frame.natoms;
+	z = sum( frame.rz, frame.natoms, frame.realsize ) / frame.natoms;
+
+	/* the writer may have come round to the slot while we were reading it */
+	if( !FrameValid( &reader, &frame ) ) {
+	    ntorn++;
+	    continue;
+	}
+	printf( "% 8ld % 15.6f % 12.6f % 12.6f % 12.6f %8lu\n", (long) frame.nfi, frame.etot, x, y, z,
+		(unsigned long) frame.missed );
+	fflush( stdout );
+	nframes++;
+	nmissed += frame.missed;
+	if( wait ) usleep( 1000 * wait );
+    }
+    printf( "%lu frames read, %lu missed, %lu overwritten while read.\n", nframes, nmissed, ntorn );
+    DetachFrameRing( &reader );
+    return 0;
+}
@@ -0,0 +1,206 @@
+/** Shared memory frames.
+
+  ljmd-cl copies every sampled frame into a ring of slots in a POSIX
+  shared memory segment, next to the energy and trajectory files. Each
+  slot is guarded by its own sequence number (a seqlock): odd while the
+  writer fills it, even when it is complete. Readers map the segment
+  read-only, take the newest complete frame and use its positions in
+  place; the sequence number tells them afterwards whether the writer has
+  come round to the slot in the meantime. Nobody ever waits for a reader.
+  The module needs neither OpenCL nor the rest of the program, readers
+  link it alone (see frame-reader.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_ring.h"
+
+static size_t round64( size_t n )
+{
+    return ( (n + 63) / 64 ) * 64;
+}
+
+static frame_record_t * slot_of( const frame_header_t * header, uint64_t frame )
+{
+    return (frame_record_t *) ( (char *) header + round64( sizeof(frame_header_t) )
+                                + ( (frame - 1) % header->nslots ) * header->slotbytes );
+}
+
+/* the segment names are "/name" */
+static void shm_name( char * dst, const char * name )
+{
+    snprintf( dst, FRAME_NAME_LEN, "%s%s", name[0] == '/' ? "" : "/", name );
+}
+
+int ReadPublishOption( const char * line, frame_ring_t * ring )
+{
+    char name[FRAME_NAME_LEN] = "";
+
+    ring->nslots = FRAME_RING_SLOTS;
+    if (sscanf(line, "%*s %255s %d", name, &ring->nslots) >= 1 && ring->nslots >= 2) {
+        shm_name(ring->name, name);
+        return 0;
+    }
+    fprintf(stderr, "usage: publish <shared memory name> [slots >= 2]\n");
+    ring->name[0] = 0;
+    return -1;
+}
+
+int OpenFrameRing( frame_ring_t * ring, int natoms, int realsize )
+{
+    frame_header_t * header;
+    size_t slotbytes = round64( sizeof(frame_record_t) + 3 * (size_t) natoms * realsize );
+    int fd;
+
+    ring->bytes = round64( sizeof(frame_header_t) ) + ring->nslots * slotbytes;
+    fd = shm_open(ring->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("cannot create the shared memory frames");
+        return -1;
+    }
+    if (ftruncate(fd, ring->bytes)) {
+        perror("cannot size the shared memory frames");
+        close(fd);
+        shm_unlink(ring->name);
+        return -1;
+    }
+    header = (frame_header_t *) mmap(NULL, ring->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("cannot map the shared memory frames");
+        shm_unlink(ring->name);
+        return -1;
+    }
+
+    /* the zero filled slots are all incomplete, the magic number goes in last */
+    header->version = FRAME_RING_VERSION;
+    header->natoms = natoms;
+    header->nslots = ring->nslots;
+    header->realsize = realsize;
+    header->slotbytes = slotbytes;
+    header->head = 0;
+    header->closed = 0;
+    __atomic_store_n(&header->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    ring->header = header;
+    ring->nframes = 0;
+    return 0;
+}
+
+void PublishFrame( frame_ring_t * ring, int nfi, double temp, double ekin, double epot, double press, double box,
+                   const void * rx, const void * ry, const void * rz )
+{
+    uint64_t n = ++ring->nframes;
+    frame_record_t * rec = slot_of(ring->header, n);
+    size_t bytes = (size_t) ring->header->natoms * ring->header->realsize;
+    char * pos = (char *) rec + sizeof(frame_record_t);
+
+    __atomic_store_n(&rec->seq, 2 * n - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->nfi = nfi;
+    rec->temp = temp;
+    rec->ekin = ekin;
+    rec->epot = epot;
+    rec->etot = ekin + epot;
+    rec->press = press;
+    rec->box = box;
+    memcpy(pos, rx, bytes);
+    memcpy(pos + bytes, ry, bytes);
+    memcpy(pos + 2 * bytes, rz, bytes);
+    __atomic_store_n(&rec->seq, 2 * n, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->head, n, __ATOMIC_RELEASE);
+}
+
+void CloseFrameRing( frame_ring_t * ring )
+{
+    if (!ring->header) return;
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring->header, ring->bytes);
+    shm_unlink(ring->name);
+    ring->header = NULL;
+}
+
+int AttachFrameRing( frame_reader_t * reader, const char * name )
+{
+    char path[FRAME_NAME_LEN];
+    struct stat st;
+    const frame_header_t * header;
+    int fd;
+
+    memset(reader, 0, sizeof(frame_reader_t));
+    shm_name(path, name);
+    fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(frame_header_t)) {
+        close(fd);
+        return -1;
+    }
+    header = (const frame_header_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) return -1;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION
+        || round64( sizeof(frame_header_t) ) + header->nslots * header->slotbytes > (size_t) st.st_size) {
+        munmap((void *) header, st.st_size);
+        return -1;
+    }
+    reader->header = header;
+    reader->bytes = st.st_size;
+    return 0;
+}
+
+int NextFrame( frame_reader_t * reader, frame_view_t * frame )
+{
+    const frame_header_t * header = reader->header;
+
+    for (;;) {
+        int closed = __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE);
+        uint64_t n = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        const frame_record_t * rec;
+        const char * pos;
+        size_t bytes;
+
+        if (n == reader->last) return closed ? -1 : 0;
+        rec = slot_of(header, n);
+
+        /* the slot already holds a newer frame, or is being filled with it */
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != 2 * n) continue;
+        frame->nfi = rec->nfi;
+        frame->temp = rec->temp;
+        frame->ekin = rec->ekin;
+        frame->epot = rec->epot;
+        frame->etot = rec->etot;
+        frame->press = rec->press;
+        frame->box = rec->box;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != 2 * n) continue;
+
+        bytes = (size_t) header->natoms * header->realsize;
+        pos = (const char *) rec + sizeof(frame_record_t);
+        frame->frame = n;
+        frame->missed = n - reader->last - 1;
+        frame->natoms = header->natoms;
+        frame->realsize = header->realsize;
+        frame->rx = pos;
+        frame->ry = pos + bytes;
+        frame->rz = pos + 2 * bytes;
+        reader->last = n;
+        return 1;
+    }
+}
+
+int FrameValid( const frame_reader_t * reader, const frame_view_t * frame )
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot_of(reader->header, frame->frame)->seq, __ATOMIC_RELAXED) == 2 * frame->frame;
+}
+
+void DetachFrameRing( frame_reader_t * reader )
+{
+    if (reader->header) munmap((void *) reader->header, reader->bytes);
+    reader->header = NULL;
+}
@@ -49,6 +49,7 @@ main(int argc, char * argv[])
     }
 
     for (ii = 0; ii < numPlatforms; ii++) {
+       printf("platform %d: ", ii);
        PrintPlatformShort(platformList[ii]);
     }
 
@@ -19,83 +19,364 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <pthread.h>
 
 #include "OpenCL_utils.h"
+#include "OpenCL_data.h"
+#include "pair_table.h"
+#include "atom_chunks.h"
+#include "arena.h"
+#include "restart.h"
+#include "domain.h"
+#include "analysis.h"
+#include "metrics.h"
+#include "counters.h"
+#include "frame_ring.h"
+#include "phases.h"
+#include "engine.h"
+
+#if defined(_MPI) && defined(_UNBLOCK)
+#error "the MPI build exchanges atoms every step and has no non blocking downloads"
+#endif
 
-#ifdef _USE_FLOAT
-#define FPTYPE float
-#define ZERO  0.0f
-#define HALF  0.5f
-#define TWO   2.0f
-#define THREE 3.0f
-static const char kernelflags[] = "-D_USE_FLOAT -cl-denorms-are-zero -cl-unsafe-math-optimizations";
-#else
-#define FPTYPE double
-#define ZERO  0.0
-#define HALF  0.5
-#define TWO   2.0
-#define THREE 3.0
-static const char kernelflags[] = "-cl-unsafe-math-optimizations";
-#endif
-
-/** generic file- or pathname buffer length */
-#define BLEN 200
-
-/** a few physical constants */
-const FPTYPE kboltz=0.0019872067;     /* boltzman constant in kcal/mol/K */
-const FPTYPE mvsq2e=2390.05736153349; /* m*v^2 in kcal/mol */
-
-/** structure to hold the complete information
-    about the MD system */
-struct _mdsys {
-    int natoms,nfi,nsteps;
-    FPTYPE dt, mass, epsilon, sigma, box, rcut;
-    FPTYPE ekin, epot, temp;
-    FPTYPE *rx, *ry, *rz;
-    FPTYPE *vx, *vy, *vz;
-    FPTYPE *fx, *fy, *fz;
-};
-typedef struct _mdsys mdsys_t;
-
-/** structure to hold the complete information
-    about the MD system on a OpenCL device*/
-struct _cl_mdsys {
-    int natoms,nfi,nsteps;
-    FPTYPE dt, mass, epsilon, sigma, box, rcut;
-    FPTYPE ekin, epot, temp;
-    cl_mem rx, ry, rz;
-    cl_mem vx, vy, vz;
-    cl_mem fx, fy, fz;
+/** slots of the print-step download events in non blocking mode:
+ * positions and kinetic energy from device 0, E_pot partials from device u at EV_EPOT+u */
+#define EV_POS  0
+#define EV_EKIN 1
+#define EV_EPOT 2
+
+/** host phases of the MD loop, timed when built with -D__PHASES */
+#define PH_VERLET_FIRST  0
+#define PH_DOMAIN        1
+#define PH_POSITIONS     2
+#define PH_FORCE         3
+#define PH_ANALYSIS      4
+#define PH_EPOT          5
+#define PH_VERLET_SECOND 6
+#define PH_COUPLING      7
+#define PH_EKIN          8
+#define PH_WAIT          9
+#define PH_REDUCTION    10
+#define PH_OUTPUT       11
+#define PH_METRICS      12
+#define NPHASES         13
+#ifdef __PHASES
+static const char *phase_names[] = { "verlet_first", "domain", "positions", "force", "analysis", "epot", "verlet_second",
+				     "coupling", "ekin", "wait", "reduction", "output", "metrics" };
+#endif
+
+/** launches of each force kernel when the vector kernel is compared with the generic one */
+#define VECTOR_REPS 3
+
+/** fractional bits of the fixed point forces of the "accumulate" keyword: the
+ * default, and the range that keeps the sums of a few hundred pairs in 64 bits */
+#define FIXED_BITS     32
+#define FIXED_MIN_BITS 16
+#define FIXED_MAX_BITS 48
+
+/** atoms per block when the velocities are streamed from the restart to the devices */
+#define STREAM_ATOMS 65536
+
+/** helper function: every device computes the forces of the atoms
+   firstatoms[u] .. firstatoms[u]+natoms[u]-1, gather the slices and
+   distribute them to all the other devices. the copies go through the
+   host buffers forces[0..2] or, in zero-copy mode, straight from the
+   mapped slice of one device to the mapped slice of the others.
+   copybytes is incremented by the number of bytes moved */
+static cl_int exchange_forces(cl_command_queue *queues, cl_mdsys_t *cl_sys, cl_uint ndevices,
+                              const chunk_layout_t *lay, cl_uint *firstatoms, cl_uint *natoms,
+                              FPTYPE **forces, cl_event *events, int zerocopy, double *copybytes)
+{
+    cl_int status = CL_SUCCESS;
+    cl_uint u, v, k;
+
+    if (zerocopy) {
+        /* the slice of one device spans at most npieces chunks, the same on every device */
+        int c, npieces = lay->nchunks, offset, count;
+        FPTYPE **slice = (FPTYPE **) alloca(sizeof(FPTYPE *)*3*ndevices*npieces);
+        FPTYPE **dst = (FPTYPE **) alloca(sizeof(FPTYPE *)*npieces);
+
+        for (u=0; u<ndevices; ++u) {
+            cl_mem *f[3] = { cl_sys[u].fx, cl_sys[u].fy, cl_sys[u].fz };
+
+            for (k=0; k<3; ++k)
+                status |= MapAtoms(queues[u], lay, f[k], firstatoms[u], natoms[u], CL_MAP_READ, CL_FALSE,
+                                   0, NULL, (k == 2) ? events+u : NULL, slice + (3*u+k)*npieces);
+        }
+        for (u=0; u<ndevices; ++u) {
+            clWaitForEvents(1, events+u);
+            clReleaseEvent(events[u]);
+        }
+
+        for (v=0; v<ndevices; ++v) {
+            cl_mem *f[3] = { cl_sys[v].fx, cl_sys[v].fy, cl_sys[v].fz };
+
+            for (u=0; u<ndevices; ++u) {
+                if (u == v) continue;
+                for (k=0; k<3; ++k) {
+                    status |= MapAtoms(queues[v], lay, f[k], firstatoms[u], natoms[u], CL_MAP_WRITE_INVALIDATE_REGION, CL_TRUE,
+                                       0, NULL, NULL, dst);
+                    for (c=0; c<ChunkPieces(lay, firstatoms[u], natoms[u]); ++c) {
+                        count = ChunkPiece(lay, firstatoms[u], natoms[u], firstatoms[u]/lay->chunk + c, &offset);
+                        memcpy(dst[c], slice[(3*u+k)*npieces+c], count*sizeof(FPTYPE));
+                    }
+                    status |= UnmapAtoms(queues[v], lay, f[k], firstatoms[u], natoms[u], dst);
+                }
+                *copybytes += 3.0*natoms[u]*sizeof(FPTYPE);
+            }
+        }
+
+        for (u=0; u<ndevices; ++u) {
+            cl_mem *f[3] = { cl_sys[u].fx, cl_sys[u].fy, cl_sys[u].fz };
+
+            for (k=0; k<3; ++k)
+                status |= UnmapAtoms(queues[u], lay, f[k], firstatoms[u], natoms[u], slice + (3*u+k)*npieces);
+        }
+        return status;
+    }
+
+    for (u=0; u<ndevices; ++u) {
+        status |= ReadAtoms(queues[u], lay, cl_sys[u].fx, firstatoms[u], natoms[u], forces[0] + firstatoms[u], CL_FALSE, 0, NULL, NULL);
+        status |= ReadAtoms(queues[u], lay, cl_sys[u].fy, firstatoms[u], natoms[u], forces[1] + firstatoms[u], CL_FALSE, 0, NULL, NULL);
+        status |= ReadAtoms(queues[u], lay, cl_sys[u].fz, firstatoms[u], natoms[u], forces[2] + firstatoms[u], CL_FALSE, 0, NULL, events+u);
+        *copybytes += 3.0*natoms[u]*sizeof(FPTYPE);
+    }
+    for (u=0; u<ndevices; ++u) {
+        clWaitForEvents(1, events+u);
+        clReleaseEvent(events[u]);
+    }
+
+    for (u=0; u<ndevices; ++u) {
+        status |= WriteAtoms(queues[u], lay, cl_sys[u].fx, 0, cl_sys[u].natoms, forces[0], CL_FALSE, 0, NULL, NULL);
+        status |= WriteAtoms(queues[u], lay, cl_sys[u].fy, 0, cl_sys[u].natoms, forces[1], CL_FALSE, 0, NULL, NULL);
+        status |= WriteAtoms(queues[u], lay, cl_sys[u].fz, 0, cl_sys[u].natoms, forces[2], CL_FALSE, 0, NULL, events+u);
+        *copybytes += 3.0*cl_sys[u].natoms*sizeof(FPTYPE);
+    }
+    for (u=0; u<ndevices; ++u) {
+        clWaitForEvents(1, events+u);
+        clReleaseEvent(events[u]);
+    }
+    return status;
+}
+
+/** a program build of one device. every build runs in a thread of its own, so
+   that the builds of all devices overlap with each other and with the restart,
+   also where clBuildProgram does not return before the build is done. the build
+   callback stamps the end of the build and wakes wait_build */
+struct _build {
+    cl_device_id device;
+    cl_program program;
+    char options[BLEN];
+    cl_int status;
+    int done;
+    double t0, seconds;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
 };
-typedef struct _cl_mdsys cl_mdsys_t;
+typedef struct _build build_t;
+
+static void CL_CALLBACK build_done(cl_program program, void *data)
+{
+    build_t *b = (build_t *) data;
+
+    pthread_mutex_lock(&b->lock);
+    if (!b->done) b->seconds = second() - b->t0;
+    b->done = 1;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void *build_thread(void *data)
+{
+    build_t *b = (build_t *) data;
+    cl_int status = clBuildProgram(b->program, 1, &b->device, b->options, build_done, b);
+
+    /* a build that could not start does not call back */
+    b->status = status;
+    if (status != CL_SUCCESS) build_done(b->program, b);
+    return NULL;
+}
+
+/** helper function: start the build of the program of one device in its own
+   context. the devices of a pool may come from different platforms and compilers */
+static cl_int start_build(build_t *b, cl_context context, cl_device_id device, const char *source, const char *options)
+{
+    char name[BLEN], ext[4096] = "";
+    cl_int status;
+
+    memset(b, 0, sizeof(build_t));
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(ext), ext, NULL);
+#ifndef _USE_FLOAT
+    if (!strstr(ext, "cl_khr_fp64")) {
+        fprintf(stderr, "%s has no double precision, build with -D_USE_FLOAT or leave it out.\n", name);
+        return CL_INVALID_DEVICE;
+    }
+#endif
+    if (strstr(options, "-D_FIXED") && !strstr(ext, "cl_khr_int64_base_atomics")) {
+        fprintf(stderr, "%s has no 64-bit atomics for the fixed point forces, use accumulate float.\n", name);
+        return CL_INVALID_DEVICE;
+    }
+    b->program = clCreateProgramWithSource(context, 1, &source, NULL, &status);
+    if (status != CL_SUCCESS) return status;
+    b->device = device;
+    snprintf(b->options, sizeof(b->options), "%s", options);
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    b->t0 = second();
+    if (pthread_create(&b->thread, NULL, build_thread, b)) return CL_OUT_OF_HOST_MEMORY;
+    return CL_SUCCESS;
+}
+
+/** helper function: wait for a build started by start_build. a failed build names
+   the device and prints its log, the __DEBUG build prints the log in any case */
+static cl_int wait_build(build_t *b, cl_program *program)
+{
+    cl_build_status state = CL_BUILD_ERROR;
+    char name[BLEN], *log;
+    size_t size = 0;
+    cl_int status;
+
+    pthread_mutex_lock(&b->lock);
+    while (!b->done) pthread_cond_wait(&b->cond, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+    pthread_join(b->thread, NULL);
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+
+    *program = b->program;
+    status = b->status;
+    clGetProgramBuildInfo(b->program, b->device, CL_PROGRAM_BUILD_STATUS, sizeof(state), &state, NULL);
+    if (status == CL_SUCCESS && state != CL_BUILD_SUCCESS) status = CL_BUILD_PROGRAM_FAILURE;
+#ifndef __DEBUG
+    if (status == CL_SUCCESS) return status;
+#endif
+    clGetDeviceInfo(b->device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetProgramBuildInfo(b->program, b->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+    log = (char *) malloc(size + 1);
+    log[0] = 0;
+    clGetProgramBuildInfo(b->program, b->device, CL_PROGRAM_BUILD_LOG, size, log, NULL);
+    log[size] = 0;
+    if (status != CL_SUCCESS)
+        fprintf(stderr, "Cannot build the kernels for %s: %s\n", name, CLErrString(status));
+    fprintf(stderr, "\nLog of %s: \n\n %s", name, log);
+    free(log);
+    return status;
+}
+
+/** helper function: wall time of reps rounds of the force launches l0 .. l1-1 */
+static double time_force(cl_command_queue queue, cl_kernel *kernel, int l0, int l1, size_t *globalWorkSize)
+{
+    double t0 = second();
+    int r, l;
+
+    for (r = 0; r < VECTOR_REPS; r++)
+        for (l = l0; l < l1; l++)
+            clEnqueueNDRangeKernel(queue, kernel[l], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL);
+    clFinish(queue);
+    return second() - t0;
+}
 
-/** helper function: read a line and then return
-   the first string with whitespace stripped off */
-static int get_me_a_line(FILE *fp, char *buf)
+/** helper function: generate the fcc lattice and its velocities on device 0, remove the
+   center of mass velocity, scale to the temperature and copy the atoms to the other
+   devices. host[0..5] are the positions and, in zero-copy mode, the velocities that
+   are the storage of device 0 */
+static cl_int generate_lattice(cl_context context, cl_program program, cl_command_queue *queues, cl_mdsys_t *cl_sys,
+                               cl_uint ndevices, const chunk_layout_t *lay, const lattice_t *lat, const mdsys_t *sys,
+                               int nthreads, FPTYPE **host, int zerocopy)
 {
-    char tmp[BLEN], *ptr;
-
-    /** read a line and cut of comments and blanks */
-    if (fgets(tmp,BLEN,fp)) {
-        int i;
-
-        ptr=strchr(tmp,'#');
-        if (ptr) *ptr= '\0';
-        i=strlen(tmp); --i;
-        while(isspace(tmp[i])) {
-            tmp[i]='\0';
-            --i;
+    size_t gws[1] = { nthreads };
+    FPTYPE a = sys->box / lat->ncell, sigma = sqrt(kboltz * lat->temp / mvsq2e / sys->mass);
+    FPTYPE cx, cy, cz, scale;
+    FPTYPE *vsum = (FPTYPE *) malloc(4 * nthreads * sizeof(FPTYPE));
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 }, sumv2;
+    cl_kernel fcc, vsumk, vscale;
+    cl_mem vsum_buffer;
+    cl_int status, err;
+    cl_uint u;
+    int c, i, k;
+
+    fcc = clCreateKernel(program, "opencl_fcc", &status);
+    vsumk = clCreateKernel(program, "opencl_vsum", &err); status |= err;
+    vscale = clCreateKernel(program, "opencl_vscale", &err); status |= err;
+    vsum_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 4 * nthreads * sizeof(FPTYPE), NULL, &err); status |= err;
+    if (status != CL_SUCCESS) return status;
+
+    /* the arguments are taken at the time of the launch, one kernel serves all chunks */
+    for (c=0; c<lay->nchunks; ++c) {
+        int nc = ChunkAtoms(lay, c), atom0 = c * lay->chunk;
+
+        status |= clSetMultKernelArgs(fcc, 0, 12, KArg(cl_sys[0].rx[c]), KArg(cl_sys[0].ry[c]), KArg(cl_sys[0].rz[c]),
+                                      KArg(cl_sys[0].vx[c]), KArg(cl_sys[0].vy[c]), KArg(cl_sys[0].vz[c]),
+                                      KArg(nc), KArg(atom0), KArg(lat->ncell), KArg(a), KArg(sigma), KArg(lat->seed));
+        status |= clEnqueueNDRangeKernel(queues[0], fcc, 1, NULL, gws, NULL, 0, NULL, NULL);
+        status |= clSetMultKernelArgs(vsumk, 0, 6, KArg(cl_sys[0].vx[c]), KArg(cl_sys[0].vy[c]), KArg(cl_sys[0].vz[c]),
+                                      KArg(nc), KArg(vsum_buffer), KArg(atom0));
+        status |= clEnqueueNDRangeKernel(queues[0], vsumk, 1, NULL, gws, NULL, 0, NULL, NULL);
+    }
+    status |= clEnqueueReadBuffer(queues[0], vsum_buffer, CL_TRUE, 0, 4 * nthreads * sizeof(FPTYPE), vsum, 0, NULL, NULL);
+    for (i=0; i<4*nthreads; ++i) sum[i%4] += vsum[i];
+
+    /* sum of v^2 in the center of mass frame, scaled to the one of 3N-3 degrees of freedom at temp */
+    cx = sum[0] / sys->natoms;
+    cy = sum[1] / sys->natoms;
+    cz = sum[2] / sys->natoms;
+    sumv2 = sum[3] - sys->natoms * ( (double) cx * cx + (double) cy * cy + (double) cz * cz );
+    scale = ( sumv2 > 0.0 ) ? sqrt( ( THREE * sys->natoms - THREE ) * kboltz * lat->temp / mvsq2e / sys->mass / sumv2 ) : ZERO;
+    for (c=0; c<lay->nchunks; ++c) {
+        int nc = ChunkAtoms(lay, c);
+
+        status |= clSetMultKernelArgs(vscale, 0, 8, KArg(cl_sys[0].vx[c]), KArg(cl_sys[0].vy[c]), KArg(cl_sys[0].vz[c]),
+                                      KArg(nc), KArg(cx), KArg(cy), KArg(cz), KArg(scale));
+        status |= clEnqueueNDRangeKernel(queues[0], vscale, 1, NULL, gws, NULL, 0, NULL, NULL);
+    }
+    status |= clFinish(queues[0]);
+
+    /* the other devices get a copy, so that all of them integrate the same system */
+    if (ndevices > 1) {
+        cl_mem *array[6] = { cl_sys[0].rx, cl_sys[0].ry, cl_sys[0].rz, cl_sys[0].vx, cl_sys[0].vy, cl_sys[0].vz };
+        FPTYPE **map = (FPTYPE **) alloca(sizeof(FPTYPE *) * lay->nchunks);
+        FPTYPE *stage = zerocopy ? NULL : (FPTYPE *) malloc(STREAM_ATOMS * sizeof(FPTYPE));
+        int first, n;
+
+        for (k=0; k<6; ++k) {
+            if (zerocopy)
+                status |= MapAtoms(queues[0], lay, array[k], 0, sys->natoms, CL_MAP_READ, CL_TRUE, 0, NULL, NULL, map);
+            for (first=0; first<sys->natoms; first+=n) {
+                n = ( sys->natoms - first < STREAM_ATOMS ) ? sys->natoms - first : STREAM_ATOMS;
+                if (!zerocopy)
+                    status |= ReadAtoms(queues[0], lay, array[k], first, n, stage, CL_TRUE, 0, NULL, NULL);
+                for (u=1; u<ndevices; ++u) {
+                    cl_mem *dst[6] = { cl_sys[u].rx, cl_sys[u].ry, cl_sys[u].rz, cl_sys[u].vx, cl_sys[u].vy, cl_sys[u].vz };
+
+                    status |= WriteAtoms(queues[u], lay, dst[k], first, n, zerocopy ? host[k] + first : stage, CL_TRUE, 0, NULL, NULL);
+                }
+            }
+            if (zerocopy)
+                status |= UnmapAtoms(queues[0], lay, array[k], 0, sys->natoms, map);
         }
-        ptr=tmp;
-        while(isspace(*ptr)) {++ptr;}
-        i=strlen(ptr);
-        strcpy(buf,tmp);
-        return 0;
-    } else {
-        perror("problem reading input");
-        return -1;
+        free(stage);
     }
-    return 0;
+
+    clReleaseMemObject(vsum_buffer);
+    clReleaseKernel(fcc);
+    clReleaseKernel(vsumk);
+    clReleaseKernel(vscale);
+    free(vsum);
+    return status;
+}
+
+/** helper function: peak resident memory of the process in MB */
+static double peak_host_mb()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
 }
 
 void PrintUsageAndExit() {
@@ -105,19 +386,179 @@ void PrintUsageAndExit() {
     exit(1);
 }
 
-/** append data to output. */
-static void output(mdsys_t *sys, FILE *erg, FILE *traj)
+/** append data to output, and publish the frame to the shared memory readers.
+   the trajectory has the unwrapped positions, the shared memory the wrapped ones */
+static void output(mdsys_t *sys, FILE *erg, FILE *traj, frame_ring_t *ring)
 {
     int i;
 
-    printf("% 8d % 20.8f % 20.8f % 20.8f % 20.8f\n", sys->nfi, sys->temp, sys->ekin, sys->epot, sys->ekin+sys->epot);
-    fprintf(erg,"% 8d % 20.8f % 20.8f % 20.8f % 20.8f\n", sys->nfi, sys->temp, sys->ekin, sys->epot, sys->ekin+sys->epot);
+    if (ring->header)
+        PublishFrame(ring, sys->nfi, sys->temp, sys->ekin, sys->epot, sys->press, sys->box, sys->rx, sys->ry, sys->rz);
+
+    printf("% 8d % 20.8f % 20.8f % 20.8f % 20.8f % 20.8f\n", sys->nfi, sys->temp, sys->ekin, sys->epot, sys->ekin+sys->epot, sys->press);
+    fprintf(erg,"% 8d % 20.8f % 20.8f % 20.8f % 20.8f % 20.8f\n", sys->nfi, sys->temp, sys->ekin, sys->epot, sys->ekin+sys->epot, sys->press);
+    if (!traj) return;
     fprintf(traj,"%d\n nfi=%d etot=%20.8f\n", sys->natoms, sys->nfi, sys->ekin+sys->epot);
     for (i=0; i<sys->natoms; ++i) {
-      fprintf(traj, "Ar  %20.8f %20.8f %20.8f\n", sys->rx[i], sys->ry[i], sys->rz[i]);
+      fprintf(traj, "Ar  %20.8f %20.8f %20.8f\n", sys->rx[i] + sys->box * sys->ix[i], sys->ry[i] + sys->box * sys->iy[i],
+              sys->rz[i] + sys->box * sys->iz[i]);
     }
 }
 
+#ifdef _MPI
+/** helper function: sum the energies of all the ranks */
+static void reduce_energies(mdsys_t *sys)
+{
+    double sum[3];
+
+    sum[0] = sys->epot;
+    sum[1] = sys->ekin;
+    sum[2] = sys->virial;
+    DomainSum(sum, 3);
+    sys->epot = sum[0];
+    sys->ekin = sum[1];
+    sys->virial = sum[2];
+}
+
+/** helper function: the number of own atoms and ghosts of a rank changes every
+   step, update the kernel arguments that count them */
+static cl_int set_domain_counts(domain_t *dom, cl_kernel verlet_first, cl_kernel verlet_second, cl_kernel ekin,
+                                cl_kernel force, cl_kernel force_noepot)
+{
+    int nall = dom->nlocal + dom->nghost;
+    cl_int status;
+
+    status  = clSetKernelArg(verlet_first, VERLET_FIRST_ARG_NATOMS, sizeof(int), &dom->nlocal);
+    status |= clSetKernelArg(verlet_second, VERLET_SECOND_ARG_NATOMS, sizeof(int), &dom->nlocal);
+    status |= clSetKernelArg(ekin, EKIN_ARG_NATOMS, sizeof(int), &dom->nlocal);
+    status |= clSetKernelArg(force, FORCE_ARG_NJ, sizeof(int), &nall);
+    status |= clSetKernelArg(force, FORCE_ARG_NATOMS1, sizeof(int), &dom->nlocal);
+    status |= clSetKernelArg(force_noepot, FORCE_ARG_NJ, sizeof(int), &nall);
+    status |= clSetKernelArg(force_noepot, FORCE_ARG_NATOMS1, sizeof(int), &dom->nlocal);
+    return status;
+}
+
+/** helper function: upload the positions of own atoms and ghosts and the
+   velocities and images of own atoms of a rank */
+static cl_int upload_domain(cl_command_queue queue, const chunk_layout_t *lay, cl_mdsys_t *cl_sys, domain_t *dom)
+{
+    int nall = dom->nlocal + dom->nghost;
+    cl_int status;
+
+    status  = WriteAtoms(queue, lay, cl_sys->rx, 0, nall, dom->rx, CL_TRUE, 0, NULL, NULL);
+    status |= WriteAtoms(queue, lay, cl_sys->ry, 0, nall, dom->ry, CL_TRUE, 0, NULL, NULL);
+    status |= WriteAtoms(queue, lay, cl_sys->rz, 0, nall, dom->rz, CL_TRUE, 0, NULL, NULL);
+    status |= WriteAtoms(queue, lay, cl_sys->vx, 0, dom->nlocal, dom->vx, CL_TRUE, 0, NULL, NULL);
+    status |= WriteAtoms(queue, lay, cl_sys->vy, 0, dom->nlocal, dom->vy, CL_TRUE, 0, NULL, NULL);
+    status |= WriteAtoms(queue, lay, cl_sys->vz, 0, dom->nlocal, dom->vz, CL_TRUE, 0, NULL, NULL);
+    status |= WriteImages(queue, lay, cl_sys->ix, 0, dom->nlocal, dom->ix, CL_TRUE, 0, NULL, NULL);
+    status |= WriteImages(queue, lay, cl_sys->iy, 0, dom->nlocal, dom->iy, CL_TRUE, 0, NULL, NULL);
+    status |= WriteImages(queue, lay, cl_sys->iz, 0, dom->nlocal, dom->iz, CL_TRUE, 0, NULL, NULL);
+    return status;
+}
+
+/** helper function: download the positions, velocities and images of the own atoms of a rank */
+static cl_int download_domain(cl_command_queue queue, const chunk_layout_t *lay, cl_mdsys_t *cl_sys, domain_t *dom)
+{
+    cl_int status;
+
+    status  = ReadAtoms(queue, lay, cl_sys->rx, 0, dom->nlocal, dom->rx, CL_TRUE, 0, NULL, NULL);
+    status |= ReadAtoms(queue, lay, cl_sys->ry, 0, dom->nlocal, dom->ry, CL_TRUE, 0, NULL, NULL);
+    status |= ReadAtoms(queue, lay, cl_sys->rz, 0, dom->nlocal, dom->rz, CL_TRUE, 0, NULL, NULL);
+    status |= ReadAtoms(queue, lay, cl_sys->vx, 0, dom->nlocal, dom->vx, CL_TRUE, 0, NULL, NULL);
+    status |= ReadAtoms(queue, lay, cl_sys->vy, 0, dom->nlocal, dom->vy, CL_TRUE, 0, NULL, NULL);
+    status |= ReadAtoms(queue, lay, cl_sys->vz, 0, dom->nlocal, dom->vz, CL_TRUE, 0, NULL, NULL);
+    status |= ReadImages(queue, lay, cl_sys->ix, 0, dom->nlocal, dom->ix, CL_TRUE, 0, NULL, NULL);
+    status |= ReadImages(queue, lay, cl_sys->iy, 0, dom->nlocal, dom->iy, CL_TRUE, 0, NULL, NULL);
+    status |= ReadImages(queue, lay, cl_sys->iz, 0, dom->nlocal, dom->iz, CL_TRUE, 0, NULL, NULL);
+    return status;
+}
+#endif
+
+/** reduce the energy partials downloaded from the devices to the energies of the sample,
+   that output() then writes. the energy partials are followed by the virial partials
+   and the box length of the force */
+static void reduce_sample(mdsys_t *sys, FPTYPE **tmp_epot, FPTYPE *tmp_ekin, cl_uint ndevices, int nthreads)
+{
+    cl_uint u;
+    int i;
+
+    /* initialize the sys.epot@host and sys.ekin@host variables to ZERO */
+    sys->epot = ZERO;
+    sys->ekin = ZERO;
+    sys->virial = ZERO;
+
+    for (u=0; u<ndevices; ++u)
+        for (i=0; i<nthreads; ++i) {
+            sys->epot += tmp_epot[u][i];
+            sys->virial += tmp_epot[u][nthreads+i];
+        }
+    sys->box = tmp_epot[0][2*nthreads];
+    for (i=0; i<nthreads; ++i)
+        sys->ekin += tmp_ekin[i];
+#ifdef _MPI
+    reduce_energies(sys);
+#endif
+
+    /* multiplying the kinetic energy by prefactors */
+    SampleEnergies(sys);
+}
+
+/** add the pair counts of all devices (and ranks) to the g(r) histogram, clear them
+   on the devices and rewrite the g(r) file */
+static cl_int flush_rdf(cl_command_queue *queues, cl_mem *rdf_buffer, cl_uint ndevices, rdf_t *rdf, mdsys_t *sys, int write)
+{
+    double *delta = (double *) calloc(rdf->nbins, sizeof(double));
+    size_t bytes = rdf->nbins * sizeof(cl_uint);
+    cl_int status = CL_SUCCESS;
+    cl_uint u;
+    int b;
+
+    for (u=0; u<ndevices; ++u) {
+        status |= clEnqueueReadBuffer(queues[u], rdf_buffer[u], CL_TRUE, 0, bytes, rdf->counts, 0, NULL, NULL);
+        for (b=0; b<rdf->nbins; ++b) delta[b] += rdf->counts[b];
+    }
+    memset(rdf->counts, 0, bytes);
+    for (u=0; u<ndevices; ++u)
+        status |= clEnqueueWriteBuffer(queues[u], rdf_buffer[u], CL_TRUE, 0, bytes, rdf->counts, 0, NULL, NULL);
+#ifdef _MPI
+    DomainSum(delta, rdf->nbins);
+#endif
+    for (b=0; b<rdf->nbins; ++b) rdf->hist[b] += delta[b];
+    free(delta);
+
+    if (write && WriteRdf(rdf, sys)) status = CL_INVALID_VALUE;
+    return status;
+}
+
+/** store the positions and velocities of this step as the time origin of the current
+   slot and add their correlations with the other stored origins, then advance the
+   slot. the kernels of every chunk and origin of device 0 are bound once */
+static cl_int correlate(cl_command_queue queue, cl_kernel *kernel_corr, cl_kernel kernel_next, int nkernels, corr_t *corr, size_t *globalWorkSize)
+{
+    size_t singleWorkSize[1] = { 1 };
+    cl_int status = CL_SUCCESS;
+    int k;
+
+    for (k=0; k<nkernels; ++k)
+        status |= clEnqueueNDRangeKernel(queue, kernel_corr[k], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL);
+    status |= clEnqueueNDRangeKernel(queue, kernel_next, 1, NULL, singleWorkSize, NULL, 0, NULL, NULL);
+    corr->nsamples++;
+    return status;
+}
+
+#ifdef _UNBLOCK
+/** wait for the print-step downloads, one context at a time, and release their events */
+static void wait_downloads(cl_event *event, cl_uint ndevices)
+{
+    cl_uint u;
+
+    clWaitForEvents(EV_EPOT+1, event);
+    for (u=1; u<ndevices; ++u) clWaitForEvents(1, &event[EV_EPOT+u]);
+    for (u=0; u<ndevices+2; ++u) clReleaseEvent(event[u]);
+}
+#endif
+
 
 
 
@@ -133,28 +574,70 @@ int main(int argc, char **argv)
 
   /** The event variables are created only when needed */
 #ifdef _UNBLOCK
-  cl_event *event;
+  cl_command_queue *copyQueues;
+  cl_event *event, *kevent;
 #endif
+  int pending = 0;   /* a sample is downloading (non blocking version only) */
 
   cl_event *force_event;
+  size_t singleWorkSize[1] = { 1 };
 
   FPTYPE * buffers[6];
   cl_mdsys_t *cl_sys;
   cl_int status;
   cl_uint ndevices;
+  double *weights, wtotal;
 
   int nprint, i, nthreads = 0;
-  char restfile[BLEN], trajfile[BLEN], ergfile[BLEN], line[BLEN];
-  FILE *fp,*traj,*erg;
+  char line[BLEN];
+  input_t in;
+  FILE *traj,*erg;
   mdsys_t sys;
+  thermo_t thermo = { THERMO_NONE, ZERO, 100.0, 12345 };
+  baro_t baro = { BARO_NONE, ONE, 1000.0, 4.5e-5 };
+  pair_table_t table;
+  rdf_t rdf;
+  corr_t corr;
+  metrics_t metrics;
+  counters_t counters;
+  frame_ring_t ring;
+#ifdef __PHASES
+  phases_t phases;
+#endif
+  char kernelopts[BLEN], rdfopt[BLEN] = "", fixopt[BLEN] = "";
   cl_uint u, nforce, *firstatoms, *natoms;
+  int zerocopy = ZEROCOPY_AUTO;
+  int vector = VECTOR_AUTO;
+  int fixbits = 0;
+  int parser = RESTART_MMAP;
+  restart_t rst;
+  lattice_t lat = { 0, ZERO, ZERO, 12345 };
+  double copybytes = 0.0;
+  chunk_layout_t lay;
+  FPTYPE * vbuf[3] = { NULL, NULL, NULL };
+  host_arena_t host = { NULL, 0, 0 };
+  arena_t *arena;
+  FILE *inp = stdin;
+  int ndomains = 1;
+#ifdef _MPI
+  domain_t dom;
+
+  /* every rank drives its own device, only rank 0 talks to the terminal */
+  MPI_Init( &argc, &argv );
+  MPI_Comm_size( MPI_COMM_WORLD, &ndomains );
+  MPI_Comm_rank( MPI_COMM_WORLD, &i );
+  if( i > 0 ) freopen( "/dev/null", "w", stdout );
+#endif
+  /* wall time of the start up, reported with the first step */
+  double tstart = second();
 
 
 /** Start profiling */
 
 #ifdef __PROFILING
 
-  double t1, t2;
+  double t1, t2, t3, t4, c1, t_sample = 0.0;
+  int nsample = 0;
 
   t1 = second();
 
@@ -162,9 +645,7 @@ int main(int argc, char **argv)
 
   /** handling the command line arguments */
   switch (argc) {
-      case 2: /** only the cpu/gpu argument was passed, setting default nthreads */
-	      if( !strcmp( argv[1], "cpu" ) ) nthreads = 16;
-	      else nthreads = 1024;
+      case 2: /** only the device argument was passed, nthreads is set by the devices */
 	      break;
       case 3: /** both the device type (cpu/gpu) and the number of threads were passed */
 	      nthreads = strtol(argv[2],NULL,10);
@@ -179,11 +660,20 @@ int main(int argc, char **argv)
   }
 
   /* Initialize the OpenCL environment */
-  if( InitOpenCLEnvironment( argv[1], &devices, &contexts, &cmdQueues, &ndevices ) != CL_SUCCESS ){
+  if( InitOpenCLEnvironment( argv[1], &devices, &contexts, &cmdQueues, &ndevices, &weights ) != CL_SUCCESS ){
     fprintf( stderr, "Program Error! OpenCL Environment was not initialized correctly.\n" );
     return 4;
   }
 
+  /* default threads: few for a pool of CPUs only, many as soon as a GPU takes part */
+  if( nthreads == 0 ) {
+    nthreads = 16;
+    for( u = 0; u < ndevices; u++ ) {
+      clGetDeviceInfo( devices[u], CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL );
+      if( !( device_type & CL_DEVICE_TYPE_CPU ) ) nthreads = 1024;
+    }
+  }
+
   /* The event initialization is performed only when needed */
   if(!(cl_sys = (cl_mdsys_t *) malloc(sizeof(cl_mdsys_t)*ndevices))) {
     fprintf( stderr, "Cannot allocate memory of cl_sys copies.\n");
@@ -191,432 +681,1309 @@ int main(int argc, char **argv)
   }
 
 #ifdef _UNBLOCK
-  /* initialize the cl_event handler variables */
+  /* the print-step downloads go to a second in-order queue of the same device,
+   * ordered against the compute queue by events only. event[] are the
+   * downloads, kevent[] the kernels producing the downloaded data */
+  copyQueues = (cl_command_queue *) alloca(sizeof(cl_command_queue)*ndevices);
+  for( u = 0; u < ndevices; u++ ) {
+	  copyQueues[u] = clCreateCommandQueue( contexts[u], devices[u], 0, &status );
+	  CheckSuccess(status, 0);
+  }
   event = (cl_event *) alloca(sizeof(cl_event)*(ndevices+2));
-  for( i = 0; i < 3; ++i) {
-	  event[i] = clCreateUserEvent( contexts[0], NULL );
-	  clSetUserEventStatus( event[i], CL_COMPLETE );
-  }
-  for( i = 3; i < ndevices+2; ++i) {
-	  event[i] = clCreateUserEvent( contexts[i-2], NULL );
-	  clSetUserEventStatus( event[i], CL_COMPLETE );
-  }
-#endif
-
-  /* read input file */
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.natoms=atoi(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.mass=atof(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.epsilon=atof(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.sigma=atof(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.rcut=atof(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.box=atof(line);
-  if(get_me_a_line(stdin,restfile)) return 1;
-  if(get_me_a_line(stdin,trajfile)) return 1;
-  if(get_me_a_line(stdin,ergfile)) return 1;
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.nsteps=atoi(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  sys.dt=atof(line);
-  if(get_me_a_line(stdin,line)) return 1;
-  nprint=atoi(line);
-
-
-  /* allocate memory */
-  for(u = 0; u < ndevices; u++) {
-    cl_sys[u].natoms = sys.natoms;
-    cl_sys[u].rx = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].ry = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].rz = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].vx = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].vy = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].vz = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].fx = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].fy = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-    cl_sys[u].fz = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, cl_sys[u].natoms * sizeof(FPTYPE), NULL, &status );
-  }
-
-  //positions and velocities
-  buffers[0] = (FPTYPE *) malloc( 2 * cl_sys[0].natoms * sizeof(FPTYPE) );
-  buffers[1] = (FPTYPE *) malloc( 2 * cl_sys[0].natoms * sizeof(FPTYPE) );
-  buffers[2] = (FPTYPE *) malloc( 2 * cl_sys[0].natoms * sizeof(FPTYPE) );
-  //forces
-  buffers[3] = (FPTYPE *) malloc( cl_sys[0].natoms * sizeof(FPTYPE) );
-  buffers[4] = (FPTYPE *) malloc( cl_sys[0].natoms * sizeof(FPTYPE) );
-  buffers[5] = (FPTYPE *) malloc( cl_sys[0].natoms * sizeof(FPTYPE) );
-
-  /* read restart */
-  fp = fopen( restfile, "r" );
-  if( fp ) {
-    for( i = 0; i < 2 * cl_sys[0].natoms; ++i ){
-#ifdef _USE_FLOAT
-      fscanf( fp, "%f%f%f", buffers[0] + i, buffers[1] + i, buffers[2] + i);
-#else
-      fscanf( fp, "%lf%lf%lf", buffers[0] + i, buffers[1] + i, buffers[2] + i);
+  kevent = (cl_event *) alloca(sizeof(cl_event)*(ndevices+2));
 #endif
+
+  /* read input file. with MPI rank 0 reads it and passes it on */
+#ifdef _MPI
+  inp = DomainInput( stdin );
+#endif
+  if(ReadInput(inp,&sys,&in)) return 1;
+  if(!strncmp(in.restfile,"fcc",3) && isspace(in.restfile[3]))
+    if(ReadLattice(in.restfile,&lat,&sys)) return 1;
+  nprint=in.nprint;
+
+  /* optional keywords */
+  memset( &table, 0, sizeof(table) );
+  memset( &rdf, 0, sizeof(rdf) );
+  memset( &corr, 0, sizeof(corr) );
+  memset( &metrics, 0, sizeof(metrics) );
+  memset( &counters, 0, sizeof(counters) );
+  memset( &ring, 0, sizeof(ring) );
+  memset( &rst, 0, sizeof(rst) );
+  metrics.format = -1;
+  while(ReadInputOption(inp,line) == 0) {
+    if(!strncmp(line,"thermostat",10)) {
+      if(ReadThermostat(line,&thermo)) return 1;
+    } else if(!strncmp(line,"barostat",8)) {
+      if(ReadBarostat(line,&baro)) return 1;
+    } else if(!strncmp(line,"zerocopy",8)) {
+      if( ReadZerocopyOption( line, &zerocopy ) ) return 1;
+    } else if(!strncmp(line,"restart",7)) {
+      if( ReadRestartOption( line, &parser ) ) return 1;
+    } else if(!strncmp(line,"vector",6)) {
+      if( ReadVectorOption( line, &vector ) ) return 1;
+    } else if(!strncmp(line,"accumulate",10)) {
+      char kind[BLEN] = "";
+      int bits = FIXED_BITS;
+
+      sscanf( line, "%*s %s %d", kind, &bits );
+      if( !strcmp( kind, "float" ) ) fixbits = 0;
+      else if( !strcmp( kind, "fixed" ) && bits >= FIXED_MIN_BITS && bits <= FIXED_MAX_BITS ) fixbits = bits;
+      else {
+        fprintf( stderr, "usage: accumulate float|fixed [bits], %d <= bits <= %d\n", FIXED_MIN_BITS, FIXED_MAX_BITS );
+        return 1;
+      }
+    } else if(!strncmp(line,"potential",9)) {
+      char kind[BLEN] = "";
+
+      sscanf( line, "%*s %s", kind );
+      table.npoints = 0;
+      if( !strcmp( kind, "table" ) ) {
+        if( ReadPairTableOption( line, &table ) ) return 1;
+      } else if( strcmp( kind, "lj" ) ) {
+        fprintf( stderr, "usage: potential lj|table ...\n" );
+        return 1;
+      }
+    } else if(!strncmp(line,"rdf",3)) {
+      if( ReadRdfOption( line, &rdf ) ) return 1;
+    } else if(!strncmp(line,"correlation",11)) {
+      if( ReadCorrOption( line, &corr ) ) return 1;
+    } else if(!strncmp(line,"metrics",7)) {
+      if( ReadMetricsOption( line, &metrics ) ) return 1;
+    } else if(!strncmp(line,"counters",8)) {
+      if( ReadCountersOption( line, &counters ) ) return 1;
+    } else if(!strncmp(line,"publish",7)) {
+      if( ReadPublishOption( line, &ring ) ) return 1;
+    } else {
+      fprintf( stderr, "unknown input keyword: %s\n", line );
+      return 1;
     }
+  }
 
+  /* the force kernels are timed through profiling events of the compute queues */
+  if( metrics.format >= 0 || counters.every )
     for( u = 0; u < ndevices; u++ ) {
-      status = clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].rx, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[0], 0, NULL, NULL );
-      status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].ry, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[1], 0, NULL, NULL );
-      status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].rz, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[2], 0, NULL, NULL );
+      clReleaseCommandQueue( cmdQueues[u] );
+      cmdQueues[u] = clCreateCommandQueue( contexts[u], devices[u], CL_QUEUE_PROFILING_ENABLE, &status );
+      CheckSuccess(status, 0);
+    }
+  if( counters.every && InitCounters( &counters, ndevices, nthreads ) ) return 5;
+
+  /* zero-copy host access when every device shares the memory with the host */
+  if( zerocopy == ZEROCOPY_AUTO ) {
+    cl_bool unified;
 
-      status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].vx, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[0] + cl_sys[u].natoms, 0, NULL, NULL );
-      status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].vy, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[1] + cl_sys[u].natoms, 0, NULL, NULL );
-      status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].vz, CL_TRUE, 0, cl_sys[u].natoms * sizeof(FPTYPE), buffers[2] + cl_sys[u].natoms, 0, NULL, NULL );
+    zerocopy = ZEROCOPY_ON;
+    for( u = 0; u < ndevices; u++ ) {
+      status = clGetDeviceInfo( devices[u], CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL );
+      if( status != CL_SUCCESS || !unified ) zerocopy = ZEROCOPY_OFF;
     }
+  }
 
-    fclose(fp);
+#ifdef _MPI
+  /* slabs of the box along x, one per rank. every rank drives one device, chosen
+   * by its rank on the node, and exchanges its atoms through the host */
+  if( DomainInit( &dom, sys.natoms, sys.box, sys.rcut ) ) {
+    fprintf( stderr, "The slabs of %d ranks are thinner than the cutoff.\n", ndomains );
+    return 1;
+  }
+  if( ndomains > 1 ) {
+    if( thermo.kind == THERMO_BERENDSEN || thermo.kind == THERMO_VRESCALE ) {
+      fprintf( stderr, "The %s thermostat needs the kinetic energy of every step and does not run on several ranks.\n",
+	       thermo_names[thermo.kind] );
+      return 1;
+    }
+    if( lat.ncell ) {
+      fprintf( stderr, "The fcc lattice is generated on a single rank, write it with examples/mklattice.py.\n" );
+      return 1;
+    }
+    if( baro.kind ) {
+      fprintf( stderr, "The barostat needs the virial of all atoms on one device and does not run on several ranks.\n" );
+      return 1;
+    }
+    if( corr.nlags ) {
+      fprintf( stderr, "The time correlations need the unwrapped positions of all atoms on a single rank.\n" );
+      return 1;
+    }
+    u = dom.noderank % ndevices;
+    devices[0] = devices[u];
+    contexts[0] = contexts[u];
+    cmdQueues[0] = cmdQueues[u];
+    ndevices = 1;
+    zerocopy = ZEROCOPY_OFF;
+    if( metrics.format >= 0 ) snprintf( metrics.file + strlen( metrics.file ), 8, ".%d", dom.rank );
+  }
+#endif
 
-  } else {
-    perror("cannot read restart file");
-    return 3;
+  /* every device computes the virial of its own slice only */
+  if( baro.kind && ndevices > 1 ) {
+    fprintf( stderr, "The barostat needs the virial of all atoms on one device.\n" );
+    return 1;
   }
 
-  /* initialize forces and energies.*/
-  sys.nfi=0;
+  /* the devices exchange their slices of fx, fy and fz, not the fixed point sums */
+  if( fixbits && ndevices > 1 ) {
+    fprintf( stderr, "The fixed point forces need one device per process, use MPI for more.\n" );
+    return 1;
+  }
 
-  size_t globalWorkSize[1];
-  globalWorkSize[0] = nthreads;
+  if( vector > 0 && table.npoints ) {
+    fprintf( stderr, "The vector force kernel has no pair table, use vector auto or off.\n" );
+    return 1;
+  }
+  if( vector > 0 && fixbits ) {
+    fprintf( stderr, "The vector force kernel has no fixed point forces, use vector auto or off.\n" );
+    return 1;
+  }
 
+  /* the programs of all devices build while the buffers are allocated and the
+   * restart is read and uploaded. the thermostat is compiled into the verlet
+   * kernels, the pair table and the g(r) histogram into the force kernel. CPU
+   * devices get the force kernel in explicit vectors, the generic one of the same
+   * program is kept to time it against */
   const char * sourcecode =
   #include <opencl_kernels_as_string.h>
   ;
+  build_t *builds = (build_t *) alloca(sizeof(build_t)*ndevices);
+  int *vecwidth = (int *) alloca(sizeof(int)*ndevices);
+  double tbuild = 0.0, twait;
+
+  if( rdf.nbins ) snprintf( rdfopt, sizeof(rdfopt), " -D_RDF=%d", rdf.nbins );
+  if( fixbits ) snprintf( fixopt, sizeof(fixopt), " -D_FIXED=%d", fixbits );
+  snprintf( kernelopts, sizeof(kernelopts), "%s -D_THERMOSTAT=%d%s%s%s%s%s%s", KERNEL_FLAGS, thermo.kind,
+	    table.npoints ? " -D_TABLE" : "", table.cubic ? " -D_TABLE_CUBIC" : "", rdfopt,
+	    baro.kind ? " -D_BAROSTAT" : "", fixopt, counters.every ? " -D_COUNTERS" : "" );
+  for(u = 0; u < ndevices; u++) {
+    char devopts[BLEN];
 
-  cl_program *program = (cl_program *) alloca(sizeof(cl_program)*ndevices);
-  cl_kernel *kernel_force = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices);
-  cl_kernel *kernel_ekin = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices);
-  cl_kernel *kernel_verlet_first = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices);
-  cl_kernel *kernel_verlet_second = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices);
-  cl_kernel *kernel_azzero = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices);
+    vecwidth[u] = VectorWidth( devices[u], vector, table.npoints || fixbits );
+    snprintf( devopts, sizeof(devopts), vecwidth[u] ? "%s -D_VECTOR=%d" : "%s", kernelopts, vecwidth[u] );
+    status = start_build( &builds[u], contexts[u], devices[u], sourcecode, devopts );
+    CheckSuccess(status, 0);
+  }
 
-  for(u = 0; u < ndevices; u++) {
-    program[u] = clCreateProgramWithSource( contexts[u], 1, (const char **) &sourcecode, NULL, &status );
+  /* every per-atom array is split in chunks that no device refuses to allocate */
+  {
+    cl_ulong maxalloc = 0, m;
 
-    status |= clBuildProgram( program[u], 0, NULL, kernelflags, NULL, NULL );
+    for( u = 0; u < ndevices; u++ ) {
+      clGetDeviceInfo( devices[u], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(m), &m, NULL );
+      if( u == 0 || m < maxalloc ) maxalloc = m;
+    }
+    /* the fixed point sums take 64 bits per atom */
+    if( fixbits ) maxalloc = maxalloc / sizeof(cl_long) * sizeof(FPTYPE);
+    if( SetChunkLayout( &lay, sys.natoms, maxalloc, sysconf(_SC_PAGESIZE) ) ) {
+      fprintf( stderr, "Cannot split the atoms in buffers of %lu bytes.\n", (unsigned long) maxalloc );
+      return 5;
+    }
+#ifdef _MPI
+    /* the own atoms and ghosts of a rank change every step and live in one chunk */
+    if( ndomains > 1 && ( SetChunkLayout( &lay, dom.cap, maxalloc, sysconf(_SC_PAGESIZE) ) || lay.nchunks > 1 ) ) {
+      fprintf( stderr, "The %d atoms of a rank do not fit in a buffer of %lu bytes, use more ranks.\n",
+	       dom.cap, (unsigned long) maxalloc );
+      return 5;
+    }
+#endif
+  }
+
+  //determine how many force vectors to calculate per device, in proportion to its weight
+  firstatoms = (cl_uint *) alloca(sizeof(cl_uint) * ndevices);
+  natoms = (cl_uint *) alloca(sizeof(cl_uint) * ndevices);
+
+  for( u = 0, wtotal = 0.0; u < ndevices; u++ ) wtotal += weights[u];
+  for( u = 0; u < ndevices-1 ; u++) {
+    nforce = (double) sys.natoms * weights[u] / wtotal;
+    firstatoms[u] = u ? firstatoms[u-1] + natoms[u-1] : 0;
+    natoms[u] = nforce;
+  }
+  //last gpu gets a few more atoms if it doesn't match
+  firstatoms[ndevices-1] = ndevices > 1 ? firstatoms[ndevices-2] + natoms[ndevices-2] : 0;
+  natoms[ndevices-1] = sys.natoms - firstatoms[ndevices-1];
+  //a rank computes the forces of its own atoms, counted again every step
+  if( ndomains > 1 ) natoms[0] = lay.natoms;
+
+  /* host storage in one allocation: the positions (on rank 0 only with MPI), the
+   * forces staged when the slices are exchanged by copies, the velocities that are
+   * the storage of device 0 in zero-copy mode and the energy partials */
+  size_t epotbytes = ( 2 * nthreads + 1 ) * sizeof(FPTYPE);
+  size_t hoff[9], himg[3], *hepot = (size_t *) alloca(sizeof(size_t)*ndevices), *hekin = (size_t *) alloca(sizeof(size_t)*ndevices);
+  FPTYPE **tmp_epot = (FPTYPE **) alloca(sizeof(FPTYPE *)*ndevices);
+  FPTYPE **tmp_ekin = (FPTYPE **) alloca(sizeof(FPTYPE *)*ndevices);
+  int hostpos = 1;
+
+#ifdef _MPI
+  if( ndomains > 1 ) hostpos = ( dom.rank == 0 );
+#endif
+  for( i = 0; i < 9; i++ ) {
+    int need = ( i < 3 ) ? hostpos : ( ( i < 6 ) ? ( ndevices > 1 && !zerocopy ) : zerocopy );
+
+    hoff[i] = need ? HostArenaReserve( &host, (size_t) sys.natoms * sizeof(FPTYPE) ) : (size_t) -1;
+  }
+  /* the image counters that unwrap the positions of the output */
+  for( i = 0; i < 3; i++ )
+    himg[i] = hostpos ? HostArenaReserve( &host, (size_t) sys.natoms * sizeof(cl_int) ) : (size_t) -1;
+  for( u = 0; u < ndevices; u++ ) {
+    hepot[u] = HostArenaReserve( &host, epotbytes );
+    hekin[u] = HostArenaReserve( &host, nthreads * sizeof(FPTYPE) );
+  }
+  if( CommitHostArena( &host ) ) {
+    fprintf( stderr, "Cannot allocate the host buffers for %d atoms.\n", sys.natoms );
+    return 5;
+  }
+  for( i = 0; i < 9; i++ ) {
+    FPTYPE *ptr = ( hoff[i] == (size_t) -1 ) ? NULL : (FPTYPE *) HostArenaPointer( &host, hoff[i] );
+
+    if( i < 6 ) buffers[i] = ptr;
+    else vbuf[i-6] = ptr;
+  }
+  for( u = 0; u < ndevices; u++ ) {
+    tmp_epot[u] = (FPTYPE *) HostArenaPointer( &host, hepot[u] );
+    tmp_ekin[u] = (FPTYPE *) HostArenaPointer( &host, hekin[u] );
+  }
+  if( hostpos ) {
+    sys.ix = (cl_int *) HostArenaPointer( &host, himg[0] );
+    sys.iy = (cl_int *) HostArenaPointer( &host, himg[1] );
+    sys.iz = (cl_int *) HostArenaPointer( &host, himg[2] );
+    for( i = 0; i < 3; i++ ) memset( HostArenaPointer( &host, himg[i] ), 0, (size_t) sys.natoms * sizeof(cl_int) );
+  }
+
+  /* device memory, one arena per device: the state buffers first, so that their
+   * initial contents go up in one transfer, then the atoms and, on device 0, the
+   * time origins of the correlations. in zero-copy mode the positions and
+   * velocities of device 0 are the host storage and all blocks are host
+   * accessible, for the mapped force exchange */
+  cl_mem *epot_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *ekin_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *thermo_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *tstate_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *baro_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *table_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *rdf_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *cnt_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
+  cl_mem *corr_buffer = NULL, corr_acc = NULL, corr_state = NULL;
+  int rdfbins = rdf.nbins ? rdf.nbins : 1;
+  size_t corrbytes = 2 * (size_t) corr.nlags * nthreads * sizeof(FPTYPE);
+
+  arena = (arena_t *) alloca(sizeof(arena_t)*ndevices);
+  for( u = 0; u < ndevices; u++ ) {
+    int sepot, sekin, sthermo, ststate, sbaro, stable, srdf, scnt, sacc = 0, scstate = 0, sring = 0, sr[6] = { 0 }, sf[3], sa[3], si[3], c, l;
+    int own = !( zerocopy && u == 0 );
+
+    InitArena( &arena[u], contexts[u], devices[u], zerocopy ? CL_MEM_ALLOC_HOST_PTR : 0 );
+    if( u == 0 && corrbytes > arena[u].maxalloc ) {
+      fprintf( stderr, "The partials of %d lags and %d threads do not fit in a buffer of device 0, use fewer lags.\n",
+	       corr.nlags, nthreads );
+      return 6;
+    }
+    sepot = ArenaReserve( &arena[u], epotbytes );
+    sekin = ArenaReserve( &arena[u], nthreads * sizeof(FPTYPE) );
+    sthermo = ArenaReserve( &arena[u], THERMO_NSTATE * sizeof(FPTYPE) );
+    ststate = ArenaReserve( &arena[u], 2 * sizeof(cl_uint) );
+    sbaro = ArenaReserve( &arena[u], BARO_NSTATE * sizeof(FPTYPE) );
+    stable = ArenaReserve( &arena[u], table.npoints ? PairTableSize( &table ) : TABLE_NCOEF_CUBIC * sizeof(FPTYPE) );
+    srdf = ArenaReserve( &arena[u], rdfbins * sizeof(cl_uint) );
+    /* without counters the kernels never touch their sums, that keep a slot of their own */
+    scnt = ArenaReserve( &arena[u], counters.every ? CountersBytes( &counters ) : sizeof(cl_ulong) );
+    if( u == 0 && corr.nlags ) {
+      sacc = ArenaReserve( &arena[u], corrbytes );
+      scstate = ArenaReserve( &arena[u], 2 * sizeof(cl_int) );
+    }
+    for( i = 0; i < 6; i++ )
+      if( own ) sr[i] = ReserveChunkedArray( &arena[u], &lay );
+    for( i = 0; i < 3; i++ )
+      sf[i] = ReserveChunkedArray( &arena[u], &lay );
+    for( i = 0; i < 3; i++ )
+      si[i] = ReserveImageArray( &arena[u], &lay );
+    /* 64-bit fixed point sums of the forces, one per atom of every chunk */
+    if( fixbits )
+      for( i = 0; i < 3; i++ )
+	for( c = 0; c < lay.nchunks; c++ ) {
+	  int slot = ArenaReserve( &arena[u], ChunkAtoms( &lay, c ) * sizeof(cl_long) );
+
+	  if( c == 0 ) sa[i] = slot;
+	}
+    /* positions and velocities of every chunk for every origin, at 6*(c*nlags+origin) */
+    if( u == 0 && corr.nlags )
+      for( c = 0; c < lay.nchunks; c++ )
+	for( l = 0; l < 6 * corr.nlags; l++ ) {
+	  int slot = ArenaReserve( &arena[u], ChunkAtoms( &lay, c ) * sizeof(FPTYPE) );
+
+	  if( c == 0 && l == 0 ) sring = slot;
+	}
+
+    if( CommitArena( &arena[u] ) != CL_SUCCESS ) {
+      fprintf( stderr, "Cannot allocate %.4g MB of device memory for %d atoms.\n", ArenaBytes( &arena[u] ) / 1048576.0,
+	       lay.natoms );
+      return 5;
+    }
+    epot_buffer[u] = ArenaBuffer( &arena[u], sepot );
+    ekin_buffer[u] = ArenaBuffer( &arena[u], sekin );
+    thermo_buffer[u] = ArenaBuffer( &arena[u], sthermo );
+    tstate_buffer[u] = ArenaBuffer( &arena[u], ststate );
+    baro_buffer[u] = ArenaBuffer( &arena[u], sbaro );
+    table_buffer[u] = ArenaBuffer( &arena[u], stable );
+    rdf_buffer[u] = ArenaBuffer( &arena[u], srdf );
+    cnt_buffer[u] = ArenaBuffer( &arena[u], scnt );
+    if( u == 0 && corr.nlags ) {
+      corr_acc = ArenaBuffer( &arena[u], sacc );
+      corr_state = ArenaBuffer( &arena[u], scstate );
+      corr_buffer = ArenaBuffers( &arena[u], sring );
+    }
+    if( own ) {
+      cl_sys[u].rx = ArenaBuffers( &arena[u], sr[0] );
+      cl_sys[u].ry = ArenaBuffers( &arena[u], sr[1] );
+      cl_sys[u].rz = ArenaBuffers( &arena[u], sr[2] );
+      cl_sys[u].vx = ArenaBuffers( &arena[u], sr[3] );
+      cl_sys[u].vy = ArenaBuffers( &arena[u], sr[4] );
+      cl_sys[u].vz = ArenaBuffers( &arena[u], sr[5] );
+    } else {
+      cl_int err;
+
+      status = CL_SUCCESS;
+      cl_sys[u].rx = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, buffers[0], &err ); status |= err;
+      cl_sys[u].ry = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, buffers[1], &err ); status |= err;
+      cl_sys[u].rz = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, buffers[2], &err ); status |= err;
+      cl_sys[u].vx = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, vbuf[0], &err ); status |= err;
+      cl_sys[u].vy = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, vbuf[1], &err ); status |= err;
+      cl_sys[u].vz = CreateChunkedArray( contexts[u], &lay, CL_MEM_READ_WRITE, vbuf[2], &err ); status |= err;
+      CheckSuccess(status, 0);
+    }
+    cl_sys[u].fx = ArenaBuffers( &arena[u], sf[0] );
+    cl_sys[u].fy = ArenaBuffers( &arena[u], sf[1] );
+    cl_sys[u].fz = ArenaBuffers( &arena[u], sf[2] );
+    cl_sys[u].ax = fixbits ? ArenaBuffers( &arena[u], sa[0] ) : cl_sys[u].fx;
+    cl_sys[u].ay = fixbits ? ArenaBuffers( &arena[u], sa[1] ) : cl_sys[u].fy;
+    cl_sys[u].az = fixbits ? ArenaBuffers( &arena[u], sa[2] ) : cl_sys[u].fz;
+    cl_sys[u].ix = ArenaBuffers( &arena[u], si[0] );
+    cl_sys[u].iy = ArenaBuffers( &arena[u], si[1] );
+    cl_sys[u].iz = ArenaBuffers( &arena[u], si[2] );
+  }
 
-#ifdef __DEBUG
-  size_t log_size;
-  char log [200000];
-  clGetProgramBuildInfo( program[u], devices[u], CL_PROGRAM_BUILD_LOG, sizeof(log), log, &log_size );
-  fprintf( stderr, "\nLog: \n\n %s", log );
+#ifdef _MPI
+  /* a rank reads its own atoms and keeps the positions of all atoms on rank 0 for
+   * the output only. own atoms and ghosts are uploaded at every step */
+  if( ndomains > 1 ) {
+    if( OpenRestart( &rst, in.restfile, sys.natoms, parser ) ) return 3;
+    if( DomainReadRestart( &dom, &rst ) ) {
+      fprintf( stderr, "cannot read the atoms of rank %d from %s\n", dom.rank, in.restfile );
+      return 3;
+    }
+    CloseRestart( &rst );
+    cl_sys[0].natoms = lay.natoms;
+    status = upload_domain( cmdQueues[0], &lay, &cl_sys[0], &dom );
+    CheckSuccess(status, 0);
+  } else {
+#else
+  {
 #endif
+    /* read restart: the positions stay on the host for the output. the velocities
+     * are only kept on the host in zero-copy mode, where they are the storage of
+     * the first device, otherwise they are streamed to the devices below */
+    if( !lat.ncell ) {
+      if( OpenRestart( &rst, in.restfile, sys.natoms, parser ) ) return 3;
+      if( ReadRestart( &rst, 0, sys.natoms, buffers[0], buffers[1], buffers[2] ) ) {
+        fprintf( stderr, "cannot read the positions of %d atoms from %s\n", sys.natoms, in.restfile );
+        return 3;
+      }
+    }
+    if( zerocopy ) {
+      if( !lat.ncell && ReadRestart( &rst, sys.natoms, sys.natoms, vbuf[0], vbuf[1], vbuf[2] ) ) {
+        fprintf( stderr, "cannot read the velocities of %d atoms from %s\n", sys.natoms, in.restfile );
+        return 3;
+      }
+    }
+
+    /* upload the atoms. in zero-copy mode positions and velocities of device 0
+     * live in the host buffers, that are never copied. the buffers of a CPU
+     * sub-device are first touched by the device, i.e. on its own NUMA node */
+    int *local_touch = (int *) alloca(sizeof(int)*ndevices);
+    for(u = 0; u < ndevices; u++) {
+      cl_device_id parent = NULL;
+
+      clGetDeviceInfo( devices[u], CL_DEVICE_PARENT_DEVICE, sizeof(parent), &parent, NULL );
+      local_touch[u] = ( parent != NULL );
+    }
+    status = CL_SUCCESS;
+    for(u = 0; u < ndevices; u++) {
+      cl_sys[u].natoms = sys.natoms;
+      if( !( zerocopy && u == 0 ) ) {
+        if( local_touch[u] ) {
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].rx );
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].ry );
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].rz );
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].vx );
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].vy );
+          status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].vz );
+        }
 
-    kernel_force[u] = clCreateKernel( program[u], "opencl_force", &status );
-    kernel_ekin[u] = clCreateKernel( program[u], "opencl_ekin", &status );
-    kernel_verlet_first[u] = clCreateKernel( program[u], "opencl_verlet_first", &status );
-    kernel_verlet_second[u] = clCreateKernel( program[u], "opencl_verlet_second", &status );
-    kernel_azzero[u] = clCreateKernel( program[u], "opencl_azzero", &status );
+        if( !lat.ncell ) {
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].rx, 0, sys.natoms, buffers[0], CL_TRUE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].ry, 0, sys.natoms, buffers[1], CL_TRUE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].rz, 0, sys.natoms, buffers[2], CL_TRUE, 0, NULL, NULL );
+        }
+        if( zerocopy && !lat.ncell ) {
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vx, 0, sys.natoms, vbuf[0], CL_TRUE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vy, 0, sys.natoms, vbuf[1], CL_TRUE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vz, 0, sys.natoms, vbuf[2], CL_TRUE, 0, NULL, NULL );
+        }
+      }
+      if( local_touch[u] ) {
+        status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].fx );
+        status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].fy );
+        status |= TouchChunkedArray( cmdQueues[u], &lay, cl_sys[u].fz );
+      }
+      /* the restart or the lattice is the image 0 of every atom */
+      status |= ZeroImages( cmdQueues[u], &lay, cl_sys[u].ix );
+      status |= ZeroImages( cmdQueues[u], &lay, cl_sys[u].iy );
+      status |= ZeroImages( cmdQueues[u], &lay, cl_sys[u].iz );
+    }
+    CheckSuccess(status, 0);
+
+    /* stream the velocities to the devices through two staging blocks:
+     * one is parsed while the other one is being uploaded */
+    if( !zerocopy && !lat.ncell ) {
+      FPTYPE *stage[2][3];
+      cl_event *vevent = (cl_event *) alloca(sizeof(cl_event) * 2 * ndevices);
+      int b, k, first, n, inflight[2] = { 0, 0 };
+
+      for( b = 0; b < 2; b++ )
+        for( k = 0; k < 3; k++ )
+          stage[b][k] = (FPTYPE *) malloc( STREAM_ATOMS * sizeof(FPTYPE) );
+
+      for( first = 0, b = 0; first < sys.natoms; first += n, b ^= 1 ) {
+        n = ( sys.natoms - first < STREAM_ATOMS ) ? sys.natoms - first : STREAM_ATOMS;
+        if( inflight[b] )
+          for( u = 0; u < ndevices; u++ ) {
+            clWaitForEvents( 1, &vevent[b*ndevices+u] );
+            clReleaseEvent( vevent[b*ndevices+u] );
+          }
+        if( ReadRestart( &rst, sys.natoms + first, n, stage[b][0], stage[b][1], stage[b][2] ) ) {
+          fprintf( stderr, "cannot read the velocities of %d atoms from %s\n", sys.natoms, in.restfile );
+          return 3;
+        }
+        for( u = 0; u < ndevices; u++ ) {
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vx, first, n, stage[b][0], CL_FALSE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vy, first, n, stage[b][1], CL_FALSE, 0, NULL, NULL );
+          status |= WriteAtoms( cmdQueues[u], &lay, cl_sys[u].vz, first, n, stage[b][2], CL_FALSE, 0, NULL, &vevent[b*ndevices+u] );
+          clFlush( cmdQueues[u] );
+        }
+        inflight[b] = 1;
+      }
+      for( b = 0; b < 2; b++ ) {
+        if( inflight[b] )
+          for( u = 0; u < ndevices; u++ ) {
+            clWaitForEvents( 1, &vevent[b*ndevices+u] );
+            clReleaseEvent( vevent[b*ndevices+u] );
+          }
+        for( k = 0; k < 3; k++ ) free( stage[b][k] );
+      }
+      CheckSuccess(status, 0);
+    }
+    CloseRestart( &rst );
+  }
+  if( !lat.ncell )
+    printf( "Restart: %d atoms read in %.3g s by the %s parser.\n", sys.natoms, rst.seconds, restart_names[parser] );
 
+  /* initialize forces and energies.*/
+  sys.nfi=0;
+
+  size_t globalWorkSize[1];
+  globalWorkSize[0] = nthreads;
+
+  /* the per-atom kernels get one kernel object per chunk, at [u*nchunks+c]. the force
+   * of device u takes nlaunch[u] launches, at flaunch[u]: every chunk holding atoms
+   * of its slice against every chunk of j atoms */
+  int c, l, nchunks = lay.nchunks;
+  int *nlaunch = (int *) alloca(sizeof(int)*ndevices);
+  int *flaunch = (int *) alloca(sizeof(int)*ndevices);
+
+  for( u = 0; u < ndevices; u++ ) {
+    nlaunch[u] = ChunkPieces( &lay, firstatoms[u], natoms[u] ) * nchunks;
+    flaunch[u] = u ? flaunch[u-1] + nlaunch[u-1] : 0;
   }
 
-  FPTYPE ** tmp_epot;
-  cl_mem *epot_buffer = (cl_mem *) alloca(sizeof(epot_buffer)*ndevices);
-  tmp_epot = (FPTYPE **) malloc( sizeof(void *) * ndevices );
-  for( u = 0; u < ndevices; u++)
-    tmp_epot[u] = (FPTYPE *) malloc( nthreads * sizeof(FPTYPE) );
-  for(u = 0; u < ndevices; u++)
-    epot_buffer[u] = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, nthreads * sizeof(FPTYPE), NULL, &status );
+  cl_program *program = (cl_program *) alloca(sizeof(cl_program)*ndevices);
+  cl_kernel *kernel_force = (cl_kernel *) alloca(sizeof(cl_kernel)*(flaunch[ndevices-1]+nlaunch[ndevices-1]));
+  cl_kernel *kernel_force_noepot = (cl_kernel *) alloca(sizeof(cl_kernel)*(flaunch[ndevices-1]+nlaunch[ndevices-1]));
+  cl_kernel *kernel_force_ref = (cl_kernel *) alloca(sizeof(cl_kernel)*(flaunch[ndevices-1]+nlaunch[ndevices-1]));
+  cl_kernel *kernel_force_virial = (cl_kernel *) alloca(sizeof(cl_kernel)*(flaunch[ndevices-1]+nlaunch[ndevices-1]));
+  cl_kernel *kernel_force_step;
+  cl_event *fstart, *fend;
+  int probe, cprobe, set;
+  cl_kernel *kernel_ekin = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel *kernel_verlet_first = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel *kernel_verlet_second = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel *kernel_azzero = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel *kernel_fixed_zero = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel *kernel_fixed_forces = (cl_kernel *) alloca(sizeof(cl_kernel)*ndevices*nchunks);
+  cl_kernel kernel_barostat = NULL;
+
+  /* the builds started before the restart was read, the kernels wait for them */
+  twait = second();
+  for(u = 0; u < ndevices; u++) {
+    status = wait_build( &builds[u], &program[u] );
+    CheckSuccess(status, 0);
+    if( builds[u].seconds > tbuild ) tbuild = builds[u].seconds;
+
+    for( l = flaunch[u]; l < flaunch[u] + nlaunch[u]; l++ ) {
+      kernel_force[l] = clCreateKernel( program[u], vecwidth[u] ? "opencl_force_vec" : "opencl_force", &status );
+      kernel_force_noepot[l] = clCreateKernel( program[u], vecwidth[u] ? "opencl_force_noepot_vec" : "opencl_force_noepot", &status );
+      kernel_force_ref[l] = vecwidth[u] ? clCreateKernel( program[u], "opencl_force_noepot", &status ) : NULL;
+      kernel_force_virial[l] = baro.kind ? clCreateKernel( program[u], vecwidth[u] ? "opencl_force_virial_vec" : "opencl_force_virial", &status ) : NULL;
+    }
+    for( c = u * nchunks; c < ( u + 1 ) * nchunks; c++ ) {
+      kernel_ekin[c] = clCreateKernel( program[u], "opencl_ekin", &status );
+      kernel_verlet_first[c] = clCreateKernel( program[u], "opencl_verlet_first", &status );
+      kernel_verlet_second[c] = clCreateKernel( program[u], "opencl_verlet_second", &status );
+      kernel_azzero[c] = clCreateKernel( program[u], "opencl_azzero", &status );
+      kernel_fixed_zero[c] = fixbits ? clCreateKernel( program[u], "opencl_fixed_zero", &status ) : NULL;
+      kernel_fixed_forces[c] = fixbits ? clCreateKernel( program[u], "opencl_fixed_forces", &status ) : NULL;
+    }
+    if( baro.kind ) kernel_barostat = clCreateKernel( program[u], "opencl_barostat", &status );
 
+  }
+  twait = second() - twait;
 
   /* precompute some constants */
-  FPTYPE c12 = 4.0 * sys.epsilon * pow( sys.sigma, 12.0);
-  FPTYPE c6  = 4.0 * sys.epsilon * pow( sys.sigma, 6.0);
-  FPTYPE rcsq = sys.rcut * sys.rcut;
-  FPTYPE boxby2 = HALF * sys.box;
+  force_args_t fa;
+  chunk_args_t ca;
   FPTYPE dtmf = HALF * sys.dt / mvsq2e / sys.mass;
   sys.epot = ZERO;
   sys.ekin = ZERO;
 
-  FPTYPE ** tmp_ekin;
-  cl_mem *ekin_buffer = (cl_mem *) alloca(sizeof(cl_mem)*ndevices);
-  tmp_ekin = (FPTYPE **) malloc( sizeof(void *) * ndevices );
-  for( u = 0; u < ndevices; u++)
-    tmp_ekin[u] = (FPTYPE *) malloc( nthreads * sizeof(FPTYPE) );
+  /* tabulated potential in constant memory. the analytic kernel gets a
+     one-interval placeholder, so that both take the same arguments. the energy
+     partials of the force (E_pot and virial of every thread, then the box length)
+     and the kinetic energy partials need no initial contents */
+  FPTYPE table_dummy[TABLE_NCOEF_CUBIC] = { ZERO };
+
+  if( table.npoints ) {
+    if( BuildPairTable( &table, &sys ) ) return 6;
+    printf( "Using %s pair table: %d points in r^2 from %g to %g%s.\n", table.cubic ? "cubic" : "linear",
+	    table.npoints, table.rmin, sys.rcut,
+	    table.modifier == TABLE_SHIFT ? ", shifted" : ( table.modifier == TABLE_SWITCH ? ", switched" : "" ) );
+  }
+  for( u = 0; u < ndevices; u++ ) {
+    cl_ulong maxconst;
 
-  //determine how many force vectors to calculate per gpu
-  nforce = sys.natoms / ndevices;
+    clGetDeviceInfo( devices[u], CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, sizeof(maxconst), &maxconst, NULL );
+    if( table.npoints && PairTableSize( &table ) > maxconst ) {
+      fprintf( stderr, "The pair table (%lu bytes) does not fit in constant memory (%lu bytes).\n",
+	       (unsigned long) PairTableSize( &table ), (unsigned long) maxconst );
+      return 6;
+    }
+    if( table.npoints )
+      ArenaWrite( &arena[u], table_buffer[u], table.coef, PairTableSize( &table ) );
+    else
+      ArenaWrite( &arena[u], table_buffer[u], table_dummy, sizeof(table_dummy) );
+  }
 
-  firstatoms = (cl_uint *) alloca(sizeof(cl_uint) * ndevices);
-  natoms = (cl_uint *) alloca(sizeof(cl_uint) * ndevices);
+  /* pair counts of g(r), one bin up to rcut if there is none. the force kernel
+     counts in a local histogram per work-group and adds it to this one */
+  cl_uint rdf_dummy = 0;
+  FPTYPE rdfscale = rdfbins / sys.rcut;
 
-  for( u = 0; u < ndevices-1 ; u++) {
-    firstatoms[u] = u * nforce;
-    natoms[u] = nforce;
+  if( rdf.nbins && InitRdf( &rdf ) ) return 6;
+  for( u = 0; u < ndevices; u++ )
+    ArenaWrite( &arena[u], rdf_buffer[u], rdf.nbins ? rdf.counts : &rdf_dummy, rdfbins * sizeof(cl_uint) );
+
+  /* thermostat state lives on the device: coupling constants and the step/seed
+     counters of the random numbers (layout must match opencl_kernels.cl) */
+  FPTYPE thermo_state[THERMO_NSTATE];
+  cl_uint tstate[2];
+  FPTYPE ndof = THREE * sys.natoms - THREE;
+
+  thermo_state[0] = exp( -sys.dt / thermo.tau );
+  thermo_state[1] = sys.dt / thermo.tau;
+  thermo_state[2] = ndof;
+  thermo_state[3] = ndof * kboltz * thermo.temp / mvsq2e / sys.mass;
+  thermo_state[4] = sqrt( ( ONE - thermo_state[0] * thermo_state[0] ) * kboltz * thermo.temp / mvsq2e / sys.mass );
+  tstate[0] = 0;
+  tstate[1] = thermo.seed;
+#ifdef _MPI
+  /* the random streams of the ranks differ by their key */
+  tstate[1] += 0x9E3779B9u * dom.rank;
+#endif
+
+  for( u = 0; u < ndevices; u++ ) {
+    ArenaWrite( &arena[u], thermo_buffer[u], thermo_state, sizeof(thermo_state) );
+    ArenaWrite( &arena[u], tstate_buffer[u], tstate, sizeof(tstate) );
+  }
+
+  /* barostat state on the device: scaling factor, box length and coupling constants
+     (layout must match opencl_kernels.cl). the kernels take it whether or not they
+     are built with -D_BAROSTAT */
+  FPTYPE baro_state[BARO_NSTATE];
+
+  baro_state[0] = ONE;
+  baro_state[1] = sys.box;
+  baro_state[2] = baro.press;
+  baro_state[3] = sys.dt * baro.kappa / baro.tau;
+  baro_state[4] = pconv;
+  baro_state[5] = mvsq2e * sys.mass;
+  for( u = 0; u < ndevices; u++ )
+    ArenaWrite( &arena[u], baro_buffer[u], baro_state, sizeof(baro_state) );
+
+  /* ring of time origins on device 0, which integrates all atoms: a copy of the
+     positions and velocities of every chunk per origin, the slot of the next sample
+     with the number of stored origins, and the msd/vacf partials of every thread */
+  cl_kernel *kernel_corr = NULL, kernel_corr_next = NULL;
+
+  if( corr.nlags ) {
+    FPTYPE *zero = (FPTYPE *) calloc( 2 * corr.nlags * nthreads, sizeof(FPTYPE) );
+    cl_int cstate[2] = { 0, 1 };
+
+    kernel_corr = (cl_kernel *) malloc(sizeof(cl_kernel)*nchunks*corr.nlags);
+    ArenaWrite( &arena[0], corr_acc, zero, corrbytes );
+    ArenaWrite( &arena[0], corr_state, cstate, sizeof(cstate) );
+    free( zero );
+    kernel_corr_next = clCreateKernel( program[0], "opencl_correlate_next", &status );
+    status |= clSetMultKernelArgs( kernel_corr_next, 0, 2, KArg(corr_state), KArg(corr.nlags) );
+    for( c = 0; c < nchunks; c++ ) {
+      int nc = ChunkAtoms( &lay, c );
+
+      for( l = c * corr.nlags; l < ( c + 1 ) * corr.nlags; l++ ) {
+	int origin = l - c * corr.nlags;
+
+	kernel_corr[l] = clCreateKernel( program[0], "opencl_correlate", &status );
+	status |= clSetMultKernelArgs( kernel_corr[l], 0, 22,
+	  KArg(cl_sys[0].rx[c]),
+	  KArg(cl_sys[0].ry[c]),
+	  KArg(cl_sys[0].rz[c]),
+	  KArg(cl_sys[0].vx[c]),
+	  KArg(cl_sys[0].vy[c]),
+	  KArg(cl_sys[0].vz[c]),
+	  KArg(corr_buffer[6*l]),
+	  KArg(corr_buffer[6*l+1]),
+	  KArg(corr_buffer[6*l+2]),
+	  KArg(corr_buffer[6*l+3]),
+	  KArg(corr_buffer[6*l+4]),
+	  KArg(corr_buffer[6*l+5]),
+	  KArg(nc),
+	  KArg(origin),
+	  KArg(corr.nlags),
+	  KArg(corr_state),
+	  KArg(corr_acc),
+	  KArg(cl_sys[0].ix[c]),
+	  KArg(cl_sys[0].iy[c]),
+	  KArg(cl_sys[0].iz[c]),
+	  KArg(sys.box),
+	  KArg(baro_buffer[0]));
+      }
+    }
+    CheckSuccess(status, 0);
+  }
+
+  /* initial contents of the state buffers, one upload per arena block */
+  for( u = 0; u < ndevices; u++ )
+    status |= FlushArena( cmdQueues[u], &arena[u] );
+  CheckSuccess(status, 0);
+
+  /* memory footprint, reported before the first force of large systems takes its time */
+  {
+    size_t maxbytes = 0;
+    cl_ulong global = 0, m;
+
+    for( u = 0; u < ndevices; u++ ) {
+      clGetDeviceInfo( devices[u], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(m), &m, NULL );
+      if( u == 0 || m < global ) global = m;
+      if( ArenaBytes( &arena[u] ) > maxbytes ) maxbytes = ArenaBytes( &arena[u] );
+    }
+    printf( "Memory: host peak %.4g MB (arena %.4g MB), device %.4g MB of %.4g MB, arrays in %d chunk(s) of %d atoms.\n",
+	    peak_host_mb(), host.size / 1048576.0, maxbytes / 1048576.0, global / 1048576.0, nchunks, lay.chunk );
+  }
+
+  /* bind the arguments of all kernels once: buffers and parameters do not change
+   * during the run, the steps between two samples only enqueue kernels */
+  ForceConstants( &fa, &sys );
+  fa.rminsq = table.rminsq;
+  fa.dsinv = table.dsinv;
+  fa.ntab = table.npoints;
+  fa.rdfbins = rdfbins;
+  fa.rdfscale = rdfscale;
+  ca.dt = sys.dt;
+  ca.dtmf = dtmf;
+  ca.box = sys.box;
+  for( u = 0; u < ndevices; u++ ) {
+    fa.epot = epot_buffer[u];
+    fa.table = table_buffer[u];
+    fa.rdf = rdf_buffer[u];
+    fa.baro = baro_buffer[u];
+    fa.cnt = cnt_buffer[u];
+    ca.thermo = thermo_buffer[u];
+    ca.baro = baro_buffer[u];
+    ca.tstate = tstate_buffer[u];
+    ca.ekin = ekin_buffer[u];
+    for( c = 0; c < nchunks; c++ ) {
+      int k = u * nchunks + c, nc = ChunkAtoms( &lay, c ), atom0 = c * lay.chunk;
+
+      status |= clSetMultKernelArgs( kernel_azzero[k], 0, 4, KArg(cl_sys[u].fx[c]), KArg(cl_sys[u].fy[c]), KArg(cl_sys[u].fz[c]), KArg(nc));
+
+      ca.r[0] = cl_sys[u].rx[c]; ca.r[1] = cl_sys[u].ry[c]; ca.r[2] = cl_sys[u].rz[c];
+      ca.v[0] = cl_sys[u].vx[c]; ca.v[1] = cl_sys[u].vy[c]; ca.v[2] = cl_sys[u].vz[c];
+      ca.f[0] = cl_sys[u].fx[c]; ca.f[1] = cl_sys[u].fy[c]; ca.f[2] = cl_sys[u].fz[c];
+      ca.a[0] = cl_sys[u].ax[c]; ca.a[1] = cl_sys[u].ay[c]; ca.a[2] = cl_sys[u].az[c];
+      ca.im[0] = cl_sys[u].ix[c]; ca.im[1] = cl_sys[u].iy[c]; ca.im[2] = cl_sys[u].iz[c];
+      ca.natoms = nc;
+      ca.atom0 = atom0;
+      status |= SetChunkArgs( kernel_verlet_first[k], kernel_verlet_second[k], kernel_ekin[k], &ca );
+
+      if( fixbits ) {
+	status |= clSetMultKernelArgs( kernel_fixed_zero[k], 0, 4, KArg(cl_sys[u].ax[c]), KArg(cl_sys[u].ay[c]),
+	  KArg(cl_sys[u].az[c]), KArg(nc));
+	status |= clSetMultKernelArgs( kernel_fixed_forces[k], 0, 7, KArg(cl_sys[u].ax[c]), KArg(cl_sys[u].ay[c]),
+	  KArg(cl_sys[u].az[c]), KArg(cl_sys[u].fx[c]), KArg(cl_sys[u].fy[c]), KArg(cl_sys[u].fz[c]), KArg(nc));
+      }
+    }
+
+    /* all force kernels take the same arguments: i chunk ci, j chunk cj. the
+     * first launch of a device overwrites the energy partials, the others add */
+    for( l = 0; l < nlaunch[u]; l++ ) {
+      int ci = firstatoms[u] / lay.chunk + l / nchunks, cj = l % nchunks;
+      int atom1, natoms1 = ChunkPiece( &lay, firstatoms[u], natoms[u], ci, &atom1 );
+
+      fa.f[0] = cl_sys[u].fx[ci]; fa.f[1] = cl_sys[u].fy[ci]; fa.f[2] = cl_sys[u].fz[ci];
+      fa.r[0] = cl_sys[u].rx[ci]; fa.r[1] = cl_sys[u].ry[ci]; fa.r[2] = cl_sys[u].rz[ci];
+      fa.rj[0] = cl_sys[u].rx[cj]; fa.rj[1] = cl_sys[u].ry[cj]; fa.rj[2] = cl_sys[u].rz[cj];
+      fa.a[0] = cl_sys[u].ax[ci]; fa.a[1] = cl_sys[u].ay[ci]; fa.a[2] = cl_sys[u].az[ci];
+      fa.nj = ChunkAtoms( &lay, cj );
+      fa.atom1 = atom1;
+      fa.natoms1 = natoms1;
+      fa.ioff = ci * lay.chunk;
+      fa.joff = cj * lay.chunk;
+      fa.eaccum = ( l > 0 );
+      for( i = 0; i < 4; i++ ) {
+	cl_kernel k = ( i == 3 ) ? kernel_force_virial[flaunch[u]+l] : ( i == 2 ) ? kernel_force_ref[flaunch[u]+l] :
+	  ( i ? kernel_force_noepot[flaunch[u]+l] : kernel_force[flaunch[u]+l] );
+
+	if( k ) status |= SetForceArgs( k, &fa );
+      }
+    }
+
+  }
+  if( baro.kind )
+    status |= clSetMultKernelArgs( kernel_barostat, 0, 4, KArg(epot_buffer[0]), KArg(ekin_buffer[0]), KArg(nthreads), KArg(baro_buffer[0]));
+#ifdef _MPI
+  if( ndomains > 1 )
+    status |= set_domain_counts( &dom, kernel_verlet_first[0], kernel_verlet_second[0], kernel_ekin[0], kernel_force[0], kernel_force_noepot[0] );
+#endif
+  CheckSuccess(status, 2);
+
+  if( lat.ncell ) {
+    FPTYPE *host[6] = { buffers[0], buffers[1], buffers[2], vbuf[0], vbuf[1], vbuf[2] };
+    double t0 = second();
+
+    status = generate_lattice( contexts[0], program[0], cmdQueues, cl_sys, ndevices, &lay, &lat, &sys, nthreads, host, zerocopy );
+    CheckSuccess(status, 0);
+    printf( "Generated an fcc lattice of %d atoms, %d^3 cells of %g A, at %g K in %.3g s.\n",
+	    sys.natoms, lat.ncell, sys.box / lat.ncell, lat.temp, second() - t0 );
   }
-  //last gpu gets a few more atoms if it doesn't match
-  firstatoms[ndevices-1] = (ndevices-1)*nforce;
-  natoms[ndevices-1] = sys.natoms - firstatoms[ndevices-1];
 
   for( u = 0; u < ndevices; u++) {
   /* Azzero force buffer */
-    status = clSetMultKernelArgs( kernel_azzero[u], 0, 4, KArg(cl_sys[u].fx), KArg(cl_sys[u].fy), KArg(cl_sys[u].fz), KArg(cl_sys[u].natoms));
-
-
-    status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_azzero[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
-
-    status |= clSetMultKernelArgs( kernel_force[u], 0, 15,
-	  KArg(cl_sys[u].fx),
-	  KArg(cl_sys[u].fy),
-	  KArg(cl_sys[u].fz),
-	  KArg(cl_sys[u].rx),
-	  KArg(cl_sys[u].ry),
-	  KArg(cl_sys[u].rz),
-	  KArg(cl_sys[u].natoms),
-	  KArg(epot_buffer[u]),
-	  KArg(c12),
-	  KArg(c6),
-	  KArg(rcsq),
-	  KArg(boxby2),
-	  KArg(sys.box),
-	  KArg(firstatoms[u]),
-	  KArg(natoms[u]));
+    for( c = u * nchunks; c < ( u + 1 ) * nchunks; c++ ) {
+      status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_azzero[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+      if( fixbits )
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_fixed_zero[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+    }
 
+    for( l = flaunch[u]; l < flaunch[u] + nlaunch[u]; l++ )
+      status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_force[l], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
 
-    status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_force[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+    /* the sums of the first force are turned into forces here, then by every verlet_second */
+    if( fixbits )
+      for( c = u * nchunks; c < ( u + 1 ) * nchunks; c++ )
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_fixed_forces[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
 
-    status |= clEnqueueReadBuffer( cmdQueues[u], epot_buffer[u], CL_TRUE, 0, nthreads * sizeof(FPTYPE), tmp_epot[u], 0, NULL, NULL );
+    status |= clEnqueueReadBuffer( cmdQueues[u], epot_buffer[u], CL_TRUE, 0, epotbytes, tmp_epot[u], 0, NULL, NULL );
   }
 
+  sys.virial = ZERO;
   for( u = 0; u < ndevices; u++ )
-    for( i = 0; i < nthreads; i++) sys.epot += tmp_epot[u][i];
+    for( i = 0; i < nthreads; i++) {
+      sys.epot += tmp_epot[u][i];
+      sys.virial += tmp_epot[u][nthreads+i];
+    }
+  if( rdf.nbins ) rdf.nsamples++;
 
+  /* the forces of the start configuration again, with the generic kernel and then
+   * with the vector one, that leaves its forces for the first step */
   for( u = 0; u < ndevices; u++ ) {
-    ekin_buffer[u] = clCreateBuffer( contexts[u], CL_MEM_READ_WRITE, nthreads * sizeof(FPTYPE), NULL, &status );
-
-    status |= clSetMultKernelArgs( kernel_ekin[u], 0, 5, KArg(cl_sys[u].vx), KArg(cl_sys[u].vy), KArg(cl_sys[u].vz),
-      KArg(cl_sys[u].natoms), KArg(ekin_buffer[u]));
-
-    status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_ekin[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+    double tref, tvec;
+
+    if( !vecwidth[u] ) continue;
+    tref = time_force( cmdQueues[u], kernel_force_ref, flaunch[u], flaunch[u] + nlaunch[u], globalWorkSize );
+    tvec = time_force( cmdQueues[u], kernel_force_noepot, flaunch[u], flaunch[u] + nlaunch[u], globalWorkSize );
+    printf( "Force kernel of device %u: %s%d lanes, %.2f x the generic kernel.\n", u,
+	    sizeof(FPTYPE) == sizeof(float) ? "float" : "double", vecwidth[u], tref / tvec );
+    for( l = flaunch[u]; l < flaunch[u] + nlaunch[u]; l++ ) clReleaseKernel( kernel_force_ref[l] );
   }
 
+  for( u = 0; u < ndevices; u++ )
+    for( c = u * nchunks; c < ( u + 1 ) * nchunks; c++ )
+      status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_ekin[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+
   status |= clEnqueueReadBuffer( cmdQueues[0], ekin_buffer[0], CL_TRUE, 0, nthreads * sizeof(FPTYPE), tmp_ekin[0], 0, NULL, NULL );
+  CheckSuccess(status, 0);
 
   for( i = 0; i < nthreads; i++) sys.ekin += tmp_ekin[0][i];
-  sys.ekin *= HALF * mvsq2e * sys.mass;
-  sys.temp  = TWO * sys.ekin / ( THREE * sys.natoms - THREE ) / kboltz;
-
-  erg=fopen(ergfile,"w");
-  traj=fopen(trajfile,"w");
+#ifdef _MPI
+  reduce_energies(&sys);
+#endif
+  SampleEnergies(&sys);
 
-  printf("Starting simulation with %d atoms for %d steps.\n",sys.natoms, sys.nsteps);
-  printf("     NFI            TEMP            EKIN                 EPOT              ETOT\n");
+  /* the first time origin is the start configuration */
+  if( corr.nlags ) {
+    status = correlate( cmdQueues[0], kernel_corr, kernel_corr_next, nchunks * corr.nlags, &corr, globalWorkSize );
+    CheckSuccess(status, 0);
+  }
 
-  /* download data on host */
-  status = clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rx, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[0], 0, NULL, NULL );
-  status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].ry, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[1], 0, NULL, NULL );
-  status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rz, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[2], 0, NULL, NULL );
+  erg = traj = NULL;
+#ifdef _MPI
+  if( dom.rank == 0 )
+#endif
+  {
+    erg=fopen(in.ergfile,"w");
+    if( strcmp( in.trajfile, "none" ) ) traj=fopen(in.trajfile,"w");
+    if( ring.name[0] && OpenFrameRing( &ring, sys.natoms, sizeof(FPTYPE) ) ) return 1;
+  }
 
+  printf("Startup: %.3g s to the first step, program builds %.3g s, %.3g s of them waited for.\n",
+	 second() - tstart, tbuild, twait);
+  printf("Starting simulation with %d atoms for %d steps.\n",sys.natoms, sys.nsteps);
+  if( thermo.kind != THERMO_NONE )
+    printf("Using %s thermostat: T = %g K, tau = %g fs.\n", thermo_names[thermo.kind], thermo.temp, thermo.tau);
+  if( baro.kind != BARO_NONE )
+    printf("Using %s barostat: P = %g bar, tau = %g fs, compressibility = %g /bar.\n", baro_names[baro.kind], baro.press,
+	   baro.tau, baro.kappa);
+  if( zerocopy )
+    printf("Using zero-copy host access.\n");
+  if( ring.header )
+    printf("Publishing the samples in shared memory %s, %d slots of %g MB.\n", ring.name, ring.nslots,
+	   ring.header->slotbytes / 1048576.0);
+  if( fixbits )
+    printf("Using fixed point forces: 64-bit sums of 2^-%d kcal/mol/A, each pair of own atoms once.\n", fixbits);
+  printf("     NFI            TEMP            EKIN                 EPOT              ETOT                PRESS\n");
+
+  /* download data on host, or map it in zero-copy mode. the mapped chunks of the
+   * CL_MEM_USE_HOST_PTR buffers are the host storage buffers[0..2] itself */
+  FPTYPE **rmap[3];
+
+  for( i = 0; i < 3; i++ ) rmap[i] = (FPTYPE **) alloca(sizeof(FPTYPE *)*nchunks);
+#ifdef _MPI
+  if( ndomains > 1 ) {
+    status = CL_SUCCESS;
+    DomainGather( &dom, buffers[0], buffers[1], buffers[2], sys.ix, sys.iy, sys.iz );
+  } else
+#endif
+  if( zerocopy ) {
+    status  = MapAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[0] );
+    status |= MapAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[1] );
+    status |= MapAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, CL_MAP_READ, CL_TRUE, 0, NULL, NULL, rmap[2] );
+  } else {
+    status  = ReadAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, buffers[0], CL_TRUE, 0, NULL, NULL );
+    status |= ReadAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, buffers[1], CL_TRUE, 0, NULL, NULL );
+    status |= ReadAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, buffers[2], CL_TRUE, 0, NULL, NULL );
+  }
   sys.rx = buffers[0];
   sys.ry = buffers[1];
   sys.rz = buffers[2];
 
-  output(&sys, erg, traj);
-
-  if( ndevices > 1 ) {
-    force_event = (cl_event *) alloca(sizeof(cl_event)*ndevices);
-    for( u = 0; u < ndevices; u++ ) {
-	  force_event[u] = clCreateUserEvent( contexts[u], NULL );
-	  clSetUserEventStatus( force_event[u], CL_COMPLETE );
-    }
+  if( erg ) output(&sys, erg, traj, &ring);
 
+  if( zerocopy ) {
+    status |= UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, rmap[0] );
+    status |= UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, rmap[1] );
+    status |= UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, rmap[2] );
+  }
 
-    // download force fragments and distribute them among gpus
-    for( u = 0 ; u < ndevices; u++ ) {
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fx, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[3] + firstatoms[u], 0, NULL, NULL );
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fy, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[4] + firstatoms[u], 0, NULL, NULL );
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fz, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[5] + firstatoms[u], 0, force_event+u, NULL );
-    }
-
-    clWaitForEvents(ndevices, force_event);
+  // download force fragments and distribute them among gpus
+  force_event = (cl_event *) alloca(sizeof(cl_event)*ndevices);
+  if( ndevices > 1 )
+    status |= exchange_forces( cmdQueues, cl_sys, ndevices, &lay, firstatoms, natoms, buffers+3, force_event, zerocopy, &copybytes );
+  CheckSuccess(status, 1);
+  copybytes = 0.0;
+  if( metrics.format >= 0 && InitMetrics( &metrics, ndevices, 0 ) ) return 1;
+  /* the work of the first forces and of the kernel timings is not counted */
+  if( counters.every ) {
+    status = ZeroCounters( &counters, cmdQueues, cnt_buffer );
+    CheckSuccess(status, 0);
+  }
 
-    for( u = 0 ; u < ndevices; u++ ) {
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fx, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[3], 0, NULL, NULL );
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fy, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[4], 0, NULL, NULL );
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fz, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[5], 0, force_event+u, NULL );
-    }
+#ifdef __PROFILING
+  t4 = second();
+  c1 = cpusecond();
+#endif
 
-    clWaitForEvents(ndevices, force_event);
-  }
+#ifdef __PHASES
+  InitPhases( &phases, NPHASES, phase_names );
+#endif
+  PHASE_START( &phases );
 
   /**************************************************/
   /* main MD loop */
   for(sys.nfi=1; sys.nfi <= sys.nsteps; ++sys.nfi) {
 
+    /* positions and energies are downloaded one step before they are written */
+    int sample = ((sys.nfi % nprint) == nprint-1);
+
     /* propagate system and recompute energies */
-    /* 2) verlet_first   */
-    for( u = 0; u < ndevices; u++ ) {
-      status |= clSetMultKernelArgs( kernel_verlet_first[u], 0, 12,
-        KArg(cl_sys[u].fx),
-        KArg(cl_sys[u].fy),
-        KArg(cl_sys[u].fz),
-        KArg(cl_sys[u].rx),
-        KArg(cl_sys[u].ry),
-        KArg(cl_sys[u].rz),
-        KArg(cl_sys[u].vx),
-        KArg(cl_sys[u].vy),
-        KArg(cl_sys[u].vz),
-        KArg(cl_sys[u].natoms),
-        KArg(sys.dt),
-        KArg(dtmf));
-      CheckSuccess(status, 2);
-
-    /* When the data transfer is non blocking, this kernel has to wait the completion of part 8 (event[2]) */
+    /* 2) verlet_first, with the weak coupling thermostats of the previous step */
+    for( u = 0; u < ndevices; u++ )
+      for( c = 0; c < nchunks; c++ ) {
+
+    /* When the data transfer is non blocking, this kernel overwrites the data still being
+     * downloaded by parts 6, 7 and 8 of the previous sample: it waits for the downloads of
+     * its own device, and on device 0 it raises the event the position download waits for */
 #ifdef _UNBLOCK
-      status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_first[u], 1, NULL, globalWorkSize, NULL, 1, &event[1], NULL );
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_first[u*nchunks+c], 1, NULL, globalWorkSize, NULL,
+					 ( pending && c == 0 ) ? ( u ? 1 : EV_EPOT+1 ) : 0, ( pending && c == 0 ) ? ( u ? &event[EV_EPOT+u] : event ) : NULL,
+					 ( sample && u == 0 && c == nchunks-1 ) ? &kevent[EV_POS] : NULL );
 #else
-      status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_first[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_first[u*nchunks+c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+#endif
+      }
+    CheckSuccess(status, 2);
+    PHASE_LAP( &phases, PH_VERLET_FIRST );
+
+#ifdef _MPI
+    /* 6) with several ranks the own atoms go through the host: the positions of a
+     * sample are gathered on rank 0, the atoms that left the slab move to the
+     * neighbors and the ghosts are rebuilt before the force */
+    if( ndomains > 1 ) {
+      status = download_domain( cmdQueues[0], &lay, &cl_sys[0], &dom );
+      CheckSuccess(status, 6);
+      if( sample ) DomainGather( &dom, buffers[0], buffers[1], buffers[2], sys.ix, sys.iy, sys.iz );
+      if( DomainExchange( &dom ) ) {
+	fprintf( stderr, "Rank %d cannot exchange its atoms at step %d.\n", dom.rank, sys.nfi );
+	MPI_Abort( MPI_COMM_WORLD, 6 );
+      }
+      status  = upload_domain( cmdQueues[0], &lay, &cl_sys[0], &dom );
+      status |= set_domain_counts( &dom, kernel_verlet_first[0], kernel_verlet_second[0], kernel_ekin[0], kernel_force[0], kernel_force_noepot[0] );
+      copybytes += ( 9.0 * dom.nlocal + 3.0 * dom.nghost ) * sizeof(FPTYPE) + 6.0 * dom.nlocal * sizeof(cl_int);
+      CheckSuccess(status, 6);
+      PHASE_LAP( &phases, PH_DOMAIN );
+    } else
 #endif
-    }
-
     /* 6) download position@device to position@host */
-    if ((sys.nfi % nprint) == nprint-1) {
+    if (sample) {
+#ifdef __PROFILING
+	t3 = second();
+#endif
 
-    /* In non blocking mode (CL_FALSE) this data transfer raises events[i] */
+    /* In zero-copy mode the positions are mapped for reading until the sample is written
+     * at the end of this step: the kernels in between do not write them */
+	if( zerocopy ) {
 #ifdef _UNBLOCK
-	status  = clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rx, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[0], 0, NULL, NULL );
-	status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].ry, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[1], 0, NULL, NULL );
-	status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rz, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[2], 0, NULL, &event[0] );
+	  clFlush( cmdQueues[0] );
+	  status  = ReadImages( copyQueues[0], &lay, cl_sys[0].ix, 0, sys.natoms, sys.ix, CL_FALSE, 1, &kevent[EV_POS], NULL );
+	  status |= ReadImages( copyQueues[0], &lay, cl_sys[0].iy, 0, sys.natoms, sys.iy, CL_FALSE, 0, NULL, NULL );
+	  status |= ReadImages( copyQueues[0], &lay, cl_sys[0].iz, 0, sys.natoms, sys.iz, CL_FALSE, 0, NULL, NULL );
+	  status |= MapAtoms( copyQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[0] );
+	  status |= MapAtoms( copyQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[1] );
+	  status |= MapAtoms( copyQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, &event[EV_POS], rmap[2] );
+	  clReleaseEvent( kevent[EV_POS] );
+	  clFlush( copyQueues[0] );
 #else
-	status  = clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rx, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[0], 0, NULL, NULL );
-	status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].ry, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[1], 0, NULL, NULL );
-	status |= clEnqueueReadBuffer( cmdQueues[0], cl_sys[0].rz, CL_TRUE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[2], 0, NULL, NULL );
+	  status  = ReadImages( cmdQueues[0], &lay, cl_sys[0].ix, 0, sys.natoms, sys.ix, CL_FALSE, 0, NULL, NULL );
+	  status |= ReadImages( cmdQueues[0], &lay, cl_sys[0].iy, 0, sys.natoms, sys.iy, CL_FALSE, 0, NULL, NULL );
+	  status |= ReadImages( cmdQueues[0], &lay, cl_sys[0].iz, 0, sys.natoms, sys.iz, CL_FALSE, 0, NULL, NULL );
+	  status |= MapAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[0] );
+	  status |= MapAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[1] );
+	  status |= MapAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, CL_MAP_READ, CL_FALSE, 0, NULL, NULL, rmap[2] );
 #endif
+	  copybytes += 3.0 * sys.natoms * sizeof(cl_int);
+	} else {
+
+    /* In non blocking mode (CL_FALSE) this data transfer runs on the copy queue after
+     * verlet_first, overlapping with the force kernel, and raises event[EV_POS] */
+#ifdef _UNBLOCK
+	clFlush( cmdQueues[0] );
+	status  = ReadImages( copyQueues[0], &lay, cl_sys[0].ix, 0, sys.natoms, sys.ix, CL_FALSE, 1, &kevent[EV_POS], NULL );
+	status |= ReadImages( copyQueues[0], &lay, cl_sys[0].iy, 0, sys.natoms, sys.iy, CL_FALSE, 0, NULL, NULL );
+	status |= ReadImages( copyQueues[0], &lay, cl_sys[0].iz, 0, sys.natoms, sys.iz, CL_FALSE, 0, NULL, NULL );
+	status |= ReadAtoms( copyQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, buffers[0], CL_FALSE, 0, NULL, NULL );
+	status |= ReadAtoms( copyQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, buffers[1], CL_FALSE, 0, NULL, NULL );
+	status |= ReadAtoms( copyQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, buffers[2], CL_FALSE, 0, NULL, &event[EV_POS] );
+	clReleaseEvent( kevent[EV_POS] );
+	clFlush( copyQueues[0] );
+#else
+	status  = ReadImages( cmdQueues[0], &lay, cl_sys[0].ix, 0, sys.natoms, sys.ix, CL_FALSE, 0, NULL, NULL );
+	status |= ReadImages( cmdQueues[0], &lay, cl_sys[0].iy, 0, sys.natoms, sys.iy, CL_FALSE, 0, NULL, NULL );
+	status |= ReadImages( cmdQueues[0], &lay, cl_sys[0].iz, 0, sys.natoms, sys.iz, CL_FALSE, 0, NULL, NULL );
+	status |= ReadAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, buffers[0], CL_TRUE, 0, NULL, NULL );
+	status |= ReadAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, buffers[1], CL_TRUE, 0, NULL, NULL );
+	status |= ReadAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, buffers[2], CL_TRUE, 0, NULL, NULL );
+#endif
+	copybytes += 3.0 * sys.natoms * ( sizeof(FPTYPE) + sizeof(cl_int) );
+	}
 	CheckSuccess(status, 6);
+#ifdef __PROFILING
+	t_sample += second() - t3;
+#endif
+	PHASE_LAP( &phases, PH_POSITIONS );
     }
 
-    /* 3) force */
+    /* 3) force: the potential energy and the virial are only accumulated on the steps
+     * whose E_pot is downloaded in 7), and on every step for the barostat, that counts
+     * no g(r) on the others; all other steps compute forces only */
+    kernel_force_step = sample ? kernel_force : ( baro.kind ? kernel_force_virial : kernel_force_noepot );
+    set = ( kernel_force_step == kernel_force_noepot ) ? CN_NOEPOT : CN_FORCE;
+    counters.steps[set]++;
+    probe = metrics.format >= 0 && MetricsProbe( &metrics, sys.nfi, sample );
+    cprobe = counters.every && CountersProbe( &counters, sys.nfi, probe, set );
+    fstart = probe ? metrics.kstart : ( cprobe ? counters.kstart : NULL );
+    fend = probe ? metrics.kend : ( cprobe ? counters.kend : NULL );
     for( u = 0; u < ndevices; u++) {
-      status |= clSetMultKernelArgs( kernel_force[u], 0, 15,
-        KArg(cl_sys[u].fx),
-        KArg(cl_sys[u].fy),
-        KArg(cl_sys[u].fz),
-        KArg(cl_sys[u].rx),
-        KArg(cl_sys[u].ry),
-        KArg(cl_sys[u].rz),
-        KArg(cl_sys[u].natoms),
-        KArg(epot_buffer[u]),
-        KArg(c12),
-        KArg(c6),
-        KArg(rcsq),
-        KArg(boxby2),
-        KArg(sys.box),
-        KArg(firstatoms[u]),
-        KArg(natoms[u]));
+      for( l = flaunch[u]; l < flaunch[u] + nlaunch[u]; l++ ) {
+	cl_event *ev = NULL;
 
-      CheckSuccess(status, 3);
-      status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_force[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+	/* a timed step marks the first and the last launch of every device */
+	if( fstart && l == flaunch[u] ) ev = &fstart[u];
+	else if( fstart && l == flaunch[u] + nlaunch[u] - 1 ) ev = &fend[u];
+#ifdef _UNBLOCK
+	if( sample && l == flaunch[u] + nlaunch[u] - 1 ) ev = &kevent[EV_EPOT+u];
+#endif
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_force_step[l], 1, NULL, globalWorkSize, NULL, 0, NULL, ev );
+      }
+#ifdef _UNBLOCK
+      /* the last launch of a sampled step carries the event of the energy download */
+      if( fstart && sample ) {
+	if( nlaunch[u] == 1 ) {
+	  fstart[u] = kevent[EV_EPOT+u];
+	  clRetainEvent( fstart[u] );
+	}
+	fend[u] = kevent[EV_EPOT+u];
+	clRetainEvent( fend[u] );
+      } else
+#endif
+      if( fstart && nlaunch[u] == 1 ) {
+	fend[u] = fstart[u];
+	clRetainEvent( fend[u] );
+      }
     }
+    if( probe ) metrics.probing = 1;
+    CheckSuccess(status, 3);
     // download force fragments and distribute them among gpus
     if( ndevices > 1 ) {
-      for( u = 0 ; u < ndevices; u++ ) {
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fx, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[3] + firstatoms[u], 0, NULL, NULL );
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fy, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[4] + firstatoms[u], 0, NULL, NULL );
-        status |= clEnqueueReadBuffer( cmdQueues[u], cl_sys[u].fz, CL_FALSE, 0, natoms[u] * sizeof(FPTYPE), buffers[5] + firstatoms[u], 0, force_event+u, NULL );
-      }
-
-      clWaitForEvents(ndevices, force_event);
-
-      for( u = 0 ; u < ndevices; u++ ) {
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fx, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[3], 0, NULL, NULL );
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fy, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[4], 0, NULL, NULL );
-        status |= clEnqueueWriteBuffer( cmdQueues[u], cl_sys[u].fz, CL_FALSE, 0, cl_sys[0].natoms * sizeof(FPTYPE), buffers[5], 0, force_event+u, NULL );
-      }
+      status |= exchange_forces( cmdQueues, cl_sys, ndevices, &lay, firstatoms, natoms, buffers+3, force_event, zerocopy, &copybytes );
+      CheckSuccess(status, 3);
+    }
+    PHASE_LAP( &phases, PH_FORCE );
 
-      clWaitForEvents(ndevices, force_event);
+    /* the pair counts of the sampled steps stay on the devices, g(r) is rewritten
+     * every rdf.every samples */
+    if( sample && rdf.nbins && ++rdf.nsamples % rdf.every == 0 ) {
+      status |= flush_rdf( cmdQueues, rdf_buffer, ndevices, &rdf, &sys, erg != NULL );
+      CheckSuccess(status, 3);
+      PHASE_LAP( &phases, PH_ANALYSIS );
     }
 
 
     /* 7) download E_pot[i]@device and perform reduction to E_pot@host */
-    if ((sys.nfi % nprint) == nprint-1) {
+    if (sample) {
+#ifdef __PROFILING
+    t3 = second();
+#endif
 
-    /* In non blocking mode (CL_FALSE) this data transfer kernel raises an event[1] */
+    /* In non blocking mode (CL_FALSE) this data transfer waits for the force kernel
+     * only, overlapping with verlet_second, and raises event[EV_EPOT+u] */
     for( u = 0; u < ndevices; u++) {
 #ifdef _UNBLOCK
-	    status |= clEnqueueReadBuffer( cmdQueues[u], epot_buffer[u], CL_FALSE, 0, nthreads * sizeof(FPTYPE), tmp_epot[u], 0, NULL, &event[u+2] );
+	    clFlush( cmdQueues[u] );
+	    status |= clEnqueueReadBuffer( copyQueues[u], epot_buffer[u], CL_FALSE, 0, epotbytes, tmp_epot[u], 1, &kevent[EV_EPOT+u], &event[EV_EPOT+u] );
+	    clReleaseEvent( kevent[EV_EPOT+u] );
+	    clFlush( copyQueues[u] );
 #else
-	    status |= clEnqueueReadBuffer( cmdQueues[u], epot_buffer[u], CL_TRUE, 0, nthreads * sizeof(FPTYPE), tmp_epot[u], 0, NULL, NULL );
+	    status |= clEnqueueReadBuffer( cmdQueues[u], epot_buffer[u], CL_TRUE, 0, epotbytes, tmp_epot[u], 0, NULL, NULL );
 #endif
+	    copybytes += epotbytes;
 	    CheckSuccess(status, 7);
 	  }
+#ifdef __PROFILING
+    t_sample += second() - t3;
+#endif
+    PHASE_LAP( &phases, PH_EPOT );
     }
 
     /* 4) verlet_second */
-    for( u = 0; u < ndevices; u++) {
-      status |= clSetMultKernelArgs( kernel_verlet_second[u], 0, 9,
-        KArg(cl_sys[u].fx),
-        KArg(cl_sys[u].fy),
-        KArg(cl_sys[u].fz),
-        KArg(cl_sys[u].vx),
-        KArg(cl_sys[u].vy),
-        KArg(cl_sys[u].vz),
-        KArg(cl_sys[u].natoms),
-        KArg(sys.dt),
-        KArg(dtmf));
-
-      CheckSuccess(status, 4);
-      status = clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_second[u], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+    for( u = 0; u < ndevices; u++)
+      for( c = u * nchunks; c < ( u + 1 ) * nchunks; c++ )
+	status |= clEnqueueNDRangeKernel( cmdQueues[u], kernel_verlet_second[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+    CheckSuccess(status, 4);
+    PHASE_LAP( &phases, PH_VERLET_SECOND );
+
+    /* 11) time correlations of device 0, nothing is downloaded before the end */
+    if( corr.nlags && sys.nfi % corr.every == 0 ) {
+      status |= correlate( cmdQueues[0], kernel_corr, kernel_corr_next, nchunks * corr.nlags, &corr, globalWorkSize );
+      CheckSuccess(status, 11);
+      PHASE_LAP( &phases, PH_ANALYSIS );
     }
 
-    if ((sys.nfi % nprint) == nprint-1) {
+    if (sample) {
 
 	/* 5) ekin */
-	status |= clSetMultKernelArgs( kernel_ekin[0], 0, 5, KArg(cl_sys[0].vx), KArg(cl_sys[0].vy), KArg(cl_sys[0].vz),
-			KArg(cl_sys[0].natoms), KArg(ekin_buffer[0]));
+	for( c = 0; c < nchunks; c++ ) {
+#ifdef _UNBLOCK
+	  status |= clEnqueueNDRangeKernel( cmdQueues[0], kernel_ekin[c], 1, NULL, globalWorkSize, NULL, 0, NULL, ( c == nchunks-1 ) ? &kevent[EV_EKIN] : NULL );
+#else
+	  status |= clEnqueueNDRangeKernel( cmdQueues[0], kernel_ekin[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+#endif
+	}
 	CheckSuccess(status, 5);
-	status = clEnqueueNDRangeKernel( cmdQueues[0], kernel_ekin[0], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
 
+#ifdef __PROFILING
+	t3 = second();
+#endif
 
 	/* 8) download E_kin[i]@device and perform reduction to E_kin@host */
-	/* In non blocking mode (CL_FALSE) this data transfer kernel raises an event[2] */
+	/* In non blocking mode (CL_FALSE) this data transfer overlaps with the next
+	 * step and raises event[EV_EKIN]; all the downloads are now pending */
 #ifdef _UNBLOCK
-	status |= clEnqueueReadBuffer( cmdQueues[0], ekin_buffer[0], CL_FALSE, 0, nthreads * sizeof(FPTYPE), tmp_ekin[0], 0, NULL, &event[2] );
+	clFlush( cmdQueues[0] );
+	status |= clEnqueueReadBuffer( copyQueues[0], ekin_buffer[0], CL_FALSE, 0, nthreads * sizeof(FPTYPE), tmp_ekin[0], 1, &kevent[EV_EKIN], &event[EV_EKIN] );
+	clReleaseEvent( kevent[EV_EKIN] );
+	clFlush( copyQueues[0] );
+	pending = 1;
 #else
 	status |= clEnqueueReadBuffer( cmdQueues[0], ekin_buffer[0], CL_TRUE, 0, nthreads * sizeof(FPTYPE), tmp_ekin[0], 0, NULL, NULL );
 #endif
+	copybytes += nthreads * sizeof(FPTYPE);
 	CheckSuccess(status, 8);
+
+#ifdef __PROFILING
+	t_sample += second() - t3;
+	nsample++;
+#endif
+	PHASE_LAP( &phases, PH_EKIN );
+
+	/* in zero-copy mode the sample is written now, with the step number it would have
+	 * in part 1, and the positions are unmapped before the next verlet_first */
+	if( zerocopy ) {
+	  mdsys_t smp = sys;
+
+#ifdef _UNBLOCK
+#ifdef __PROFILING
+	  t3 = second();
+#endif
+	  wait_downloads( event, ndevices );
+	  pending = 0;
+#ifdef __PROFILING
+	  t_sample += second() - t3;
+#endif
+	  PHASE_LAP( &phases, PH_WAIT );
+#endif
+	  smp.nfi = ( ( sys.nfi + nprint - 1 ) / nprint ) * nprint;
+	  if( smp.nfi <= sys.nsteps ) {
+	    reduce_sample(&smp, tmp_epot, tmp_ekin[0], ndevices, nthreads);
+	    sys.box = smp.box;
+	    PHASE_LAP( &phases, PH_REDUCTION );
+	    /* writing output files (positions, energies and temperature) */
+	    if( erg ) output(&smp, erg, traj, &ring);
+	    PHASE_LAP( &phases, PH_OUTPUT );
+	  }
+
+	  status  = UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].rx, 0, sys.natoms, rmap[0] );
+	  status |= UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].ry, 0, sys.natoms, rmap[1] );
+	  status |= UnmapAtoms( cmdQueues[0], &lay, cl_sys[0].rz, 0, sys.natoms, rmap[2] );
+	  CheckSuccess(status, 1);
+	  PHASE_LAP( &phases, PH_POSITIONS );
+	}
     }
 
-    /* 1) write output every nprint steps */
-    if ((sys.nfi % nprint) == 0) {
+    /* 10) barostat: box scaling of the next step from the virial of this force and the
+     * kinetic energy partials (part 5 has them on the sampled steps), on the device */
+    if( baro.kind ) {
+      if( !sample )
+	for( c = 0; c < nchunks; c++ )
+	  status |= clEnqueueNDRangeKernel( cmdQueues[0], kernel_ekin[c], 1, NULL, globalWorkSize, NULL, 0, NULL, NULL );
+      status |= clEnqueueNDRangeKernel( cmdQueues[0], kernel_barostat, 1, NULL, singleWorkSize, NULL, 0, NULL, NULL );
+      CheckSuccess(status, 10);
+      PHASE_LAP( &phases, PH_COUPLING );
+    }
+
+    /* 1) write output every nprint steps (in zero-copy mode the sample is written by part 8) */
+    if (!zerocopy && (sys.nfi % nprint) == 0) {
 
     /* Calling a synchronization function (only when in non blocking mode) that will wait until all the
-     * events[i], related to the data transfers, to be completed */
+     * events[i], related to the data transfers, to be completed. Events of different contexts
+     * cannot be waited for together */
 #ifdef _UNBLOCK
-        clWaitForEvents(ndevices+2, event);
+#ifdef __PROFILING
+	t3 = second();
+#endif
+	if( pending ) {
+	  wait_downloads( event, ndevices );
+	  pending = 0;
+	}
+#ifdef __PROFILING
+	t_sample += second() - t3;
+#endif
+	PHASE_LAP( &phases, PH_WAIT );
 #endif
 	sys.rx = buffers[0];
 	sys.ry = buffers[1];
 	sys.rz = buffers[2];
 
-	/* initialize the sys.epot@host and sys.ekin@host variables to ZERO */
-	sys.epot = ZERO;
-	sys.ekin = ZERO;
-
 	/* reduction on the tmp_Exxx[i] buffers downloaded from the device
 	 * during parts 7 and 8 of the previous MD loop iteration */
-	for( u = 0; u < ndevices; u++)
-	    for( i = 0; i < nthreads; i++)
-		  sys.epot += tmp_epot[u][i];
-	for( i = 0; i < nthreads; i++)
-		sys.ekin += tmp_ekin[0][i];
-
-	/* multiplying the kinetic energy by prefactors */
-	sys.ekin *= HALF * mvsq2e * sys.mass;
-	sys.temp  = TWO * sys.ekin / ( THREE * sys.natoms - THREE ) / kboltz;
-
+	reduce_sample(&sys, tmp_epot, tmp_ekin[0], ndevices, nthreads);
+	PHASE_LAP( &phases, PH_REDUCTION );
 	/* writing output files (positions, energies and temperature) */
-	output(&sys, erg, traj);
+	if( erg ) output(&sys, erg, traj, &ring);
+	PHASE_LAP( &phases, PH_OUTPUT );
+    }
+
+    /* 12) live metrics every metrics.interval seconds */
+    if( metrics.format >= 0 && MetricsDue( &metrics ) ) {
+      status = WriteMetrics( &metrics, &sys, copybytes, pending, erg, traj );
+      CheckSuccess(status, 12);
+      PHASE_LAP( &phases, PH_METRICS );
     }
 
   }
   /**************************************************/
 
+#ifdef __PROFILING
+  for( u = 0; u < ndevices; u++ ) clFinish( cmdQueues[u] );
+  t4 = second() - t4;
+  c1 = cpusecond() - c1;
+#endif
+
+#ifdef _UNBLOCK
+  /* downloads of a last sample that is never written */
+  if( pending ) wait_downloads( event, ndevices );
+  for( u = 0; u < ndevices; u++ ) clReleaseCommandQueue( copyQueues[u] );
+#endif
+
+  if( metrics.format >= 0 ) {
+    sys.nfi = sys.nsteps;
+    /* unless the export of the last step is already written */
+    if( metrics.nfilast != sys.nfi ) {
+      status = CollectMetrics( &metrics );
+      status |= WriteMetrics( &metrics, &sys, copybytes, 0, erg, traj );
+      CheckSuccess(status, 0);
+    }
+    FreeMetrics( &metrics );
+  }
+
+  if( rdf.nbins ) {
+    status = flush_rdf( cmdQueues, rdf_buffer, ndevices, &rdf, &sys, erg != NULL );
+    CheckSuccess(status, 0);
+    printf( "g(r) of %d samples written to %s.\n", rdf.nsamples, rdf.file );
+    FreeRdf( &rdf );
+  }
+  if( corr.nlags ) {
+    FPTYPE *acc = (FPTYPE *) malloc( 2 * corr.nlags * nthreads * sizeof(FPTYPE) );
+
+    status = clEnqueueReadBuffer( cmdQueues[0], corr_acc, CL_TRUE, 0, 2 * corr.nlags * nthreads * sizeof(FPTYPE), acc, 0, NULL, NULL );
+    CheckSuccess(status, 0);
+    if( WriteCorr( &corr, &sys, acc, nthreads ) ) return 1;
+    printf( "Time correlations of %d samples written to %s.\n", corr.nsamples, corr.file );
+    free( acc );
+    free( kernel_corr );
+  }
+
 /* End profiling */
 
 #ifdef __PROFILING
@@ -624,9 +1991,28 @@ int main(int argc, char **argv)
 t2 = second();
 
 fprintf( stdout, "\n\nTime of execution = %.3g (seconds)\n", (t2 - t1) );
+/* host time spent in the print-step downloads (parts 6, 7, 8 and the wait of part 1) */
+if( nsample )
+  fprintf( stdout, "Print-step transfers = %.3g (seconds), %.3g per sample over %d samples\n",
+	   t_sample, t_sample / nsample, nsample );
+fprintf( stdout, "Host-device copies = %.4g bytes per step (zero-copy %s)\n",
+	 copybytes / sys.nsteps, zerocopy ? "on" : "off" );
+/* wall time of the MD loop and CPU time of the host thread driving it */
+fprintf( stdout, "MD loop = %.3g (seconds), %.4g steps/s, host CPU time %.3g (seconds), %.3g per step\n",
+	 t4, sys.nsteps / t4, c1, c1 / sys.nsteps );
 
 #endif
 
+#ifdef __PHASES
+  PrintPhases( &phases, stdout );
+#endif
+
+  if( counters.every ) {
+    status = PrintCounters( &counters, cmdQueues, cnt_buffer, stdout );
+    CheckSuccess(status, 0);
+    FreeCounters( &counters );
+  }
+
 
 
 
@@ -634,18 +2020,31 @@ fprintf( stdout, "\n\nTime of execution = %.3g (seconds)\n", (t2 - t1) );
 
   /* clean up: close files, free memory */
   printf("Simulation Done.\n");
-  fclose(erg);
-  fclose(traj);
+  if( erg ) fclose(erg);
+  if( traj ) fclose(traj);
+  CloseFrameRing( &ring );
 
-  free(buffers[0]);
-  free(buffers[1]);
-  free(buffers[2]);
-  free(buffers[3]);
+  for( u = 0; u < ndevices; u++ )
+    ReleaseArena( &arena[u] );
+  if( zerocopy ) {
+    ReleaseChunkedArray( &lay, cl_sys[0].rx );
+    ReleaseChunkedArray( &lay, cl_sys[0].ry );
+    ReleaseChunkedArray( &lay, cl_sys[0].rz );
+    ReleaseChunkedArray( &lay, cl_sys[0].vx );
+    ReleaseChunkedArray( &lay, cl_sys[0].vy );
+    ReleaseChunkedArray( &lay, cl_sys[0].vz );
+  }
+  ReleaseHostArena( &host );
 
+  FreePairTable(&table);
   free(cl_sys);
   free(cmdQueues);
   free(contexts);
   free(devices);
+#ifdef _MPI
+  FreeDomain(&dom);
+  MPI_Finalize();
+#endif
 
   return 0;
 }
@@ -0,0 +1,682 @@
+/** Python module ljmd: the MD engine in process.
+
+  ljmd.Engine(input, device="cpu", nthreads=0) reads the twelve mandatory
+  lines of an ljmd-cl input file and its restart, builds the kernels for the
+  first device the device string selects and computes the forces of the
+  start configuration. run(nsteps) then integrates NVE steps with the
+  same kernels as ljmd-cl (verlet_first, force, verlet_second) and leaves
+  the energies of the last step in the energies dict.
+
+  positions, velocities, forces and images are (3, natoms) views of the
+  engine's own host storage through the buffer protocol, numpy.asarray()
+  wraps them without a copy. Every row is a page aligned piece of one host
+  arena. When the device shares its memory with the host
+  (CL_DEVICE_HOST_UNIFIED_MEMORY) the device buffers are created on those
+  pieces with CL_MEM_USE_HOST_PTR and stay mapped while Python holds the
+  engine: run() unmaps them, launches the kernels and maps them again, no
+  byte is copied. Other devices get their own buffers, that run() reads
+  back into the host storage at the end of the call. Changes made from
+  Python reach the device with the next run(); after changing positions,
+  update() recomputes the forces and energies they belong to.
+
+  The engine is a single device, single chunk, NVE subset of ljmd-cl and
+  the restart must be a file. Of the optional keywords of the input it
+  takes vector, restart, zerocopy, potential lj and accumulate float; the
+  others (thermostat, barostat, the pair table, fixed point forces, rdf,
+  correlation, metrics, publish, counters) raise NotImplementedError with
+  all of them named, unknown keywords raise ValueError.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string.h>
+
+#include "OpenCL_utils.h"
+#include "OpenCL_data.h"
+#include "arena.h"
+#include "restart.h"
+#include "engine.h"
+
+#ifdef _USE_FLOAT
+#define FPFORMAT "f"
+#else
+#define FPFORMAT "d"
+#endif
+
+static const char * sourcecode =
+#include <opencl_kernels_as_string.h>
+;
+
+/** the per-atom arrays, three rows each */
+#define ARRAY_POS    0
+#define ARRAY_VEL    1
+#define ARRAY_FORCE  2
+#define ARRAY_IMAGE  3
+#define NARRAYS      4
+static const char *array_names[] = { "positions", "velocities", "forces", "images" };
+
+/** entries of the small state buffers the force and verlet kernels take in
+    the NVE build: thermostat, barostat, placeholder pair table, rdf counts */
+#define NSTATE 8
+
+struct _engine {
+    PyObject_HEAD
+    mdsys_t sys;
+    int nthreads, zerocopy, mapped, vecwidth;
+    int vector, parser;             /* the "vector" and "restart" keywords */
+    size_t gws[1];
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel force, force_noepot, verlet_first, verlet_second, ekin;
+    cl_mem mem[3*NARRAYS];          /* rx ry rz vx vy vz fx fy fz ix iy iz */
+    void *row[3*NARRAYS];           /* the host storage of every row */
+    size_t rowbytes[NARRAYS];       /* bytes of a row */
+    size_t stride[NARRAYS];         /* bytes between two rows */
+    cl_mem epot, ekinb, state, ustate, cnt;
+    FPTYPE *tmp_epot, *tmp_ekin;
+    size_t epotbytes;
+    host_arena_t host;
+    FPTYPE dtmf;
+};
+typedef struct _engine engine_t;
+
+/** a (3, natoms) array of an engine, only there to export it */
+struct _array {
+    PyObject_HEAD
+    engine_t *engine;
+    int which;
+    Py_ssize_t shape[2], strides[2];
+};
+typedef struct _array array_t;
+
+static PyTypeObject ArrayType;
+
+static PyObject * cl_error( const char * what, cl_int status )
+{
+    PyErr_Format( PyExc_RuntimeError, "%s: %s", what, CLErrString( status ) );
+    return NULL;
+}
+
+/** the keywords of ljmd-cl the engine does not run */
+static const char *unsupported[] = { "thermostat", "barostat", "rdf", "correlation", "metrics", "publish", "counters",
+                                     NULL };
+
+/** helper function: the optional keywords. the ones of the engine set vector,
+    parser and zerocopy, the names of the others are collected in skipped */
+static int read_options( FILE * fp, engine_t * e, char * skipped, size_t size )
+{
+    char line[BLEN], key[BLEN], kind[BLEN];
+    int i, err;
+
+    while (ReadInputOption( fp, line ) == 0) {
+        const char * name = NULL;
+
+        kind[0] = '\0';
+        sscanf( line, "%s %s", key, kind );
+        for (i = 0; unsupported[i]; ++i)
+            if (!strcmp( key, unsupported[i] )) name = unsupported[i];
+        if (!strcmp( key, "potential" ) && !strcmp( kind, "table" )) name = "potential table";
+        if (!strcmp( key, "accumulate" ) && !strcmp( kind, "fixed" )) name = "accumulate fixed";
+
+        err = 0;
+        if (name) {
+            if (!strstr( skipped, name ))
+                snprintf( skipped + strlen( skipped ), size - strlen( skipped ), "%s%s", *skipped ? ", " : "", name );
+        } else if (!strcmp( key, "vector" )) err = ReadVectorOption( line, &e->vector );
+        else if (!strcmp( key, "restart" )) err = ReadRestartOption( line, &e->parser );
+        else if (!strcmp( key, "zerocopy" )) err = ReadZerocopyOption( line, &e->zerocopy );
+        else if (!strcmp( key, "potential" )) err = strcmp( kind, "lj" );
+        else if (!strcmp( key, "accumulate" )) err = strcmp( kind, "float" );
+        else {
+            PyErr_Format( PyExc_ValueError, "unknown input keyword: %s", line );
+            return -1;
+        }
+        if (err) {
+            PyErr_Format( PyExc_ValueError, "invalid input keyword: %s", line );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** the twelve mandatory lines of the input and the optional keywords */
+static int read_input( const char * file, engine_t * e, char * restfile )
+{
+    FILE * fp = fopen( file, "r" );
+    char skipped[BLEN] = "";
+    input_t in;
+    int err;
+
+    if (!fp) {
+        PyErr_SetFromErrnoWithFilename( PyExc_OSError, file );
+        return -1;
+    }
+    e->vector = VECTOR_AUTO;
+    e->parser = RESTART_MMAP;
+    e->zerocopy = ZEROCOPY_AUTO;
+    err = ReadInput( fp, &e->sys, &in );
+    if (err) {
+        fclose( fp );
+        PyErr_Format( PyExc_ValueError, "%s: not the twelve lines of an input file", file );
+        return -1;
+    }
+    err = read_options( fp, e, skipped, sizeof(skipped) );
+    fclose( fp );
+    if (err) return -1;
+    if (*skipped) {
+        PyErr_Format( PyExc_NotImplementedError, "%s: the engine does not run %s", file, skipped );
+        return -1;
+    }
+    if (!strncmp( in.restfile, "fcc", 3 ) && isspace( in.restfile[3] )) {
+        PyErr_SetString( PyExc_ValueError, "the engine reads its atoms from a restart file, not an fcc lattice" );
+        return -1;
+    }
+    strcpy( restfile, in.restfile );
+    return 0;
+}
+
+/** the host storage of all rows, one page aligned piece each, and of the
+    energy partials. the rows of an array are the same number of pages apart */
+static int create_rows( engine_t * e )
+{
+    size_t hoff[3*NARRAYS], hepot, hekin;
+    int i;
+
+    for (i = 0; i < NARRAYS; ++i)
+        e->rowbytes[i] = (size_t) e->sys.natoms * ( i == ARRAY_IMAGE ? sizeof(cl_int) : sizeof(FPTYPE) );
+    for (i = 0; i < 3*NARRAYS; ++i) hoff[i] = HostArenaReserve( &e->host, e->rowbytes[i/3] );
+    hepot = HostArenaReserve( &e->host, e->epotbytes );
+    hekin = HostArenaReserve( &e->host, e->nthreads * sizeof(FPTYPE) );
+    if (CommitHostArena( &e->host )) return -1;
+    for (i = 0; i < 3*NARRAYS; ++i) {
+        e->row[i] = HostArenaPointer( &e->host, hoff[i] );
+        memset( e->row[i], 0, e->rowbytes[i/3] );
+    }
+    for (i = 0; i < NARRAYS; ++i) e->stride[i] = hoff[3*i+1] - hoff[3*i];
+    e->tmp_epot = (FPTYPE *) HostArenaPointer( &e->host, hepot );
+    e->tmp_ekin = (FPTYPE *) HostArenaPointer( &e->host, hekin );
+    return 0;
+}
+
+/** the device buffers, with zerocopy in the rows themselves */
+static cl_int create_buffers( engine_t * e )
+{
+    FPTYPE zero[NSTATE] = { ZERO };
+    cl_uint uzero[NSTATE] = { 0 };
+    cl_int status = CL_SUCCESS, err;
+    int i;
+
+    for (i = 0; i < 3*NARRAYS; ++i) {
+        e->mem[i] = clCreateBuffer( e->context, CL_MEM_READ_WRITE | ( e->zerocopy ? CL_MEM_USE_HOST_PTR : 0 ),
+                                    e->rowbytes[i/3], e->zerocopy ? e->row[i] : NULL, &err );
+        status |= err;
+    }
+    e->epot = clCreateBuffer( e->context, CL_MEM_READ_WRITE, e->epotbytes, NULL, &err );
+    status |= err;
+    e->ekinb = clCreateBuffer( e->context, CL_MEM_READ_WRITE, e->nthreads * sizeof(FPTYPE), NULL, &err );
+    status |= err;
+    e->state = clCreateBuffer( e->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(zero), zero, &err );
+    status |= err;
+    e->ustate = clCreateBuffer( e->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(uzero), uzero, &err );
+    status |= err;
+    /* the counter sums of the force kernels, never touched without -D_COUNTERS */
+    e->cnt = clCreateBuffer( e->context, CL_MEM_READ_WRITE, sizeof(cl_ulong), NULL, &err );
+    return status | err;
+}
+
+/** the arguments of the kernels: one chunk that is its own j chunk, no table,
+    no g(r), no fixed point sums, no counters */
+static cl_int create_kernels( engine_t * e )
+{
+    force_args_t fa;
+    chunk_args_t ca;
+    cl_int status, err;
+    int i;
+
+    e->force = clCreateKernel( e->program, e->vecwidth ? "opencl_force_vec" : "opencl_force", &status );
+    e->force_noepot = clCreateKernel( e->program, e->vecwidth ? "opencl_force_noepot_vec" : "opencl_force_noepot", &err );
+    status |= err;
+    e->verlet_first = clCreateKernel( e->program, "opencl_verlet_first", &err );
+    status |= err;
+    e->verlet_second = clCreateKernel( e->program, "opencl_verlet_second", &err );
+    status |= err;
+    e->ekin = clCreateKernel( e->program, "opencl_ekin", &err );
+    status |= err;
+    if (status != CL_SUCCESS) return status;
+
+    memset( &fa, 0, sizeof(fa) );
+    ForceConstants( &fa, &e->sys );
+    for (i = 0; i < 3; ++i) {
+        fa.f[i] = fa.a[i] = ca.f[i] = ca.a[i] = e->mem[6+i];
+        fa.r[i] = fa.rj[i] = ca.r[i] = e->mem[i];
+        ca.v[i] = e->mem[3+i];
+        ca.im[i] = e->mem[9+i];
+    }
+    fa.nj = fa.natoms1 = ca.natoms = e->sys.natoms;
+    fa.epot = e->epot;
+    fa.table = fa.baro = e->state;
+    fa.rdf = e->ustate;
+    fa.cnt = e->cnt;
+    fa.rdfbins = 1;
+    ca.atom0 = 0;
+    ca.dt = e->sys.dt;
+    ca.dtmf = e->dtmf;
+    ca.box = e->sys.box;
+    ca.thermo = ca.baro = e->state;
+    ca.tstate = e->ustate;
+    ca.ekin = e->ekinb;
+
+    status  = SetForceArgs( e->force, &fa );
+    status |= SetForceArgs( e->force_noepot, &fa );
+    status |= SetChunkArgs( e->verlet_first, e->verlet_second, e->ekin, &ca );
+    return status;
+}
+
+/** the rows go to the device: unmapped with zerocopy, written otherwise */
+static cl_int to_device( engine_t * e )
+{
+    cl_int status = CL_SUCCESS;
+    int i;
+
+    for (i = 0; i < 3*NARRAYS; ++i) {
+        if (!e->zerocopy)
+            status |= clEnqueueWriteBuffer( e->queue, e->mem[i], CL_FALSE, 0, e->rowbytes[i/3], e->row[i], 0, NULL, NULL );
+        else if (e->mapped)
+            status |= clEnqueueUnmapMemObject( e->queue, e->mem[i], e->row[i], 0, NULL, NULL );
+    }
+    e->mapped = 0;
+    return status;
+}
+
+/** and back to the host, with the energy partials. a mapped USE_HOST_PTR
+    buffer is the host row itself */
+static cl_int to_host( engine_t * e )
+{
+    cl_int status, err;
+    int i;
+
+    status = clEnqueueReadBuffer( e->queue, e->epot, CL_FALSE, 0, e->epotbytes, e->tmp_epot, 0, NULL, NULL );
+    status |= clEnqueueReadBuffer( e->queue, e->ekinb, CL_FALSE, 0, e->nthreads * sizeof(FPTYPE), e->tmp_ekin, 0, NULL, NULL );
+    for (i = 0; i < 3*NARRAYS; ++i) {
+        size_t bytes = e->rowbytes[i/3];
+
+        if (e->zerocopy) {
+            void * ptr = clEnqueueMapBuffer( e->queue, e->mem[i], CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0, NULL,
+                                             NULL, &err );
+
+            status |= err;
+            if (err == CL_SUCCESS && ptr != e->row[i]) status |= CL_MAP_FAILURE;
+        } else
+            status |= clEnqueueReadBuffer( e->queue, e->mem[i], CL_FALSE, 0, bytes, e->row[i], 0, NULL, NULL );
+    }
+    status |= clFinish( e->queue );
+    if (e->zerocopy) e->mapped = 1;
+    return status;
+}
+
+/** the energies of the downloaded partials, as reduce_sample of ljmd-cl.c does */
+static void energies( engine_t * e )
+{
+    mdsys_t * sys = &e->sys;
+    int i;
+
+    sys->epot = ZERO;
+    sys->ekin = ZERO;
+    sys->virial = ZERO;
+    for (i = 0; i < e->nthreads; ++i) {
+        sys->epot += e->tmp_epot[i];
+        sys->virial += e->tmp_epot[e->nthreads+i];
+        sys->ekin += e->tmp_ekin[i];
+    }
+    SampleEnergies( sys );
+}
+
+/** nsteps velocity verlet steps, the potential energy of the last one only.
+    no step recomputes the forces and energies of the current positions */
+static cl_int steps( engine_t * e, long nsteps )
+{
+    cl_int status = to_device( e );
+    long n;
+
+    if (!nsteps)
+        status |= clEnqueueNDRangeKernel( e->queue, e->force, 1, NULL, e->gws, NULL, 0, NULL, NULL );
+
+    for (n = 1; n <= nsteps && status == CL_SUCCESS; ++n) {
+        status |= clEnqueueNDRangeKernel( e->queue, e->verlet_first, 1, NULL, e->gws, NULL, 0, NULL, NULL );
+        status |= clEnqueueNDRangeKernel( e->queue, n == nsteps ? e->force : e->force_noepot, 1, NULL, e->gws, NULL, 0,
+                                          NULL, NULL );
+        status |= clEnqueueNDRangeKernel( e->queue, e->verlet_second, 1, NULL, e->gws, NULL, 0, NULL, NULL );
+    }
+    status |= clEnqueueNDRangeKernel( e->queue, e->ekin, 1, NULL, e->gws, NULL, 0, NULL, NULL );
+    status |= to_host( e );
+    if (status == CL_SUCCESS) {
+        e->sys.nfi += nsteps;
+        energies( e );
+    }
+    return status;
+}
+
+static void engine_dealloc( engine_t * e )
+{
+    int i;
+
+    if (e->queue) clFinish( e->queue );
+    if (e->force) clReleaseKernel( e->force );
+    if (e->force_noepot) clReleaseKernel( e->force_noepot );
+    if (e->verlet_first) clReleaseKernel( e->verlet_first );
+    if (e->verlet_second) clReleaseKernel( e->verlet_second );
+    if (e->ekin) clReleaseKernel( e->ekin );
+    if (e->program) clReleaseProgram( e->program );
+    for (i = 0; i < 3*NARRAYS; ++i) {
+        if (!e->mem[i]) continue;
+        if (e->mapped) clEnqueueUnmapMemObject( e->queue, e->mem[i], e->row[i], 0, NULL, NULL );
+        clReleaseMemObject( e->mem[i] );
+    }
+    if (e->queue) clFinish( e->queue );
+    if (e->epot) clReleaseMemObject( e->epot );
+    if (e->ekinb) clReleaseMemObject( e->ekinb );
+    if (e->state) clReleaseMemObject( e->state );
+    if (e->ustate) clReleaseMemObject( e->ustate );
+    if (e->cnt) clReleaseMemObject( e->cnt );
+    if (e->queue) clReleaseCommandQueue( e->queue );
+    if (e->context) clReleaseContext( e->context );
+    ReleaseHostArena( &e->host );
+    Py_TYPE(e)->tp_free( (PyObject *) e );
+}
+
+/** Engine(input, device="cpu", nthreads=0) */
+static int engine_init( engine_t * e, PyObject * args, PyObject * kwds )
+{
+    static char * kwlist[] = { "input", "device", "nthreads", NULL };
+    const char * input, * devarg = "cpu";
+    char device[STRINGSIZE], restfile[BLEN];
+    cl_device_id * devices = NULL, dev;
+    cl_context * contexts = NULL;
+    cl_command_queue * queues = NULL;
+    cl_device_type type;
+    cl_bool unified = CL_FALSE;
+    cl_ulong maxalloc;
+    cl_uint ndevices, u;
+    double * weights = NULL;
+    restart_t rst;
+    cl_int status;
+    int nthreads = 0;
+    char options[BLEN];
+
+    if (e->context) {
+        PyErr_SetString( PyExc_RuntimeError, "the engine is already initialized" );
+        return -1;
+    }
+    if (!PyArg_ParseTupleAndKeywords( args, kwds, "s|si", kwlist, &input, &devarg, &nthreads )) return -1;
+    if (nthreads < 0) {
+        PyErr_SetString( PyExc_ValueError, "the number of threads must not be negative" );
+        return -1;
+    }
+    memset( &e->sys, 0, sizeof(mdsys_t) );
+    if (read_input( input, e, restfile )) return -1;
+
+    snprintf( device, sizeof(device), "%s", devarg );
+    if (InitOpenCLEnvironment( device, &devices, &contexts, &queues, &ndevices, &weights ) != CL_SUCCESS) {
+        PyErr_Format( PyExc_RuntimeError, "no OpenCL device for \"%s\"", devarg );
+        return -1;
+    }
+    /* the first device only, the others are let go */
+    dev = devices[0];
+    e->context = contexts[0];
+    e->queue = queues[0];
+    for (u = 1; u < ndevices; ++u) {
+        clReleaseCommandQueue( queues[u] );
+        clReleaseContext( contexts[u] );
+    }
+    free( devices );
+    free( contexts );
+    free( queues );
+    free( weights );
+
+    clGetDeviceInfo( dev, CL_DEVICE_TYPE, sizeof(type), &type, NULL );
+    clGetDeviceInfo( dev, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL );
+    clGetDeviceInfo( dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxalloc), &maxalloc, NULL );
+    if ((cl_ulong) e->sys.natoms * sizeof(FPTYPE) > maxalloc) {
+        PyErr_Format( PyExc_MemoryError, "%d atoms do not fit in a single buffer of the device", e->sys.natoms );
+        return -1;
+    }
+    if (e->zerocopy == ZEROCOPY_AUTO) e->zerocopy = unified;
+    e->nthreads = nthreads ? nthreads : ( ( type & CL_DEVICE_TYPE_CPU ) ? 16 : 1024 );
+    e->gws[0] = e->nthreads;
+    e->epotbytes = ( 2 * e->nthreads + 1 ) * sizeof(FPTYPE);
+
+    e->vecwidth = VectorWidth( dev, e->vector, 0 );
+    snprintf( options, sizeof(options), e->vecwidth ? "%s -D_THERMOSTAT=0 -D_VECTOR=%d" : "%s -D_THERMOSTAT=0",
+              KERNEL_FLAGS, e->vecwidth );
+    e->program = clCreateProgramWithSource( e->context, 1, &sourcecode, NULL, &status );
+    if (status != CL_SUCCESS) {
+        cl_error( "clCreateProgramWithSource", status );
+        return -1;
+    }
+    status = clBuildProgram( e->program, 1, &dev, options, NULL, NULL );
+    if (status != CL_SUCCESS) {
+        char log[STRINGSIZE] = "";
+
+        clGetProgramBuildInfo( e->program, dev, CL_PROGRAM_BUILD_LOG, sizeof(log) - 1, log, NULL );
+        PyErr_Format( PyExc_RuntimeError, "the kernels do not build: %s\n%s", CLErrString( status ), log );
+        return -1;
+    }
+
+    e->dtmf = HALF * e->sys.dt / mvsq2e / e->sys.mass;
+
+    /* the restart goes into the host rows before the buffers are made of them */
+    memset( &rst, 0, sizeof(rst) );
+    if (OpenRestart( &rst, restfile, e->sys.natoms, e->parser )) {
+        PyErr_Format( PyExc_OSError, "cannot read the restart %s", restfile );
+        return -1;
+    }
+    if (create_rows( e )) {
+        CloseRestart( &rst );
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (ReadRestart( &rst, 0, e->sys.natoms, e->row[0], e->row[1], e->row[2] ) ||
+        ReadRestart( &rst, e->sys.natoms, e->sys.natoms, e->row[3], e->row[4], e->row[5] )) {
+        CloseRestart( &rst );
+        PyErr_Format( PyExc_ValueError, "the restart %s does not hold %d atoms", restfile, e->sys.natoms );
+        return -1;
+    }
+    CloseRestart( &rst );
+    status = create_buffers( e );
+    if (status != CL_SUCCESS) {
+        cl_error( "cannot create the buffers", status );
+        return -1;
+    }
+    status = create_kernels( e );
+    if (status != CL_SUCCESS) {
+        cl_error( "cannot create the kernels", status );
+        return -1;
+    }
+    status = steps( e, 0 );
+    if (status != CL_SUCCESS) {
+        cl_error( "the first force failed", status );
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * engine_run( engine_t * e, PyObject * args )
+{
+    long nsteps;
+    cl_int status;
+
+    if (!PyArg_ParseTuple( args, "l", &nsteps )) return NULL;
+    if (nsteps < 0) {
+        PyErr_SetString( PyExc_ValueError, "the number of steps must not be negative" );
+        return NULL;
+    }
+    if (!e->context) {
+        PyErr_SetString( PyExc_RuntimeError, "the engine is not initialized" );
+        return NULL;
+    }
+    status = steps( e, nsteps );
+    if (status != CL_SUCCESS) return cl_error( "run", status );
+    Py_RETURN_NONE;
+}
+
+static PyObject * engine_update( engine_t * e, PyObject * unused )
+{
+    cl_int status;
+
+    if (!e->context) {
+        PyErr_SetString( PyExc_RuntimeError, "the engine is not initialized" );
+        return NULL;
+    }
+    status = steps( e, 0 );
+    if (status != CL_SUCCESS) return cl_error( "update", status );
+    Py_RETURN_NONE;
+}
+
+/** a memoryview of one of the (3, natoms) arrays, that keeps the engine alive */
+static PyObject * engine_array( engine_t * e, void * closure )
+{
+    array_t * a;
+    PyObject * view;
+    int which = (int) (intptr_t) closure;
+
+    if (!e->context) {
+        PyErr_SetString( PyExc_RuntimeError, "the engine is not initialized" );
+        return NULL;
+    }
+    a = PyObject_New( array_t, &ArrayType );
+    if (!a) return NULL;
+    Py_INCREF( e );
+    a->engine = e;
+    a->which = which;
+    a->shape[0] = 3;
+    a->shape[1] = e->sys.natoms;
+    a->strides[0] = e->stride[which];
+    a->strides[1] = ( which == ARRAY_IMAGE ) ? sizeof(cl_int) : sizeof(FPTYPE);
+    view = PyMemoryView_FromObject( (PyObject *) a );
+    Py_DECREF( a );
+    return view;
+}
+
+static PyObject * engine_energies( engine_t * e, void * closure )
+{
+    return Py_BuildValue( "{s:i,s:d,s:d,s:d,s:d,s:d}", "nfi", e->sys.nfi, "temp", (double) e->sys.temp,
+                          "ekin", (double) e->sys.ekin, "epot", (double) e->sys.epot,
+                          "etot", (double) ( e->sys.ekin + e->sys.epot ), "press", (double) e->sys.press );
+}
+
+static PyObject * engine_get( engine_t * e, void * closure )
+{
+    switch ((int) (intptr_t) closure) {
+    case 0: return PyLong_FromLong( e->sys.natoms );
+    case 1: return PyFloat_FromDouble( e->sys.box );
+    case 2: return PyFloat_FromDouble( e->sys.dt );
+    case 3: return PyLong_FromLong( e->sys.nsteps );
+    case 4: return PyBool_FromLong( e->zerocopy );
+    default: return PyLong_FromLong( e->nthreads );
+    }
+}
+
+static int array_getbuffer( array_t * a, Py_buffer * view, int flags )
+{
+    engine_t * e = a->engine;
+
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && a->strides[0] != a->shape[1] * a->strides[1]) {
+        PyErr_Format( PyExc_BufferError, "the %s rows are page aligned, the array needs strides", array_names[a->which] );
+        return -1;
+    }
+    view->obj = (PyObject *) a;
+    Py_INCREF( a );
+    view->buf = e->row[3*a->which];
+    view->len = 3 * a->shape[1] * a->strides[1];
+    view->readonly = 0;
+    view->itemsize = a->strides[1];
+    view->format = ( flags & PyBUF_FORMAT ) ? ( a->which == ARRAY_IMAGE ? "i" : FPFORMAT ) : NULL;
+    view->ndim = 2;
+    view->shape = a->shape;
+    view->strides = a->strides;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void array_dealloc( array_t * a )
+{
+    Py_XDECREF( a->engine );
+    PyObject_Del( a );
+}
+
+static PyBufferProcs array_as_buffer = {
+    (getbufferproc) array_getbuffer,
+    NULL,
+};
+
+static PyTypeObject ArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ljmd._Array",
+    .tp_basicsize = sizeof(array_t),
+    .tp_dealloc = (destructor) array_dealloc,
+    .tp_as_buffer = &array_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "(3, natoms) host storage of an engine",
+};
+
+static PyMethodDef engine_methods[] = {
+    { "run", (PyCFunction) engine_run, METH_VARARGS,
+      "run(nsteps): nsteps NVE steps, then the arrays and energies are those of the last one" },
+    { "update", (PyCFunction) engine_update, METH_NOARGS,
+      "update(): the forces and energies of the arrays as changed from Python" },
+    { NULL }
+};
+
+static PyGetSetDef engine_getset[] = {
+    { "positions", (getter) engine_array, NULL, "(3, natoms) positions in A, wrapped into the box", (void *) ARRAY_POS },
+    { "velocities", (getter) engine_array, NULL, "(3, natoms) velocities in A/fs", (void *) ARRAY_VEL },
+    { "forces", (getter) engine_array, NULL, "(3, natoms) forces in kcal/mol/A", (void *) ARRAY_FORCE },
+    { "images", (getter) engine_array, NULL, "(3, natoms) periodic images, unwrapped = positions + box * images",
+      (void *) ARRAY_IMAGE },
+    { "energies", (getter) engine_energies, NULL, "nfi, temp, ekin, epot, etot and press of the last step", NULL },
+    { "natoms", (getter) engine_get, NULL, "number of atoms", (void *) 0 },
+    { "box", (getter) engine_get, NULL, "box length in A", (void *) 1 },
+    { "dt", (getter) engine_get, NULL, "time step in fs", (void *) 2 },
+    { "nsteps", (getter) engine_get, NULL, "steps of the input file", (void *) 3 },
+    { "zerocopy", (getter) engine_get, NULL, "the arrays are the device buffers themselves", (void *) 4 },
+    { "nthreads", (getter) engine_get, NULL, "work-items of the kernels", (void *) 5 },
+    { NULL }
+};
+
+static PyTypeObject EngineType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ljmd.Engine",
+    .tp_basicsize = sizeof(engine_t),
+    .tp_dealloc = (destructor) engine_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Engine(input, device=\"cpu\", nthreads=0): the system of an ljmd-cl input file on one OpenCL device",
+    .tp_methods = engine_methods,
+    .tp_getset = engine_getset,
+    .tp_init = (initproc) engine_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef ljmd_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ljmd",
+    .m_doc = "the ljmd-cl engine in process, its state as arrays without copies",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_ljmd( void )
+{
+    PyObject * m;
+
+    if (PyType_Ready( &ArrayType ) < 0 || PyType_Ready( &EngineType ) < 0) return NULL;
+    m = PyModule_Create( &ljmd_module );
+    if (!m) return NULL;
+    Py_INCREF( &EngineType );
+    if (PyModule_AddObject( m, "Engine", (PyObject *) &EngineType ) < 0) {
+        Py_DECREF( &EngineType );
+        Py_DECREF( m );
+        return NULL;
+    }
+    return m;
+}
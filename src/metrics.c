@@ -0,0 +1,173 @@
+/** Live throughput of the run.
+
+  The rates are the steps since the last export over its wall time, the
+  ETA extrapolates the mean rate of the whole run. The force kernel time
+  of a device is the span from the start of its first force launch to
+  the end of its last one, on every METRICS_PROBE-th step. A probe that
+  falls on a sampled step, whose force also computes the energies, moves
+  to the next unsampled step, or to the last step before the next probe
+  when every step is sampled; the mean of the last METRICS_WINDOW probes
+  is exported. The
+  Prometheus file is written next to the target and renamed over it, a
+  textfile collector never reads half a file. The JSON file gets one line
+  per export.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio_ext.h>
+
+#include "metrics.h"
+#include "OpenCL_utils.h"
+
+static const char * metrics_names[] = { "prom", "json" };
+
+int ReadMetricsOption( const char * line, metrics_t * m )
+{
+    char kind[BLEN] = "";
+
+    m->interval = 10.0;
+    if (sscanf(line, "%*s %s %s %lf", kind, m->file, &m->interval) >= 2 && m->interval >= 0.0)
+        for (m->format = METRICS_JSON; m->format >= METRICS_PROM; m->format--)
+            if (!strcmp(kind, metrics_names[m->format])) return 0;
+    fprintf(stderr, "usage: metrics prom|json <file> [seconds between two exports]\n");
+    m->format = -1;
+    return -1;
+}
+
+int InitMetrics( metrics_t * m, int ndevices, int nfi )
+{
+    m->ndevices = ndevices;
+    m->nfi0 = m->nfilast = nfi;
+    m->tstart = m->tlast = second();
+    m->nktime = 0;
+    m->probing = 0;
+    m->due = -1;
+    m->ktime = (double *) calloc(METRICS_WINDOW * ndevices, sizeof(double));
+    m->kstart = (cl_event *) calloc(ndevices, sizeof(cl_event));
+    m->kend = (cl_event *) calloc(ndevices, sizeof(cl_event));
+    if (!m->ktime || !m->kstart || !m->kend) return -1;
+
+    /* a new JSON file for every run */
+    if (m->format == METRICS_JSON) {
+        FILE * fp = fopen(m->file, "w");
+
+        if (!fp) {
+            perror("cannot write metrics file");
+            return -1;
+        }
+        fclose(fp);
+    }
+    return 0;
+}
+
+int CollectMetrics( metrics_t * m )
+{
+    cl_ulong start, end;
+    cl_int status = CL_SUCCESS;
+    int u;
+
+    if (!m->probing) return CL_SUCCESS;
+    for (u = 0; u < m->ndevices; u++) {
+        status |= clWaitForEvents(1, &m->kend[u]);
+        status |= clGetEventProfilingInfo(m->kstart[u], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        status |= clGetEventProfilingInfo(m->kend[u], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        m->ktime[u * METRICS_WINDOW + m->nktime % METRICS_WINDOW] = ( end > start ) ? 1.0e-9 * ( end - start ) : 0.0;
+        clReleaseEvent(m->kstart[u]);
+        clReleaseEvent(m->kend[u]);
+    }
+    m->nktime++;
+    m->probing = 0;
+    return status;
+}
+
+int MetricsProbe( metrics_t * m, int nfi, int sample )
+{
+    if (nfi % METRICS_PROBE == 0 && m->due < 0) m->due = nfi;
+    if (m->due < 0 || ( sample && nfi - m->due < METRICS_PROBE - 1 )) return 0;
+    CollectMetrics(m);
+    m->due = -1;
+    return 1;
+}
+
+int MetricsDue( const metrics_t * m )
+{
+    return second() - m->tlast >= m->interval;
+}
+
+/* mean force kernel time of device u over the window */
+static double kernel_time( const metrics_t * m, int u )
+{
+    int n = ( m->nktime < METRICS_WINDOW ) ? m->nktime : METRICS_WINDOW, k;
+    double sum = 0.0;
+
+    for (k = 0; k < n; k++) sum += m->ktime[u * METRICS_WINDOW + k];
+    return n ? sum / n : 0.0;
+}
+
+int WriteMetrics( metrics_t * m, const mdsys_t * sys, double copybytes, int pending, FILE * erg, FILE * traj )
+{
+    double now = second();
+    double rate = ( now > m->tlast ) ? ( sys->nfi - m->nfilast ) / ( now - m->tlast ) : 0.0;
+    double mean = ( now > m->tstart ) ? ( sys->nfi - m->nfi0 ) / ( now - m->tstart ) : 0.0;
+    double eta = ( mean > 0.0 ) ? ( sys->nsteps - sys->nfi ) / mean : 0.0;
+    double nsday = rate * sys->dt * 86400.0 * 1.0e-6;
+    long backlog = ( erg ? __fpending(erg) : 0 ) + ( traj ? __fpending(traj) : 0 );
+    char tmp[BLEN + 8];
+    FILE * fp;
+    int u;
+
+    if (m->format == METRICS_JSON) {
+        if (!( fp = fopen(m->file, "a") )) {
+            perror("cannot write metrics file");
+            return -1;
+        }
+        fprintf(fp, "{\"step\": %d, \"steps_per_second\": %.6g, \"ns_per_day\": %.6g, \"atom_steps_per_second\": %.6g, "
+                "\"force_kernel_seconds\": [", sys->nfi, rate, nsday, rate * sys->natoms);
+        for (u = 0; u < m->ndevices; u++) fprintf(fp, "%s%.6g", u ? ", " : "", kernel_time(m, u));
+        fprintf(fp, "], \"copy_bytes\": %.0f, \"pending_samples\": %d, \"output_backlog_bytes\": %ld, \"eta_seconds\": %.6g}\n",
+                copybytes, pending, backlog, eta);
+        fclose(fp);
+    } else {
+        snprintf(tmp, sizeof(tmp), "%s.tmp", m->file);
+        if (!( fp = fopen(tmp, "w") )) {
+            perror("cannot write metrics file");
+            return -1;
+        }
+        fprintf(fp, "# HELP ljmd_step Last MD step.\n# TYPE ljmd_step gauge\nljmd_step %d\n", sys->nfi);
+        fprintf(fp, "# HELP ljmd_steps_per_second MD steps per wall second since the last export.\n"
+                "# TYPE ljmd_steps_per_second gauge\nljmd_steps_per_second %.6g\n", rate);
+        fprintf(fp, "# HELP ljmd_ns_per_day Simulated nanoseconds per day.\n# TYPE ljmd_ns_per_day gauge\nljmd_ns_per_day %.6g\n", nsday);
+        fprintf(fp, "# HELP ljmd_atom_steps_per_second Atoms times steps per wall second.\n"
+                "# TYPE ljmd_atom_steps_per_second gauge\nljmd_atom_steps_per_second %.6g\n", rate * sys->natoms);
+        fprintf(fp, "# HELP ljmd_force_kernel_seconds Mean force kernel time of a step over the last %d probes.\n"
+                "# TYPE ljmd_force_kernel_seconds gauge\n", METRICS_WINDOW);
+        for (u = 0; u < m->ndevices; u++) fprintf(fp, "ljmd_force_kernel_seconds{device=\"%d\"} %.6g\n", u, kernel_time(m, u));
+        fprintf(fp, "# HELP ljmd_copy_bytes_total Bytes copied between host and devices in the MD loop.\n"
+                "# TYPE ljmd_copy_bytes_total counter\nljmd_copy_bytes_total %.0f\n", copybytes);
+        fprintf(fp, "# HELP ljmd_pending_samples Samples downloading and not written yet.\n"
+                "# TYPE ljmd_pending_samples gauge\nljmd_pending_samples %d\n", pending);
+        fprintf(fp, "# HELP ljmd_output_backlog_bytes Output bytes buffered and not written to the files.\n"
+                "# TYPE ljmd_output_backlog_bytes gauge\nljmd_output_backlog_bytes %ld\n", backlog);
+        fprintf(fp, "# HELP ljmd_eta_seconds Wall seconds to the last step at the mean rate of the run.\n"
+                "# TYPE ljmd_eta_seconds gauge\nljmd_eta_seconds %.6g\n", eta);
+        if (fclose(fp) || rename(tmp, m->file)) {
+            perror("cannot write metrics file");
+            return -1;
+        }
+    }
+    m->tlast = now;
+    m->nfilast = sys->nfi;
+    return 0;
+}
+
+void FreeMetrics( metrics_t * m )
+{
+    CollectMetrics(m);
+    free(m->ktime);
+    free(m->kstart);
+    free(m->kend);
+    m->ktime = NULL;
+    m->kstart = m->kend = NULL;
+}
@@ -4,16 +4,57 @@
 #define ZERO    0.0f
 #define HALF    0.5f
 #define ONE     1.0f
+#define TWO     2.0f
+#define THREE   3.0f
 #define SIX     6.0f
+#define NINE    9.0f
 #define TWELVE 12.0f
+#define TWOPI   6.28318530717958648f
+#define RAND_SCALE 5.9604644775390625e-08f  /* 2^-24 */
 #else
 #pragma OPENCL EXTENSION cl_khr_fp64: enable
 #define FPTYPE double
 #define ZERO    0.0
 #define HALF    0.5
 #define ONE     1.0
+#define TWO     2.0
+#define THREE   3.0
 #define SIX     6.0
+#define NINE    9.0
 #define TWELVE 12.0
+#define TWOPI   6.28318530717958648
+#define RAND_SCALE 5.9604644775390625e-08   /* 2^-24 */
+#endif
+
+/* thermostat kinds, selected at build time with -D_THERMOSTAT=n */
+#define BERENDSEN 1
+#define VRESCALE  2
+#define LANGEVIN  3
+#ifndef _THERMOSTAT
+#define _THERMOSTAT 0
+#endif
+
+/* layout of the thermostat state buffer (must match ljmd-cl.c) */
+#define TH_DECAY  0   /* exp(-dt/tau) */
+#define TH_DTTAU  1   /* dt/tau */
+#define TH_NDOF   2   /* degrees of freedom */
+#define TH_SUMV2  3   /* target sum of v^2 at the reference temperature */
+#define TH_NOISE  4   /* langevin noise amplitude */
+
+/* layout of the barostat state buffer (must match ljmd-cl.c), used when built with -D_BAROSTAT */
+#define BA_MU     0   /* position scaling of the next step */
+#define BA_BOX    1   /* box length of the next force */
+#define BA_PRESS  2   /* reference pressure in bar */
+#define BA_COUPLE 3   /* dt*compressibility/tau in 1/bar */
+#define BA_PCONV  4   /* kcal/mol/A^3 in bar */
+#define BA_MV2    5   /* mvsq2e*mass, kinetic energy of sum(v^2) */
+
+/* fixed point force accumulation (built with -D_FIXED=bits): the pair forces are
+   rounded to multiples of 2^-bits and summed as 64-bit integers, in any order */
+#ifdef _FIXED
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics: enable
+#define FIXED_SCALE ( (FPTYPE) ( 1L << _FIXED ) )
+#define FIXED_INV   ( ONE / FIXED_SCALE )
 #endif
 
 __kernel void opencl_azzero(  __global FPTYPE * a, __global FPTYPE * b, __global FPTYPE * c, const int natoms ) {
@@ -33,132 +74,1001 @@ __kernel void opencl_azzero(  __global FPTYPE * a, __global FPTYPE * b, __global
 
 } 	 
 
-__kernel void opencl_ekin(  __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, __global FPTYPE * ekin ) {
+/* kinetic energy partials of the chunk starting at atom atom0: the first chunk
+   overwrites ekin, the others add to it */
+__kernel void opencl_ekin(  __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, __global FPTYPE * ekin, const int atom0 ) {
 
   int nths = get_global_size( 0 );
   int id_th = get_global_id( 0 );
   int loc_id = id_th;
-
-  ekin[id_th] = ZERO;
+  FPTYPE ekin_th = atom0 ? ekin[id_th] : ZERO;
     
   while( loc_id < natoms ) {
 
-    ekin[id_th] += vx[loc_id] * vx[loc_id] + vy[loc_id] * vy[loc_id] + vz[loc_id] * vz[loc_id];
+    ekin_th += vx[loc_id] * vx[loc_id] + vy[loc_id] * vy[loc_id] + vz[loc_id] * vz[loc_id];
 
     loc_id += nths;
   }
+  ekin[id_th] = ekin_th;
   //    sys->ekin *= 0.5*mvsq2e*sys->mass;
   //    sys->temp  = 2.0*sys->ekin/(3.0*sys->natoms-3.0)/kboltz;
 }
 
 
-inline FPTYPE pbc(FPTYPE x, const FPTYPE boxby2, const FPTYPE box)
+/* counter based random numbers (Philox2x32-10): the same counter and key
+   give the same numbers on every device, no state has to be stored */
+inline void philox2x32(uint *c0, uint *c1, uint key)
 {
-    while (x >  boxby2) x -= box;
-    while (x < -boxby2) x += box;
-    return x;
+  int r;
+  uint hi, lo;
+
+  for( r = 0; r < 10; r++ ) {
+    hi = mul_hi( 0xD256D193u, *c0 );
+    lo = 0xD256D193u * *c0;
+    *c0 = hi ^ key ^ *c1;
+    *c1 = lo;
+    key += 0x9E3779B9u;
+  }
+}
+
+/* two uniform numbers in (0,1) */
+inline void uniform2(uint c0, uint c1, uint key, FPTYPE *u0, FPTYPE *u1)
+{
+  philox2x32( &c0, &c1, key );
+  *u0 = ( (FPTYPE) ( c0 >> 8 ) + HALF ) * RAND_SCALE;
+  *u1 = ( (FPTYPE) ( c1 >> 8 ) + HALF ) * RAND_SCALE;
+}
+
+/* two normal deviates (Box-Muller) */
+inline void gauss2(uint c0, uint c1, uint key, FPTYPE *g0, FPTYPE *g1)
+{
+  FPTYPE u0, u1, r;
+
+  uniform2( c0, c1, key, &u0, &u1 );
+  r = sqrt( -TWO * log( u0 ) );
+  *g0 = r * cos( TWOPI * u1 );
+  *g1 = r * sin( TWOPI * u1 );
+}
+
+/* sum of nn squared normal deviates, i.e. a chi-squared number drawn
+   as 2*Gamma(nn/2) with the Marsaglia-Tsang method */
+inline FPTYPE sum_noises(FPTYPE nn, uint step, uint key)
+{
+  FPTYPE d = HALF * nn - ONE / THREE;
+  FPTYPE c = ONE / sqrt( NINE * d );
+  FPTYPE x, v, u, w;
+  uint n;
+
+  for( n = 1; n < 64; n += 2 ) {
+    gauss2( n, step, key, &x, &w );
+    uniform2( n + 1, step, key, &u, &w );
+    v = ONE + c * x;
+    if( v <= ZERO ) continue;
+    v = v * v * v;
+    if( log( u ) < HALF * x * x + d - d * v + d * log( v ) ) return TWO * d * v;
+  }
+  return nn;
 }
 
 
-__kernel void opencl_force( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxby2, const FPTYPE box, const int atom1, const int natoms1 ){
+#if _THERMOSTAT == BERENDSEN || _THERMOSTAT == VRESCALE
+/* velocity scaling factor of the weak coupling thermostats from the kinetic energy
+   partials left by opencl_verlet_second. every work-item of opencl_verlet_first
+   computes it, from the same partials and random numbers, so that it needs no
+   launch of its own and no data goes back to the host */
+inline FPTYPE coupling_factor( __global FPTYPE * ekin, const int nparts, __global FPTYPE * thermo, __global uint * tstate ) {
+
+  int i;
+  FPTYPE sumv2 = ZERO;
+
+  for( i = 0; i < nparts; i++ ) sumv2 += ekin[i];
+
+#if _THERMOSTAT == BERENDSEN
+  return sqrt( max( ONE + thermo[TH_DTTAU] * ( thermo[TH_SUMV2] / sumv2 - ONE ), ZERO ) );
+#else
+  {
+    /* stochastic velocity rescaling, Bussi et al., J. Chem. Phys. 126, 014101 (2007) */
+    FPTYPE c = thermo[TH_DECAY];
+    FPTYPE nf = thermo[TH_NDOF];
+    FPTYPE ratio = thermo[TH_SUMV2] / sumv2 / nf;
+    FPTYPE r1, s, alpha2;
+
+    gauss2( 0, tstate[0], tstate[1] ^ 0x5BD1E995u, &r1, &s );
+    s = sum_noises( nf - ONE, tstate[0], tstate[1] ^ 0x5BD1E995u );
+    alpha2 = c + ( ONE - c ) * ( s + r1 * r1 ) * ratio + TWO * r1 * sqrt( c * ( ONE - c ) * ratio );
+    return sqrt( max( alpha2, ZERO ) );
+  }
+#endif
+}
+#endif
+
+
+/* Berendsen barostat: instantaneous pressure of the last step from the virial
+   partials of the force (epot[nparts..2*nparts-1]) and the sum of v^2 partials
+   of opencl_ekin, then the scaling factor mu of the box, applied to the box now
+   and to the positions by the next verlet_first. runs as a single work-item */
+__kernel void opencl_barostat( __global FPTYPE * epot, __global FPTYPE * ekin, const int nparts, __global FPTYPE * baro ) {
+
+  int i;
+  FPTYPE vir = ZERO, sumv2 = ZERO, box, press, mu3;
+
+  if( get_global_id( 0 ) != 0 ) return;
+
+  for( i = 0; i < nparts; i++ ) {
+    vir += epot[nparts+i];
+    sumv2 += ekin[i];
+  }
+  box = baro[BA_BOX];
+  press = ( baro[BA_MV2] * sumv2 + vir ) / ( THREE * box * box * box ) * baro[BA_PCONV];
+
+  /* at most 1% of volume per step */
+  mu3 = clamp( ONE - baro[BA_COUPLE] * ( baro[BA_PRESS] - press ), (FPTYPE) 0.99, (FPTYPE) 1.01 );
+  baro[BA_MU] = cbrt( mu3 );
+  baro[BA_BOX] = box * baro[BA_MU];
+}
+
+
+/* fcc lattice of ncell^3 cells of edge a centered in the box, atom atom0+i of the
+   chunk is basis site (atom0+i)%4 of cell (atom0+i)/4. the velocities are normal
+   deviates of width sigma drawn from the global atom index, on counters the
+   langevin thermostat does not use */
+__kernel void opencl_fcc( __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const int atom0, const int ncell, const FPTYPE a, const FPTYPE sigma, const uint key ) {
+
+  int nths = get_global_size( 0 );
+  int loc_id = get_global_id( 0 );
+  FPTYPE half_box = HALF * ncell * a;
+  FPTYPE g0, g1, g2, g3;
+
+  while( loc_id < natoms ) {
+    int g = atom0 + loc_id, cell = g / 4, site = g % 4;
+    int ix = cell / ( ncell * ncell ), iy = ( cell / ncell ) % ncell, iz = cell % ncell;
+
+    rx[loc_id] = ( ix + ( ( site == 1 || site == 2 ) ? HALF : ZERO ) ) * a - half_box;
+    ry[loc_id] = ( iy + ( ( site == 1 || site == 3 ) ? HALF : ZERO ) ) * a - half_box;
+    rz[loc_id] = ( iz + ( ( site == 2 || site == 3 ) ? HALF : ZERO ) ) * a - half_box;
+
+    gauss2( g, 0xFFFFFFFEu, key, &g0, &g1 );
+    gauss2( g, 0xFFFFFFFFu, key, &g2, &g3 );
+    vx[loc_id] = sigma * g0;
+    vy[loc_id] = sigma * g1;
+    vz[loc_id] = sigma * g2;
+
+    loc_id += nths;
+  }
+}
+
+/* partial sums of vx, vy, vz and v^2, four per thread: the first chunk
+   overwrites vsum, the others add to it */
+__kernel void opencl_vsum( __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, __global FPTYPE * vsum, const int atom0 ) {
 
   int nths = get_global_size( 0 );
   int id_th = get_global_id( 0 );
-  int loc_id;
+  int loc_id = id_th;
+  FPTYPE sx = ZERO, sy = ZERO, sz = ZERO, sv2 = ZERO;
+
+  if( atom0 ) {
+    sx = vsum[4*id_th];
+    sy = vsum[4*id_th+1];
+    sz = vsum[4*id_th+2];
+    sv2 = vsum[4*id_th+3];
+  }
+  while( loc_id < natoms ) {
+    sx += vx[loc_id];
+    sy += vy[loc_id];
+    sz += vz[loc_id];
+    sv2 += vx[loc_id] * vx[loc_id] + vy[loc_id] * vy[loc_id] + vz[loc_id] * vz[loc_id];
+    loc_id += nths;
+  }
+  vsum[4*id_th] = sx;
+  vsum[4*id_th+1] = sy;
+  vsum[4*id_th+2] = sz;
+  vsum[4*id_th+3] = sv2;
+}
 
-  /* zero energy and forces */
-  epot[id_th] = ZERO;
+/* removes the center of mass velocity and scales the velocities */
+__kernel void opencl_vscale( __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const FPTYPE cx, const FPTYPE cy, const FPTYPE cz, const FPTYPE scale ) {
 
-  loc_id = id_th;
-  while( loc_id < natoms1 ){
+  int nths = get_global_size( 0 );
+  int loc_id = get_global_id( 0 );
 
-    fx[ loc_id ] = ZERO;
-    fy[ loc_id ] = ZERO;
-    fz[ loc_id ] = ZERO;
+  while( loc_id < natoms ) {
+    vx[loc_id] = ( vx[loc_id] - cx ) * scale;
+    vy[loc_id] = ( vy[loc_id] - cy ) * scale;
+    vz[loc_id] = ( vz[loc_id] - cz ) * scale;
+    loc_id += nths;
+  }
+}
+
+
+/* time correlation functions of a chunk and one time origin of the ring of nlags
+   origins (ox .. ovz). cstate holds the slot of this sample and the number of
+   origins stored so far: the origin of the current slot is overwritten with this
+   step, the others are lag d = (slot - origin) mod nlags old. the squared
+   displacement and v(0).v(t) are added to the partials of this thread, acc holds
+   2*nlags values (msd, vacf) per thread. the displacements are those of the
+   unwrapped positions r + box*image */
+__kernel void opencl_correlate( __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, __global FPTYPE * ox, __global FPTYPE * oy, __global FPTYPE * oz, __global FPTYPE * ovx, __global FPTYPE * ovy, __global FPTYPE * ovz, const int natoms, const int origin, const int nlags, __global int * cstate, __global FPTYPE * acc, __global int * ix, __global int * iy, __global int * iz, const FPTYPE box, __global FPTYPE * baro ) {
+
+  int nths = get_global_size( 0 );
+  int id_th = get_global_id( 0 );
+  int loc_id = id_th;
+  int d = ( cstate[0] - origin + nlags ) % nlags;
+  FPTYPE msd = ZERO, vacf = ZERO;
+#ifdef _BAROSTAT
+  const FPTYPE lbox = baro[BA_BOX];
+#else
+  const FPTYPE lbox = box;
+#endif
+
+  if( d >= cstate[1] ) return;
+
+  while( loc_id < natoms ) {
+    FPTYPE x = rx[loc_id] + lbox * ix[loc_id];
+    FPTYPE y = ry[loc_id] + lbox * iy[loc_id];
+    FPTYPE z = rz[loc_id] + lbox * iz[loc_id];
+
+    if( d == 0 ) {
+      ox[loc_id] = x;
+      oy[loc_id] = y;
+      oz[loc_id] = z;
+      ovx[loc_id] = vx[loc_id];
+      ovy[loc_id] = vy[loc_id];
+      ovz[loc_id] = vz[loc_id];
+    } else {
+      FPTYPE dx = x - ox[loc_id];
+      FPTYPE dy = y - oy[loc_id];
+      FPTYPE dz = z - oz[loc_id];
+
+      msd += dx * dx + dy * dy + dz * dz;
+    }
+    vacf += vx[loc_id] * ovx[loc_id] + vy[loc_id] * ovy[loc_id] + vz[loc_id] * ovz[loc_id];
     loc_id += nths;
   }
+  acc[2*(nlags*id_th+d)] += msd;
+  acc[2*(nlags*id_th+d)+1] += vacf;
+}
+
+
+/* next slot of the ring of time origins */
+__kernel void opencl_correlate_next( __global int * cstate, const int nlags ) {
+
+  if( get_global_id( 0 ) != 0 ) return;
+  cstate[0] = ( cstate[0] + 1 ) % nlags;
+  cstate[1] = min( cstate[1] + 1, nlags );
+}
+
+
+/* minimum image of a distance, branchless: the positions are wrapped into the
+   box by opencl_verlet_first, but the j atoms of MPI ghosts, restarts and the
+   first force may be any number of boxes away */
+inline FPTYPE pbc(FPTYPE x, const FPTYPE box, const FPTYPE boxinv)
+{
+    return x - box * rint( x * boxinv );
+}
+
+
+/* tabulated potential (built with -D_TABLE): the table is uniform in r^2 and
+   every interval holds the polynomial coefficients of the energy and of the
+   force factor f/r in the fractional position t (see pair_table.c) */
+#ifdef _TABLE_CUBIC
+#define TABLE_NCOEF 8
+#else
+#define TABLE_NCOEF 4
+#endif
+
+inline void pair_table(const FPTYPE rsq, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, FPTYPE *epair, FPTYPE *ffac)
+{
+  FPTYPE x = ( rsq - rminsq ) * dsinv;
+  int k = clamp( (int) x, 0, ntab - 1 );
+  FPTYPE t = clamp( x - k, ZERO, ONE );
+  __constant FPTYPE * c = table + k * TABLE_NCOEF;
+
+#ifdef _TABLE_CUBIC
+  *epair = c[0] + t * ( c[1] + t * ( c[2] + t * c[3] ) );
+  *ffac  = c[4] + t * ( c[5] + t * ( c[6] + t * c[7] ) );
+#else
+  *epair = c[0] + t * c[1];
+  *ffac  = c[2] + t * c[3];
+#endif
+}
+
+
+/* work counters of the force kernels, built with -D_COUNTERS: every work-item
+   adds its counts of a launch to cnt[(set*CN_NCOUNT+c)*nths+id_th], set 0 for
+   opencl_force and 1 for opencl_force_noepot, over the whole run (layout must
+   match counters.h) */
+#define CN_PAIRS  0   /* pairs whose distance is computed */
+#define CN_CUTOFF 1   /* pairs within the cutoff */
+#define CN_IMAGE  2   /* pairs moved by the minimum image */
+#define CN_IATOMS 3   /* i atoms */
+#define CN_NCOUNT 4
+
+#ifdef _COUNTERS
+#define COUNT(c,n) cn[c] += (n)
+#else
+#define COUNT(c,n)
+#endif
+
+inline void store_counters( __global ulong * cnt, const ulong * cn, const int eflag )
+{
+  int nths = get_global_size( 0 ), id_th = get_global_id( 0 ), c;
+
+  for( c = 0; c < CN_NCOUNT; c++ ) cnt[( ( eflag ? 0 : 1 ) * CN_NCOUNT + c ) * nths + id_th] += cn[c];
+}
+
+
+/* force computation shared by opencl_force, opencl_force_virial and
+   opencl_force_noepot. eflag is a literal in the callers: 1 for the sampled steps,
+   2 for the other steps of the barostat, that need the virial but must not add to
+   the g(r) of the samples, 0 for forces only, with the energy code compiled out.
+   the i atoms atom1 .. atom1+natoms1-1 of the chunk rx (global index ioff+k)
+   interact with the natoms j atoms of the chunk rxj (global index joff+j):
+   the forces are zeroed by the launch with the first j chunk, and the energy
+   partials are added to epot by every launch of a step but the first (eaccum).
+   built with -D_RDF=nbins the sampled steps also count the pair distances below
+   the cutoff in nbins bins of 1/rdfscale: every work-group fills a histogram in
+   local memory and adds it to rdf at the end of the launch.
+   the sampled steps add the virial sum r.f over the pairs to the partials
+   epot[nths+id_th], and work-item 0 leaves the box length of the force in
+   epot[2*nths], so that both travel with the energy. built with -D_BAROSTAT
+   the box length is the one of the barostat state */
+inline void force_body( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global ulong * cnt, const int eflag ){
+
+  int nths = get_global_size( 0 );
+  int id_th = get_global_id( 0 );
+  int loc_id;
+  FPTYPE epot_th = ZERO, vir_th = ZERO;
+#ifdef _BAROSTAT
+  const FPTYPE lbox = baro[BA_BOX], lboxinv = ONE / lbox;
+#else
+  const FPTYPE lbox = box, lboxinv = boxinv;
+#endif
+#ifdef _COUNTERS
+  ulong cn[CN_NCOUNT] = { 0, 0, 0, 0 };
+#endif
+
+  if( eflag && eaccum ) {
+    epot_th = epot[id_th];
+    vir_th = epot[nths+id_th];
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) ) lhist[loc_id] = 0;
+    barrier( CLK_LOCAL_MEM_FENCE );
+  }
+#endif
+
+  /* zero forces of the slice atom1 .. atom1+natoms1-1 computed by this device */
+  if( joff == 0 ) {
+    loc_id = id_th;
+    while( loc_id < natoms1 ){
+
+      fx[ loc_id+atom1 ] = ZERO;
+      fy[ loc_id+atom1 ] = ZERO;
+      fz[ loc_id+atom1 ] = ZERO;
+      loc_id += nths;
+    }
+  }
   
   loc_id = id_th;
   while( loc_id < natoms1  ) {
 
-    int j,k;
+    int j,k,self;
     FPTYPE rx1, ry1, rz1;
     k = loc_id+atom1;
+    self = k + ioff - joff;
     rx1 = rx[k];
     ry1 = ry[k];
     rz1 = rz[k];
+    COUNT( CN_IATOMS, 1 );
     
     for( j = 0; j < natoms; ++j ) {
 
       FPTYPE loc_rx, loc_ry, loc_rz, rsq;
       
       /* particles have no interactions with themselves */
-      if ( k == j) continue;
+      if ( self == j) continue;
       
       /* get distance between particle i and j */
-      loc_rx = pbc(rx1 - rx[j], boxby2, box);
-      loc_ry = pbc(ry1 - ry[j], boxby2, box);
-      loc_rz = pbc(rz1 - rz[j], boxby2, box);
+      loc_rx = pbc(rx1 - rxj[j], lbox, lboxinv);
+      loc_ry = pbc(ry1 - ryj[j], lbox, lboxinv);
+      loc_rz = pbc(rz1 - rzj[j], lbox, lboxinv);
       rsq = loc_rx * loc_rx + loc_ry * loc_ry + loc_rz * loc_rz;
+      COUNT( CN_PAIRS, 1 );
+      COUNT( CN_IMAGE, loc_rx != rx1 - rxj[j] || loc_ry != ry1 - ryj[j] || loc_rz != rz1 - rzj[j] );
+      COUNT( CN_CUTOFF, rsq < rcsq );
       
       /* compute force and energy if within cutoff */
       if (rsq < rcsq) {
-  	FPTYPE r6, rinv, ffac;
+  	FPTYPE ffac;
+#ifdef _TABLE
+  	FPTYPE epair;
+
+  	pair_table( rsq, table, rminsq, dsinv, ntab, &epair, &ffac );
+  	if( eflag ) epot_th += HALF * epair;
+#else
+  	FPTYPE r6, rinv;
 	
   	rinv = ONE / rsq;
   	r6 = rinv * rinv * rinv;
         
   	ffac = ( TWELVE * c12 * r6 - SIX * c6 ) * r6 * rinv;
-  	epot[id_th] += HALF * r6 * ( c12 * r6 - c6 );
+  	if( eflag ) epot_th += HALF * r6 * ( c12 * r6 - c6 );
+#endif
 	
-  	fx[loc_id] += loc_rx * ffac;
-  	fy[loc_id] += loc_ry * ffac;
-  	fz[loc_id] += loc_rz * ffac;
+  	fx[k] += loc_rx * ffac;
+  	fy[k] += loc_ry * ffac;
+  	fz[k] += loc_rz * ffac;
+  	if( eflag ) vir_th += HALF * rsq * ffac;
+#ifdef _RDF
+  	if( eflag == 1 ) atomic_inc( &lhist[ min( (int) ( sqrt( rsq ) * rdfscale ), _RDF - 1 ) ] );
+#endif
       }
     }
 
     loc_id += nths;
   }
 
+#ifdef _COUNTERS
+  store_counters( cnt, cn, eflag );
+#endif
+
+  /* one store per work-item, only when the energy is sampled */
+  if( eflag ) {
+    epot[id_th] = epot_th;
+    epot[nths+id_th] = vir_th;
+    if( id_th == 0 ) epot[2*nths] = lbox;
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    barrier( CLK_LOCAL_MEM_FENCE );
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) )
+      if( lhist[loc_id] ) atomic_add( &rdf[loc_id], lhist[loc_id] );
+  }
+#endif
 }
 
 
-__kernel void opencl_verlet_first( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const FPTYPE dt, const FPTYPE dtmf) {
+#ifdef _FIXED
+/* force_body with -D_FIXED: the pairs of two i atoms of the slice (same chunk,
+   ioff == joff) are computed once, by the work-item of the lower index, that adds
+   the force to its own atom and subtracts it from the other one with atom_add.
+   the pairs with the other j atoms (other chunks, other devices or ghosts) are
+   computed from both sides. every pair force is rounded to fixed point before it
+   is added, so that the sums of ax, ay and az do not depend on the order of the
+   additions, nor on the number of work-items. opencl_verlet_second turns them
+   into fx, fy and fz and clears them for the next force */
+inline void force_body_fixed( __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt, const int eflag ){
+
+  int nths = get_global_size( 0 );
+  int id_th = get_global_id( 0 );
+  int loc_id;
+  /* the j atoms that are also i atoms of this launch */
+  const int jn0 = ( ioff == joff ) ? atom1 : natoms;
+  const int jn1 = ( ioff == joff ) ? atom1 + natoms1 : natoms;
+  FPTYPE epot_th = ZERO, vir_th = ZERO;
+#ifdef _BAROSTAT
+  const FPTYPE lbox = baro[BA_BOX], lboxinv = ONE / lbox;
+#else
+  const FPTYPE lbox = box, lboxinv = boxinv;
+#endif
+#ifdef _COUNTERS
+  ulong cn[CN_NCOUNT] = { 0, 0, 0, 0 };
+#endif
+
+  if( eflag && eaccum ) {
+    epot_th = epot[id_th];
+    vir_th = epot[nths+id_th];
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) ) lhist[loc_id] = 0;
+    barrier( CLK_LOCAL_MEM_FENCE );
+  }
+#endif
+
+  loc_id = id_th;
+  while( loc_id < natoms1  ) {
+
+    int j,k,self,newton;
+    long sx = 0, sy = 0, sz = 0;
+    FPTYPE rx1, ry1, rz1;
+    k = loc_id+atom1;
+    self = k + ioff - joff;
+    rx1 = rx[k];
+    ry1 = ry[k];
+    rz1 = rz[k];
+    COUNT( CN_IATOMS, 1 );
+
+    for( j = 0; j < natoms; ++j ) {
+
+      FPTYPE loc_rx, loc_ry, loc_rz, rsq;
+
+      /* every pair of i atoms once, and no interactions with themselves */
+      newton = ( j >= jn0 && j < jn1 );
+      if ( ( newton && j <= k ) || self == j ) continue;
+
+      loc_rx = pbc(rx1 - rxj[j], lbox, lboxinv);
+      loc_ry = pbc(ry1 - ryj[j], lbox, lboxinv);
+      loc_rz = pbc(rz1 - rzj[j], lbox, lboxinv);
+      rsq = loc_rx * loc_rx + loc_ry * loc_ry + loc_rz * loc_rz;
+      COUNT( CN_PAIRS, 1 );
+      COUNT( CN_IMAGE, loc_rx != rx1 - rxj[j] || loc_ry != ry1 - ryj[j] || loc_rz != rz1 - rzj[j] );
+      COUNT( CN_CUTOFF, rsq < rcsq );
+
+      if (rsq < rcsq) {
+	FPTYPE ffac, epair, w = newton ? ONE : HALF;
+	long qx, qy, qz;
+#ifdef _TABLE
+	pair_table( rsq, table, rminsq, dsinv, ntab, &epair, &ffac );
+#else
+	FPTYPE r6, rinv;
+
+	rinv = ONE / rsq;
+	r6 = rinv * rinv * rinv;
+	ffac = ( TWELVE * c12 * r6 - SIX * c6 ) * r6 * rinv;
+	epair = r6 * ( c12 * r6 - c6 );
+#endif
+
+	/* rounded to nearest, the force on j is exactly the opposite one */
+	qx = (long) rint( loc_rx * ffac * FIXED_SCALE );
+	qy = (long) rint( loc_ry * ffac * FIXED_SCALE );
+	qz = (long) rint( loc_rz * ffac * FIXED_SCALE );
+	sx += qx;
+	sy += qy;
+	sz += qz;
+	if( newton ) {
+	  atom_add( &ax[j], -qx );
+	  atom_add( &ay[j], -qy );
+	  atom_add( &az[j], -qz );
+	}
+	if( eflag ) {
+	  epot_th += w * epair;
+	  vir_th += w * rsq * ffac;
+	}
+#ifdef _RDF
+	if( eflag == 1 ) atomic_add( &lhist[ min( (int) ( sqrt( rsq ) * rdfscale ), _RDF - 1 ) ], newton ? 2 : 1 );
+#endif
+      }
+    }
+
+    /* one addition per i atom, the other work-items add to it as well */
+    atom_add( &ax[k], sx );
+    atom_add( &ay[k], sy );
+    atom_add( &az[k], sz );
+    loc_id += nths;
+  }
+
+#ifdef _COUNTERS
+  store_counters( cnt, cn, eflag );
+#endif
+
+  if( eflag ) {
+    epot[id_th] = epot_th;
+    epot[nths+id_th] = vir_th;
+    if( id_th == 0 ) epot[2*nths] = lbox;
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    barrier( CLK_LOCAL_MEM_FENCE );
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) )
+      if( lhist[loc_id] ) atomic_add( &rdf[loc_id], lhist[loc_id] );
+  }
+#endif
+}
+
+
+/* fixed point sums of the first force to fx, fy and fz, before the first step */
+__kernel void opencl_fixed_forces( __global long * ax, __global long * ay, __global long * az, __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, const int natoms ) {
+
+  int nths = get_global_size( 0 );
+  int loc_id = get_global_id( 0 );
+
+  while( loc_id < natoms ) {
+    fx[loc_id] = FIXED_INV * (FPTYPE) ax[loc_id];
+    fy[loc_id] = FIXED_INV * (FPTYPE) ay[loc_id];
+    fz[loc_id] = FIXED_INV * (FPTYPE) az[loc_id];
+    ax[loc_id] = 0;
+    ay[loc_id] = 0;
+    az[loc_id] = 0;
+    loc_id += nths;
+  }
+}
+
+
+/* empty sums before the first force */
+__kernel void opencl_fixed_zero( __global long * ax, __global long * ay, __global long * az, const int natoms ) {
+
+  int nths = get_global_size( 0 );
+  int loc_id = get_global_id( 0 );
+
+  while( loc_id < natoms ) {
+    ax[loc_id] = 0;
+    ay[loc_id] = 0;
+    az[loc_id] = 0;
+    loc_id += nths;
+  }
+}
+#endif
+
+
+/* forces and potential energy partials, for the steps that are printed */
+__kernel void opencl_force( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+#ifdef _FIXED
+  force_body_fixed( rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, ax, ay, az, cnt, 1 );
+#else
+  force_body( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, cnt, 1 );
+#endif
+}
+
+
+/* energy and virial partials without the g(r) counts, for the steps of the
+   barostat that are not printed */
+#ifdef _BAROSTAT
+__kernel void opencl_force_virial( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+#ifdef _FIXED
+  force_body_fixed( rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, ax, ay, az, cnt, 2 );
+#else
+  force_body( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, cnt, 2 );
+#endif
+}
+#endif
+
+
+/* forces only, same arguments as opencl_force. epot is left untouched */
+__kernel void opencl_force_noepot( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+#ifdef _FIXED
+  force_body_fixed( rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, ax, ay, az, cnt, 0 );
+#else
+  force_body( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, table, rminsq, dsinv, ntab, rdf, lhist, rdfscale, baro, cnt, 0 );
+#endif
+}
+
+
+#if defined(_VECTOR) && !defined(_TABLE)
+/* CPU variant of the force, built with -D_VECTOR=8 or 16: every work-item takes
+   its i atoms against _VECTOR j atoms at a time, in the lanes of FPTYPE vectors.
+   the minimum image is the one of pbc() on whole vectors, and the cutoff and the
+   self pair are masked with select, so that the loop has no branch the CPU
+   compilers would have to vectorize. blocks of j atoms all beyond the cutoff are
+   skipped, the last natoms % _VECTOR j atoms and the g(r) counts go lane by
+   lane. same arguments and results as force_body, only the partial sums are
+   added in another order */
+#define VCAT(a,b) a##b
+#define VNAME(a,b) VCAT(a,b)
+#define FPTYPEV VNAME(FPTYPE,_VECTOR)
+#define VLOAD VNAME(vload,_VECTOR)
+#define VSTORE VNAME(vstore,_VECTOR)
+#ifdef _USE_FLOAT
+#define LANE int
+#else
+#define LANE long
+#endif
+#define MASKV VNAME(LANE,_VECTOR)
+
+__constant LANE vlanes[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+inline FPTYPE vsum( FPTYPEV v )
+{
+  FPTYPE t[_VECTOR], s = ZERO;
+  int m;
+
+  VSTORE( v, 0, t );
+  for( m = 0; m < _VECTOR; m++ ) s += t[m];
+  return s;
+}
+
+/* lanes set in a mask, that are -1 */
+inline int vcount( MASKV m )
+{
+  LANE t[_VECTOR];
+  int k, s = 0;
+
+  VSTORE( m, 0, t );
+  for( k = 0; k < _VECTOR; k++ ) s -= (int) t[k];
+  return s;
+}
+
+inline void force_body_vec( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global ulong * cnt, const int eflag ){
+
+  int nths = get_global_size( 0 );
+  int id_th = get_global_id( 0 );
+  int loc_id;
+  int nvec = natoms - natoms % _VECTOR;
+  FPTYPE epot_th = ZERO, vir_th = ZERO;
+  const MASKV lane = VLOAD( 0, vlanes );
+#ifdef _BAROSTAT
+  const FPTYPE lbox = baro[BA_BOX], lboxinv = ONE / lbox;
+#else
+  const FPTYPE lbox = box, lboxinv = boxinv;
+#endif
+#ifdef _COUNTERS
+  ulong cn[CN_NCOUNT] = { 0, 0, 0, 0 };
+#endif
+
+  if( eflag && eaccum ) {
+    epot_th = epot[id_th];
+    vir_th = epot[nths+id_th];
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) ) lhist[loc_id] = 0;
+    barrier( CLK_LOCAL_MEM_FENCE );
+  }
+#endif
+
+  if( joff == 0 ) {
+    loc_id = id_th;
+    while( loc_id < natoms1 ){
+
+      fx[ loc_id+atom1 ] = ZERO;
+      fy[ loc_id+atom1 ] = ZERO;
+      fz[ loc_id+atom1 ] = ZERO;
+      loc_id += nths;
+    }
+  }
+
+  loc_id = id_th;
+  while( loc_id < natoms1 ) {
+
+    int j, k = loc_id + atom1, self = k + ioff - joff;
+    FPTYPE rx1 = rx[k], ry1 = ry[k], rz1 = rz[k];
+    FPTYPE fxs = ZERO, fys = ZERO, fzs = ZERO;
+    FPTYPEV fxv = (FPTYPEV)( ZERO ), fyv = (FPTYPEV)( ZERO ), fzv = (FPTYPEV)( ZERO );
+    FPTYPEV ev = (FPTYPEV)( ZERO ), wv = (FPTYPEV)( ZERO );
+
+    COUNT( CN_IATOMS, 1 );
+    for( j = 0; j < nvec; j += _VECTOR ) {
+      FPTYPEV dx = rx1 - VLOAD( 0, rxj + j );
+      FPTYPEV dy = ry1 - VLOAD( 0, ryj + j );
+      FPTYPEV dz = rz1 - VLOAD( 0, rzj + j );
+      FPTYPEV rsq, rinv, r6, ffac;
+      MASKV in;
+
+      /* every lane is computed, the self pair included */
+      COUNT( CN_PAIRS, _VECTOR );
+      COUNT( CN_IMAGE, vcount( ( rint( dx * lboxinv ) != ZERO ) | ( rint( dy * lboxinv ) != ZERO ) | ( rint( dz * lboxinv ) != ZERO ) ) );
+      dx -= lbox * rint( dx * lboxinv );
+      dy -= lbox * rint( dy * lboxinv );
+      dz -= lbox * rint( dz * lboxinv );
+      rsq = dx * dx + dy * dy + dz * dz;
+      in = ( rsq < rcsq ) & ( lane + j != self );
+      COUNT( CN_CUTOFF, vcount( in ) );
+      if( !any( in ) ) continue;
+
+      /* the masked lanes, the self pair among them, divide by one */
+      rinv = ONE / select( (FPTYPEV)( ONE ), rsq, in );
+      r6 = rinv * rinv * rinv;
+      ffac = select( (FPTYPEV)( ZERO ), ( TWELVE * c12 * r6 - SIX * c6 ) * r6 * rinv, in );
+      fxv += dx * ffac;
+      fyv += dy * ffac;
+      fzv += dz * ffac;
+      if( eflag ) {
+        ev += select( (FPTYPEV)( ZERO ), HALF * r6 * ( c12 * r6 - c6 ), in );
+        wv += HALF * rsq * ffac;
+#ifdef _RDF
+        {
+          FPTYPE r2[_VECTOR];
+          int m;
+
+          VSTORE( select( (FPTYPEV)( rcsq ), rsq, in ), 0, r2 );
+          for( m = 0; m < _VECTOR && eflag == 1; m++ )
+            if( r2[m] < rcsq ) atomic_inc( &lhist[ min( (int) ( sqrt( r2[m] ) * rdfscale ), _RDF - 1 ) ] );
+        }
+#endif
+      }
+    }
+
+    for( ; j < natoms; ++j ) {
+      FPTYPE dx, dy, dz, rsq;
+
+      if( self == j ) continue;
+      dx = pbc( rx1 - rxj[j], lbox, lboxinv );
+      dy = pbc( ry1 - ryj[j], lbox, lboxinv );
+      dz = pbc( rz1 - rzj[j], lbox, lboxinv );
+      rsq = dx * dx + dy * dy + dz * dz;
+      COUNT( CN_PAIRS, 1 );
+      COUNT( CN_IMAGE, dx != rx1 - rxj[j] || dy != ry1 - ryj[j] || dz != rz1 - rzj[j] );
+      COUNT( CN_CUTOFF, rsq < rcsq );
+      if( rsq < rcsq ) {
+        FPTYPE rinv = ONE / rsq, r6 = rinv * rinv * rinv;
+        FPTYPE ffac = ( TWELVE * c12 * r6 - SIX * c6 ) * r6 * rinv;
+
+        fxs += dx * ffac;
+        fys += dy * ffac;
+        fzs += dz * ffac;
+        if( eflag ) {
+          epot_th += HALF * r6 * ( c12 * r6 - c6 );
+          vir_th += HALF * rsq * ffac;
+#ifdef _RDF
+          if( eflag == 1 ) atomic_inc( &lhist[ min( (int) ( sqrt( rsq ) * rdfscale ), _RDF - 1 ) ] );
+#endif
+        }
+      }
+    }
+
+    fx[k] += vsum( fxv ) + fxs;
+    fy[k] += vsum( fyv ) + fys;
+    fz[k] += vsum( fzv ) + fzs;
+    if( eflag ) {
+      epot_th += vsum( ev );
+      vir_th += vsum( wv );
+    }
+    loc_id += nths;
+  }
+
+#ifdef _COUNTERS
+  store_counters( cnt, cn, eflag );
+#endif
+
+  if( eflag ) {
+    epot[id_th] = epot_th;
+    epot[nths+id_th] = vir_th;
+    if( id_th == 0 ) epot[2*nths] = lbox;
+  }
+
+#ifdef _RDF
+  if( eflag == 1 ) {
+    barrier( CLK_LOCAL_MEM_FENCE );
+    for( loc_id = get_local_id( 0 ); loc_id < _RDF; loc_id += get_local_size( 0 ) )
+      if( lhist[loc_id] ) atomic_add( &rdf[loc_id], lhist[loc_id] );
+  }
+#endif
+}
+
+
+/* opencl_force, opencl_force_noepot and opencl_force_virial of the CPU devices */
+__kernel void opencl_force_vec( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+  force_body_vec( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, rdf, lhist, rdfscale, baro, cnt, 1 );
+}
+
+
+__kernel void opencl_force_noepot_vec( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+  force_body_vec( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, rdf, lhist, rdfscale, baro, cnt, 0 );
+}
+
+
+#ifdef _BAROSTAT
+__kernel void opencl_force_virial_vec( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * rxj, __global FPTYPE * ryj, __global FPTYPE * rzj, const int natoms, __global FPTYPE * epot, const FPTYPE c12, const FPTYPE c6, const FPTYPE rcsq, const FPTYPE boxinv, const FPTYPE box, const int atom1, const int natoms1, const int ioff, const int joff, const int eaccum, __constant FPTYPE * table, const FPTYPE rminsq, const FPTYPE dsinv, const int ntab, __global uint * rdf, __local uint * lhist, const FPTYPE rdfscale, __global FPTYPE * baro, __global long * ax, __global long * ay, __global long * az, __global ulong * cnt ){
+
+  force_body_vec( fx, fy, fz, rx, ry, rz, rxj, ryj, rzj, natoms, epot, c12, c6, rcsq, boxinv, box, atom1, natoms1, ioff, joff, eaccum, rdf, lhist, rdfscale, baro, cnt, 2 );
+}
+#endif
+#endif
+
+
+/* wraps a coordinate into the box [0,box) and counts the boxes it was moved by,
+   so that r + box*image is the unwrapped coordinate */
+inline void wrap( __global FPTYPE * r, __global int * image, const FPTYPE box, const FPTYPE boxinv )
+{
+  FPTYPE n = floor( *r * boxinv );
+
+  *r -= box * n;
+  *image += (int) n;
+}
+
+
+/* the positions leave the kernel wrapped into the box, with their image
+   counters ix, iy and iz updated. the step counter tstate[0] of the random
+   numbers advances in the kernel of a step that does not read it: here for
+   langevin, that draws in opencl_verlet_second, and in opencl_verlet_second
+   for vrescale, that draws here. atom0 tells the first chunk, that advances it */
+__kernel void opencl_verlet_first( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * rx, __global FPTYPE * ry, __global FPTYPE * rz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const FPTYPE dt, const FPTYPE dtmf, __global FPTYPE * thermo, __global FPTYPE * baro, const FPTYPE box, __global int * ix, __global int * iy, __global int * iz, __global FPTYPE * ekin, __global uint * tstate, const int atom0) {
 
   int nths = get_global_size( 0 );
   int id_th = get_global_id( 0 );
   int loc_id = id_th;
 
+  /* the weak coupling thermostats scale the velocities of the previous step here */
+#if _THERMOSTAT == BERENDSEN || _THERMOSTAT == VRESCALE
+  const FPTYPE lambda = coupling_factor( ekin, nths, thermo, tstate );
+#else
+  const FPTYPE lambda = ONE;
+#endif
+#ifdef _BAROSTAT
+  /* and the barostat the positions, to the box it has already scaled */
+  const FPTYPE mu = baro[BA_MU];
+  const FPTYPE lbox = baro[BA_BOX];
+#else
+  const FPTYPE lbox = box;
+#endif
+  const FPTYPE lboxinv = ONE / lbox;
+
   /* first part: propagate velocities by half and positions by full step */
   while( loc_id < natoms ){
   
-    vx[loc_id] += dtmf * fx[loc_id];
-    vy[loc_id] += dtmf * fy[loc_id];
-    vz[loc_id] += dtmf * fz[loc_id];
+    vx[loc_id] = lambda * vx[loc_id] + dtmf * fx[loc_id];
+    vy[loc_id] = lambda * vy[loc_id] + dtmf * fy[loc_id];
+    vz[loc_id] = lambda * vz[loc_id] + dtmf * fz[loc_id];
+#ifdef _BAROSTAT
+    rx[loc_id] = mu * rx[loc_id] + dt*vx[loc_id];
+    ry[loc_id] = mu * ry[loc_id] + dt*vy[loc_id];
+    rz[loc_id] = mu * rz[loc_id] + dt*vz[loc_id];
+#else
     rx[loc_id] += dt*vx[loc_id];
     ry[loc_id] += dt*vy[loc_id];
     rz[loc_id] += dt*vz[loc_id];
+#endif
+    wrap( rx + loc_id, ix + loc_id, lbox, lboxinv );
+    wrap( ry + loc_id, iy + loc_id, lbox, lboxinv );
+    wrap( rz + loc_id, iz + loc_id, lbox, lboxinv );
   
     loc_id += nths;
   }
+
+#if _THERMOSTAT == LANGEVIN
+  if( atom0 == 0 && id_th == 0 ) tstate[0]++;
+#endif
 }
 
 
-__kernel void opencl_verlet_second( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const FPTYPE dt, const FPTYPE dtmf) {
+/* atom0 is the global index of the first atom of the chunk: it numbers the
+   random streams and tells the first chunk, that overwrites the partials.
+   ax, ay and az are only read when built with -D_FIXED */
+__kernel void opencl_verlet_second( __global FPTYPE * fx, __global FPTYPE * fy, __global FPTYPE * fz, __global FPTYPE * vx, __global FPTYPE * vy, __global FPTYPE * vz, const int natoms, const FPTYPE dt, const FPTYPE dtmf, __global FPTYPE * ekin, __global FPTYPE * thermo, __global uint * tstate, const int atom0, __global long * ax, __global long * ay, __global long * az) {
 
   int nths = get_global_size( 0 );
   int id_th = get_global_id( 0 );
   int loc_id = id_th;
 
+#if _THERMOSTAT == BERENDSEN || _THERMOSTAT == VRESCALE
+  FPTYPE sumv2 = atom0 ? ekin[id_th] : ZERO;
+#elif _THERMOSTAT == LANGEVIN
+  const FPTYPE c1 = thermo[TH_DECAY];
+  const FPTYPE c2 = thermo[TH_NOISE];
+  const uint step = tstate[0];
+  const uint key = tstate[1];
+  FPTYPE g0, g1, g2, g3;
+#endif
+
   /* second part: propagate velocities by another half step */
   while( loc_id < natoms ){
 
+#ifdef _FIXED
+    /* the fixed point sums of the force become the forces of this and of the next
+       verlet_first, and are cleared for the next force */
+    fx[loc_id] = FIXED_INV * (FPTYPE) ax[loc_id];
+    fy[loc_id] = FIXED_INV * (FPTYPE) ay[loc_id];
+    fz[loc_id] = FIXED_INV * (FPTYPE) az[loc_id];
+    ax[loc_id] = 0;
+    ay[loc_id] = 0;
+    az[loc_id] = 0;
+#endif
     vx[loc_id] += dtmf * fx[loc_id];
     vy[loc_id] += dtmf * fy[loc_id];
     vz[loc_id] += dtmf * fz[loc_id];
+
+#if _THERMOSTAT == BERENDSEN || _THERMOSTAT == VRESCALE
+    /* kinetic energy partials for the next opencl_verlet_first */
+    sumv2 += vx[loc_id] * vx[loc_id] + vy[loc_id] * vy[loc_id] + vz[loc_id] * vz[loc_id];
+#elif _THERMOSTAT == LANGEVIN
+    /* exact Ornstein-Uhlenbeck step for the friction and random force */
+    gauss2( loc_id + atom0, 2 * step, key, &g0, &g1 );
+    gauss2( loc_id + atom0, 2 * step + 1, key, &g2, &g3 );
+    vx[loc_id] = c1 * vx[loc_id] + c2 * g0;
+    vy[loc_id] = c1 * vy[loc_id] + c2 * g1;
+    vz[loc_id] = c1 * vz[loc_id] + c2 * g2;
+#endif
     
     loc_id += nths;
   }
+
+#if _THERMOSTAT == BERENDSEN || _THERMOSTAT == VRESCALE
+  ekin[id_th] = sumv2;
+#endif
+#if _THERMOSTAT == VRESCALE
+  if( atom0 == 0 && id_th == 0 ) tstate[0]++;
+#endif
 }
 
 
@@ -0,0 +1,294 @@
+/** Tabulated pair potentials.
+
+  The table is uniform in r^2, so the force kernels need no square root
+  to find the interval. Every interval stores the coefficients of a
+  linear or cubic (Hermite) polynomial in the fractional position t
+  for the energy and for the force factor f/r.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "pair_table.h"
+
+/** source of the tabulated values: analytic 12-6 LJ or data read from a file */
+struct _table_source {
+    double c12, c6;
+    int nfile;
+    double *r, *e, *f;
+    double rcsq, ronsq;
+    int modifier;
+    double eshift;
+};
+
+/** raw energy and force factor (f/r) at distance^2 s */
+static void raw_pair(const struct _table_source *src, double s, double *e, double *ffac)
+{
+    if (src->nfile) {
+        double r = sqrt(s), t;
+        int lo = 0, hi = src->nfile - 1, mid;
+
+        if (r <= src->r[0]) { *e = src->e[0]; *ffac = src->f[0] / r; return; }
+        if (r >= src->r[hi]) { *e = src->e[hi]; *ffac = src->f[hi] / r; return; }
+        while (hi - lo > 1) {
+            mid = (lo + hi) / 2;
+            if (src->r[mid] > r) hi = mid;
+            else lo = mid;
+        }
+        t = (r - src->r[lo]) / (src->r[hi] - src->r[lo]);
+        *e = src->e[lo] + t * (src->e[hi] - src->e[lo]);
+        *ffac = (src->f[lo] + t * (src->f[hi] - src->f[lo])) / r;
+    } else {
+        double r2inv = 1.0 / s;
+        double r6 = r2inv * r2inv * r2inv;
+
+        *e = r6 * (src->c12 * r6 - src->c6);
+        *ffac = (12.0 * src->c12 * r6 - 6.0 * src->c6) * r6 * r2inv;
+    }
+}
+
+/** energy and force factor with the cutoff modifier applied */
+static void pair(const struct _table_source *src, double s, double *e, double *ffac)
+{
+    raw_pair(src, s, e, ffac);
+
+    if (src->modifier == TABLE_SHIFT) {
+        *e -= src->eshift;
+    } else if (src->modifier == TABLE_SWITCH && s > src->ronsq) {
+        /* CHARMM switching function in r^2 and its derivative */
+        double a = src->rcsq, b = src->ronsq, d = (a - b) * (a - b) * (a - b);
+        double sw = 0.0, dsw = 0.0;
+
+        if (s < a) {
+            sw = (a - s) * (a - s) * (a + 2.0 * s - 3.0 * b) / d;
+            dsw = 6.0 * (a - s) * (b - s) / d;
+        }
+        /* f/r = -2 dE/d(r^2) */
+        *ffac = *ffac * sw - 2.0 * *e * dsw;
+        *e *= sw;
+    }
+}
+
+static void free_table_source(struct _table_source *src)
+{
+    free(src->r);
+    free(src->e);
+    free(src->f);
+    src->r = src->e = src->f = NULL;
+}
+
+/** grows one column of the file to nmax entries, keeps it on failure */
+static int grow_column(double **col, int nmax)
+{
+    double *p = (double *) realloc(*col, nmax * sizeof(double));
+
+    if (!p) return -1;
+    *col = p;
+    return 0;
+}
+
+/** reads "r energy force" lines; comments start with #. on error nothing
+    stays allocated */
+static int read_table_file(struct _table_source *src, const char *file)
+{
+    FILE *fp;
+    char line[BLEN], *ptr;
+    double r, e, f;
+    int n = 0, nmax = 1024;
+
+    fp = fopen(file, "r");
+    if (!fp) {
+        perror("cannot read pair table file");
+        return -1;
+    }
+    src->r = (double *) malloc(nmax * sizeof(double));
+    src->e = (double *) malloc(nmax * sizeof(double));
+    src->f = (double *) malloc(nmax * sizeof(double));
+    if (!src->r || !src->e || !src->f) {
+        fprintf(stderr, "cannot allocate the pair table file %s\n", file);
+        fclose(fp);
+        free_table_source(src);
+        return -1;
+    }
+
+    while (fgets(line, BLEN, fp)) {
+        ptr = strchr(line, '#');
+        if (ptr) *ptr = '\0';
+        if (sscanf(line, "%lf %lf %lf", &r, &e, &f) != 3) continue;
+        if (n > 0 && r <= src->r[n-1]) {
+            fprintf(stderr, "pair table file %s: distances must increase (r = %g)\n", file, r);
+            fclose(fp);
+            free_table_source(src);
+            return -1;
+        }
+        if (n == nmax) {
+            nmax *= 2;
+            if (grow_column(&src->r, nmax) || grow_column(&src->e, nmax) || grow_column(&src->f, nmax)) {
+                fprintf(stderr, "cannot allocate %d lines of the pair table file %s\n", nmax, file);
+                fclose(fp);
+                free_table_source(src);
+                return -1;
+            }
+        }
+        src->r[n] = r;
+        src->e[n] = e;
+        src->f[n] = f;
+        ++n;
+    }
+    fclose(fp);
+
+    if (n < 2) {
+        fprintf(stderr, "pair table file %s: need at least two \"r energy force\" lines\n", file);
+        free_table_source(src);
+        return -1;
+    }
+    src->nfile = n;
+    return 0;
+}
+
+int ReadPairTableOption( const char * line, pair_table_t * tab ) {
+
+    char interp[BLEN], word[BLEN];
+    const char *ptr;
+    int n;
+
+    tab->modifier = TABLE_TRUNCATE;
+    tab->file[0] = '\0';
+
+    if (sscanf(line, "%*s %*s %d %s%n", &tab->npoints, interp, &n) != 2 || tab->npoints < 2) {
+        fprintf(stderr, "usage: potential table <npoints> linear|cubic [shift|switch <r_on>] [rmin <r>] [file <name>]\n");
+        return -1;
+    }
+    if (!strcmp(interp, "cubic")) tab->cubic = 1;
+    else if (!strcmp(interp, "linear")) tab->cubic = 0;
+    else {
+        fprintf(stderr, "unknown table interpolation: %s\n", interp);
+        return -1;
+    }
+
+    ptr = line + n;
+    while (sscanf(ptr, "%s%n", word, &n) == 1) {
+        ptr += n;
+        if (!strcmp(word, "shift")) {
+            tab->modifier = TABLE_SHIFT;
+        } else if (!strcmp(word, "switch") || !strcmp(word, "rmin") || !strcmp(word, "file")) {
+            char arg[BLEN];
+
+            if (sscanf(ptr, "%s%n", arg, &n) != 1) {
+                fprintf(stderr, "potential table: missing value after %s\n", word);
+                return -1;
+            }
+            ptr += n;
+            if (!strcmp(word, "switch")) {
+                tab->modifier = TABLE_SWITCH;
+                tab->ron = atof(arg);
+            } else if (!strcmp(word, "rmin")) {
+                tab->rmin = atof(arg);
+            } else {
+                strcpy(tab->file, arg);
+            }
+        } else {
+            fprintf(stderr, "potential table: unknown option %s\n", word);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int BuildPairTable( pair_table_t * tab, const mdsys_t * sys ) {
+
+    struct _table_source src;
+    int k, ncoef = tab->cubic ? TABLE_NCOEF_CUBIC : TABLE_NCOEF_LINEAR;
+    double smin, smax, h, de;
+
+    memset(&src, 0, sizeof(src));
+    src.c12 = 4.0 * sys->epsilon * pow(sys->sigma, 12.0);
+    src.c6  = 4.0 * sys->epsilon * pow(sys->sigma, 6.0);
+    src.rcsq = sys->rcut * sys->rcut;
+    src.ronsq = tab->ron * tab->ron;
+
+    if (tab->rmin <= ZERO) tab->rmin = HALF * sys->sigma;
+    if (tab->file[0]) {
+        if (read_table_file(&src, tab->file)) return -1;
+        if (tab->rmin < src.r[0]) tab->rmin = src.r[0];
+        if (src.r[src.nfile-1] < sys->rcut) {
+            fprintf(stderr, "pair table file %s ends at r = %g before the cutoff %g\n",
+                    tab->file, src.r[src.nfile-1], sys->rcut);
+            free_table_source(&src);
+            return -1;
+        }
+    }
+    if (tab->rmin >= sys->rcut || (tab->modifier == TABLE_SWITCH && (tab->ron < tab->rmin || tab->ron >= sys->rcut))) {
+        fprintf(stderr, "pair table: need rmin < r_on < rcut\n");
+        free_table_source(&src);
+        return -1;
+    }
+
+    /* the shift is taken from the unmodified potential at the cutoff */
+    if (tab->modifier == TABLE_SHIFT) raw_pair(&src, src.rcsq, &src.eshift, &de);
+    src.modifier = tab->modifier;
+
+    smin = tab->rmin * tab->rmin;
+    smax = src.rcsq;
+    h = (smax - smin) / tab->npoints;
+    tab->rminsq = smin;
+    tab->dsinv = 1.0 / h;
+
+    tab->coef = (FPTYPE *) malloc(PairTableSize(tab));
+    if (!tab->coef) {
+        fprintf(stderr, "cannot allocate the pair table\n");
+        free_table_source(&src);
+        return -1;
+    }
+
+    for (k = 0; k < tab->npoints; ++k) {
+        double s0 = smin + k * h, s1 = s0 + h;
+        double e0, e1, f0, f1;
+        FPTYPE *c = tab->coef + k * ncoef;
+
+        pair(&src, s0, &e0, &f0);
+        pair(&src, s1, &e1, &f1);
+
+        if (tab->cubic) {
+            /* Hermite polynomials in t = (s - s0)/h, slopes from central differences */
+            double me[2], mf[2], el, eh, fl, fh, lo, hi;
+            int i;
+
+            for (i = 0; i < 2; ++i) {
+                lo = (i ? s1 : s0) - 1.0e-3 * h;
+                hi = (i ? s1 : s0) + 1.0e-3 * h;
+                if (lo < smin) lo = smin;
+                if (hi > smax) hi = smax;
+                pair(&src, lo, &el, &fl);
+                pair(&src, hi, &eh, &fh);
+                me[i] = h * (eh - el) / (hi - lo);
+                mf[i] = h * (fh - fl) / (hi - lo);
+            }
+            c[0] = e0;
+            c[1] = me[0];
+            c[2] = 3.0 * (e1 - e0) - 2.0 * me[0] - me[1];
+            c[3] = 2.0 * (e0 - e1) + me[0] + me[1];
+            c[4] = f0;
+            c[5] = mf[0];
+            c[6] = 3.0 * (f1 - f0) - 2.0 * mf[0] - mf[1];
+            c[7] = 2.0 * (f0 - f1) + mf[0] + mf[1];
+        } else {
+            c[0] = e0;
+            c[1] = e1 - e0;
+            c[2] = f0;
+            c[3] = f1 - f0;
+        }
+    }
+
+    free_table_source(&src);
+    return 0;
+}
+
+size_t PairTableSize( const pair_table_t * tab ) {
+    return (size_t) tab->npoints * (tab->cubic ? TABLE_NCOEF_CUBIC : TABLE_NCOEF_LINEAR) * sizeof(FPTYPE);
+}
+
+void FreePairTable( pair_table_t * tab ) {
+    free(tab->coef);
+    tab->coef = NULL;
+}
@@ -0,0 +1,102 @@
+/** Host phase timers.
+
+  A lap costs a time stamp read and a few additions: the histogram bin
+  is the position of the highest bit of the ticks and the three bits
+  below it. The ticks of the time stamp counter are converted with the
+  ratio of the monotonic clock to the counter over the whole run, so
+  no frequency has to be known. The percentiles are the middle of their
+  bin, within the exact min and max, i.e. within 1/16 of the value.
+ */
+
+#include <string.h>
+
+#include "phases.h"
+
+static double monotonic_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+/* lower bound and width of bin b in ticks */
+static void bin_range( int b, double * lo, double * width )
+{
+    int e;
+
+    if (b < 2 * PHASE_SUB) {
+        *lo = b;
+        *width = 1.0;
+        return;
+    }
+    e = ( b - 2 * PHASE_SUB ) / PHASE_SUB + 4;
+    *width = (double) ( 1ULL << ( e - 3 ) );
+    *lo = ( PHASE_SUB + ( b - 2 * PHASE_SUB ) % PHASE_SUB ) * *width;
+}
+
+/* the tick value below which a fraction q of the laps of ph fall */
+static double percentile( const phase_t * ph, double q )
+{
+    uint64_t rank = (uint64_t) ( q * ph->count + 0.5 ), seen = 0;
+    double lo, width, v;
+    int b;
+
+    if (rank < 1) rank = 1;
+    for (b = 0; b < PHASE_BINS; ++b) {
+        seen += ph->hist[b];
+        if (seen >= rank) break;
+    }
+    bin_range( b, &lo, &width );
+    v = lo + 0.5 * width;
+    if (v < ph->min) v = ph->min;
+    if (v > ph->max) v = ph->max;
+    return v;
+}
+
+void InitPhases( phases_t * p, int nphases, const char ** names )
+{
+    int i;
+
+    memset( p, 0, sizeof(phases_t) );
+    p->nphases = nphases < PHASE_MAX ? nphases : PHASE_MAX;
+    for (i = 0; i < p->nphases; ++i) {
+        p->phase[i].name = names[i];
+        p->phase[i].min = UINT64_MAX;
+    }
+}
+
+void PhaseStart( phases_t * p )
+{
+    p->ns0 = monotonic_ns();
+    p->tick0 = p->last = PhaseTicks();
+}
+
+void PrintPhases( const phases_t * p, FILE * out )
+{
+    double ns = monotonic_ns() - p->ns0, us;
+    uint64_t ticks = PhaseTicks() - p->tick0, all = 0;
+    int i;
+
+    for (i = 0; i < p->nphases; ++i) all += p->phase[i].sum;
+    if (!ticks || !all) return;
+    /* microseconds per tick */
+    us = 1e-3 * ns / ticks;
+    fprintf( out, "Host phases of the MD loop (%s, %.4g ns per tick):\n",
+#if defined(__x86_64__) || defined(__i386__)
+             "time stamp counter",
+#else
+             "CLOCK_MONOTONIC",
+#endif
+             1e3 * us );
+    fprintf( out, "%-14s %10s %10s %6s %10s %10s %10s %10s %10s\n", "phase", "count", "total s", "%", "min us",
+             "mean us", "p50 us", "p99 us", "max us" );
+    for (i = 0; i < p->nphases; ++i) {
+        const phase_t * ph = p->phase + i;
+
+        if (!ph->count) continue;
+        fprintf( out, "%-14s %10llu %10.4g %6.2f %10.3f %10.3f %10.3f %10.3f %10.3f\n", ph->name,
+                 (unsigned long long) ph->count, 1e-6 * us * ph->sum, 100.0 * ph->sum / all, us * ph->min,
+                 us * ph->sum / ph->count, us * percentile( ph, 0.5 ), us * percentile( ph, 0.99 ), us * ph->max );
+    }
+}
@@ -0,0 +1,296 @@
+/** Text restart files.
+
+  The scanf parser is the plain stdio path. The mmap parser maps the
+  file, cuts it in one line aligned range per thread to count the lines
+  and index every RESTART_BLOCK-th one, then parses the blocks of lines
+  in parallel. Its number parser does not depend on the locale: the
+  decimal digits are read into an integer of up to 19 significant
+  digits and scaled by an exact power of ten in long double. Only the
+  values that fall too close to the middle of two FPTYPE numbers for
+  this rounding are parsed again by strtod in the C locale, so the
+  values are the ones fscanf reads. Parsed pages are given back to the
+  kernel, large restarts are not kept resident.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <locale.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "restart.h"
+
+#ifdef _USE_FLOAT
+#define FPTYPE_MANT_DIG FLT_MANT_DIG
+#define strtofp_l strtof_l
+#else
+#define FPTYPE_MANT_DIG DBL_MANT_DIG
+#define strtofp_l strtod_l
+#endif
+
+/* the C locale of the correctly rounded fallback */
+static locale_t c_locale;
+
+static int is_space( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* end of the line starting at p, the newline excluded */
+static const char * line_end( const char * p, const char * end )
+{
+    const char * q = memchr( p, '\n', end - p );
+
+    return q ? q : end;
+}
+
+/* lines of white space only are not counted */
+static int is_blank( const char * p, const char * e )
+{
+    for ( ; p < e; ++p )
+        if ( !is_space( *p ) ) return 0;
+    return 1;
+}
+
+static long double power_of_ten( int e )
+{
+    static const long double exact[] = {
+        1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L,
+        1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+    };
+
+    return ( e < 28 ) ? exact[e] : powl( 10.0L, e );
+}
+
+/* [+-]digits[.digits][(e|E)[+-]digits] up to the next white space.
+   returns the end of the number, NULL if there is none */
+static const char * parse_number( const char * s, const char * end, FPTYPE * val )
+{
+    const char * start = s;
+    uint64_t m = 0;
+    int digits = 0, exp10 = 0, any = 0, neg = 0, ex;
+    long double v, ulp;
+
+    if ( s < end && ( *s == '+' || *s == '-' ) ) neg = ( *s++ == '-' );
+    for ( ; s < end && *s >= '0' && *s <= '9'; ++s, any = 1 ) {
+        if ( digits < 19 ) {
+            m = m * 10 + ( *s - '0' );
+            if ( m ) digits++;
+        } else
+            exp10++;
+    }
+    if ( s < end && *s == '.' )
+        for ( ++s; s < end && *s >= '0' && *s <= '9'; ++s, any = 1 ) {
+            if ( digits < 19 ) {
+                m = m * 10 + ( *s - '0' );
+                if ( m ) digits++;
+                exp10--;
+            }
+        }
+    if ( !any ) return NULL;
+    if ( s + 1 < end && ( *s == 'e' || *s == 'E' ) ) {
+        const char * t = s + 1;
+        int e = 0, eneg = 0;
+
+        if ( *t == '+' || *t == '-' ) eneg = ( *t++ == '-' );
+        if ( t < end && *t >= '0' && *t <= '9' ) {
+            for ( ; t < end && *t >= '0' && *t <= '9'; ++t )
+                if ( e < 100000 ) e = e * 10 + ( *t - '0' );
+            exp10 += eneg ? -e : e;
+            s = t;
+        }
+    }
+    if ( s < end && !is_space( *s ) ) return NULL;
+
+    v = m;
+    if ( m ) v = ( exp10 < 0 ) ? v / power_of_ten( -exp10 ) : v * power_of_ten( exp10 );
+    *val = neg ? -v : v;
+
+    /* a value within 2^-9 ulp of a tie may round the other way */
+    frexpl( v, &ex );
+    ulp = ldexpl( 1.0L, ex - FPTYPE_MANT_DIG );
+    if ( m && fabsl( fabsl( v - (FPTYPE) v ) - 0.5L * ulp ) <= ulp / 512 ) {
+        char buf[64];
+        size_t len = s - start;
+
+        if ( len >= sizeof(buf) ) len = sizeof(buf) - 1;
+        memcpy( buf, start, len );
+        buf[len] = 0;
+        *val = strtofp_l( buf, NULL, c_locale );
+    }
+    return s;
+}
+
+/* three numbers of the line p .. e */
+static int parse_line( const char * p, const char * e, FPTYPE * x, FPTYPE * y, FPTYPE * z )
+{
+    FPTYPE * v[3] = { x, y, z };
+    int k;
+
+    for ( k = 0; k < 3; ++k ) {
+        while ( p < e && is_space( *p ) ) ++p;
+        if ( !( p = parse_number( p, e, v[k] ) ) ) return -1;
+    }
+    return 0;
+}
+
+static int open_mapped( restart_t * rst, const char * file )
+{
+    struct stat st;
+    const char * text, * end;
+    long * count, nlines;
+    int fd, t, nthreads = 1;
+    size_t nblocks;
+
+    fd = open( file, O_RDONLY );
+    if ( fd < 0 || fstat( fd, &st ) ) {
+        perror( "cannot read restart file" );
+        return -1;
+    }
+    rst->size = st.st_size;
+    rst->text = ( rst->size > 0 ) ? mmap( NULL, rst->size, PROT_READ, MAP_PRIVATE, fd, 0 ) : NULL;
+    close( fd );
+    if ( rst->text == MAP_FAILED ) {
+        rst->text = NULL;
+        perror( "cannot map restart file" );
+        return -1;
+    }
+    madvise( rst->text, rst->size, MADV_SEQUENTIAL );
+    text = rst->text;
+    end = text + rst->size;
+
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    count = (long *) calloc( nthreads + 1, sizeof(long) );
+    nblocks = ( 2 * (size_t) rst->natoms + RESTART_BLOCK - 1 ) / RESTART_BLOCK;
+    rst->block = (size_t *) malloc( ( nblocks + 1 ) * sizeof(size_t) );
+
+    /* thread t owns the lines that start in its byte range. first pass counts
+       them, the second one stores the offsets of the indexed lines */
+#pragma omp parallel num_threads(nthreads) private(t)
+    {
+        const char * p, * lo, * hi, * e;
+        long line;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#else
+        t = 0;
+#endif
+        lo = text + rst->size * t / nthreads;
+        hi = text + rst->size * ( t + 1 ) / nthreads;
+        if ( t > 0 && lo[-1] != '\n' ) lo = line_end( lo, end ) + 1;
+
+        for ( p = lo, line = 0; p < hi; p = e + 1 ) {
+            e = line_end( p, end );
+            if ( !is_blank( p, e ) ) line++;
+        }
+        count[t+1] = line;
+
+#pragma omp barrier
+#pragma omp single
+        for ( line = 0; line < nthreads; ++line ) count[line+1] += count[line];
+
+        for ( p = lo, line = count[t]; p < hi && line < 2 * (long) rst->natoms; p = e + 1 ) {
+            e = line_end( p, end );
+            if ( is_blank( p, e ) ) continue;
+            if ( line % RESTART_BLOCK == 0 ) rst->block[line/RESTART_BLOCK] = p - text;
+            line++;
+        }
+    }
+    nlines = count[nthreads];
+    free( count );
+    rst->block[nblocks] = rst->size;
+
+    if ( nlines != 2 * (long) rst->natoms ) {
+        fprintf( stderr, "restart file %s has %ld lines, %d atoms need %ld\n", file, nlines, rst->natoms,
+                 2 * (long) rst->natoms );
+        return -1;
+    }
+    return 0;
+}
+
+int OpenRestart( restart_t * rst, const char * file, int natoms, int parser )
+{
+    double t0 = second();
+    int err = 0;
+
+    if ( !c_locale ) c_locale = newlocale( LC_ALL_MASK, "C", (locale_t) 0 );
+    memset( rst, 0, sizeof(restart_t) );
+    rst->natoms = natoms;
+    rst->parser = parser;
+    if ( parser == RESTART_MMAP )
+        err = open_mapped( rst, file );
+    else if ( !( rst->fp = fopen( file, "r" ) ) ) {
+        perror( "cannot read restart file" );
+        err = -1;
+    }
+    rst->seconds += second() - t0;
+    return err;
+}
+
+int ReadRestart( restart_t * rst, int first, int n, FPTYPE * x, FPTYPE * y, FPTYPE * z )
+{
+    double t0 = second();
+    int b, err = 0;
+
+    if ( n <= 0 ) return 0;
+    if ( rst->parser == RESTART_SCANF ) {
+        int i;
+
+        if ( first != rst->next ) return -1;
+        for ( i = 0; i < n && !err; ++i ) {
+#ifdef _USE_FLOAT
+            if ( fscanf( rst->fp, "%f%f%f", x+i, y+i, z+i ) != 3 ) err = -1;
+#else
+            if ( fscanf( rst->fp, "%lf%lf%lf", x+i, y+i, z+i ) != 3 ) err = -1;
+#endif
+        }
+        rst->next += n;
+    } else {
+        const char * end = rst->text + rst->size;
+        int b0 = first / RESTART_BLOCK, b1 = ( first + n - 1 ) / RESTART_BLOCK;
+        size_t page = sysconf( _SC_PAGESIZE ), lo, hi;
+
+#pragma omp parallel for schedule(dynamic,4) reduction(|:err)
+        for ( b = b0; b <= b1; ++b ) {
+            const char * p = rst->text + rst->block[b], * e;
+            int line = b * RESTART_BLOCK, stop = ( b + 1 ) * RESTART_BLOCK;
+
+            if ( stop > first + n ) stop = first + n;
+            for ( ; line < stop && p < end && !err; p = e + 1 ) {
+                e = line_end( p, end );
+                if ( is_blank( p, e ) ) continue;
+                if ( line >= first && parse_line( p, e, x + line - first, y + line - first, z + line - first ) ) err = -1;
+                line++;
+            }
+        }
+
+        /* the lines before the last block are not read again */
+        lo = rst->block[b0] / page * page;
+        hi = rst->block[b1] / page * page;
+        if ( hi > lo ) madvise( rst->text + lo, hi - lo, MADV_DONTNEED );
+    }
+    rst->seconds += second() - t0;
+    return err;
+}
+
+void CloseRestart( restart_t * rst )
+{
+    if ( rst->fp ) fclose( rst->fp );
+    if ( rst->text ) munmap( rst->text, rst->size );
+    free( rst->block );
+    rst->fp = NULL;
+    rst->text = NULL;
+    rst->block = NULL;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+#utility to bench the cost of the virial and of the barostat over plain NVE steps
+#the executable ljmd-cl (built with -D__PROFILING) must be in the current directory, test/
+#nve: energy, virial and pressure on the print steps only
+#virial: print every step, i.e. the energy and virial force kernel and its download on every step
+#barostat: energy and virial force kernel, kinetic energy and barostat kernels on every step
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+cp $infile bench-nve.inp
+sed '12s/.*/1/' $infile > bench-virial.inp
+(cat $infile; echo "barostat berendsen 1.0 1000.0") > bench-barostat.inp
+for run in nve virial barostat
+do
+    ./ljmd-cl $device $threads < bench-$run.inp > bench-$run.out
+    echo "$run: $(grep 'MD loop' bench-$run.out)" >> $benchfile
+done
+rm -f bench-nve.inp bench-virial.inp bench-barostat.inp bench-nve.out bench-virial.out bench-barostat.out
+cat $benchfile
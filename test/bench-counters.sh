@@ -0,0 +1,22 @@
+#!/bin/bash
+
+#utility to bench the work of the force kernels: the pairs, flops, bytes and achieved rates
+#of the generic, vector and fixed point kernels, and the cost of the counters on the MD loop
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+echo "no counters: $(./ljmd-cl $device $threads < $infile | grep 'MD loop')" >> $benchfile
+for opt in "vector off" "vector auto" "accumulate fixed"
+do
+    ( cat $infile; echo "$opt"; echo "counters" ) > bench-counters.inp
+    ./ljmd-cl $device $threads < bench-counters.inp > bench-counters.out
+    echo "$opt: $(grep 'MD loop' bench-counters.out)" >> $benchfile
+    sed -n '/^Force kernel work/,/^Simulation Done/p' bench-counters.out | grep -v '^Simulation Done' >> $benchfile
+done
+rm -f bench-counters.inp bench-counters.out
+cat $benchfile
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+#utility to bench the fixed point forces against the floating point ones, and to
+#check that the trajectory of the fixed point forces does not depend on the threads
+
+device=$1
+threads="$2"
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+trajfile=$(sed -n 8p $infile | awk '{print $1}')
+rm -f $benchfile
+for acc in float fixed
+do
+    ( cat $infile; echo "accumulate $acc" ) > bench-fixed.inp
+    for nt in $threads
+    do
+	time=$(./ljmd-cl $device $nt < bench-fixed.inp | grep 'Time of execution')
+	echo "accumulate $acc threads $nt: $time positions $(grep -v nfi $trajfile | md5sum | cut -c1-8)" >> $benchfile
+    done
+done
+rm -f bench-fixed.inp
+cat $benchfile
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+#utility to bench the scaling of the MPI build (-D_MPI) over 1, 2 and 4 ranks
+#strong scaling: the same input on every number of ranks
+#weak scaling: examples/mklattice.py inputs whose atoms grow with the ranks
+#the executable ljmd-cl (built with -D__PROFILING) must be in the current directory, test/
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+for np in 1 2 4
+do
+    mpirun -np $np ./ljmd-cl $device $threads < $infile > bench-mpi.out
+    echo "strong $np ranks: $(grep 'MD loop' bench-mpi.out)" >> $benchfile
+done
+#4*n^3 atoms for n = 12, 15, 19: about 6912 atoms per rank
+for run in "1 12" "2 15" "4 19"
+do
+    set -- $run
+    python ../examples/mklattice.py $2 > /dev/null
+    mpirun -np $1 ./ljmd-cl $device $threads < argon_$((4*$2*$2*$2)).inp > bench-mpi.out
+    echo "weak $1 ranks: $(grep 'MD loop' bench-mpi.out)" >> $benchfile
+done
+rm -f bench-mpi.out
+cat $benchfile
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+#utility to bench a CPU device split in NUMA sub-devices against the whole device
+#the executable ljmd-cl (built with -D__PROFILING) must be in the current directory, test/
+#e.g. ./bench-numa.sh cpu 64 ../examples/argon_78732.inp bench-numa.dat
+#(examples/mklattice.py 27 writes the restart of the 78732 atoms)
+#whole: one device over all sockets
+#numa: one sub-device per NUMA node, each with the buffers of its atoms on its own node
+#parts: the device split in as many equal parts as there are NUMA nodes
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+nodes=$(ls -d /sys/devices/system/node/node[0-9]* 2>/dev/null | wc -l)
+[ $nodes -lt 1 ] && nodes=1
+echo "device $device threads $threads infile $infile benchfile $benchfile nodes $nodes"
+
+rm -f $benchfile
+for run in whole numa parts
+do
+    case $run in
+        whole) spec=$device ;;
+        numa)  spec=$device/numa ;;
+        parts) spec=$device/$nodes ;;
+    esac
+    ./ljmd-cl $spec $threads < $infile > bench-$run.out
+    echo "$run ($spec): $(grep 'MD loop' bench-$run.out)" >> $benchfile
+done
+rm -f bench-whole.out bench-numa.out bench-parts.out
+cat $benchfile
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+#utility to bench the cost of the host phase timers: the MD loop of the plain build against
+#the one built with -D__PHASES, and the phase table of the latter
+#both executables must be in the current directory: ljmd-cl and ljmd-cl.phases
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+for exe in ljmd-cl ljmd-cl.phases
+do
+    ./$exe $device $threads < $infile > bench-phases.out
+    echo "$exe: $(grep 'MD loop' bench-phases.out)" >> $benchfile
+done
+sed -n '/^Host phases/,/^Simulation Done/p' bench-phases.out | grep -v '^Simulation Done' >> $benchfile
+rm -f bench-phases.out
+cat $benchfile
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+#utility to bench short segments run in process by the python module ljmd (make python)
+#against the same steps run as one ljmd-cl process per segment, that pays the start up
+#and the restart and output files every time. the executable ljmd-cl and the module
+#must be in the current directory, test/
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+nseg=${5:-100}
+nsteps=${6:-10}
+echo "device $device threads $threads infile $infile benchfile $benchfile segments $nseg steps $nsteps"
+
+rm -f $benchfile
+sed -e "10s/.*/$nsteps/" -e "12s/.*/$nsteps/" $infile > bench-python.inp
+t0=$(date +%s.%N)
+for (( s = 0; s < nseg; s++ ))
+do
+    ./ljmd-cl $device $threads < bench-python.inp > bench-python.out
+done
+t1=$(date +%s.%N)
+awk -v n=$nseg -v t0=$t0 -v t1=$t1 'BEGIN { printf "processes: %d segments in %.3f s, %.1f segments/s\n", n, t1 - t0, n / (t1 - t0) }' >> $benchfile
+PYTHONPATH=. python ../examples/segments.py bench-python.inp $nseg $nsteps $device $threads > bench-python.out
+echo "module: $(tail -1 bench-python.out)" >> $benchfile
+rm -f bench-python.inp bench-python.out
+cat $benchfile
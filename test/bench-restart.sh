@@ -0,0 +1,20 @@
+#!/bin/bash
+
+#utility to bench the restart parsers (mmap and scanf) on the 78732 atoms lattice of examples/mklattice.py
+#the executable ljmd-cl must be in the current directory, test/
+
+device=$1
+threads=$2
+benchfile=$3
+echo "device $device threads $threads benchfile $benchfile"
+
+python ../examples/mklattice.py 27 > /dev/null
+rm -f $benchfile
+for parser in scanf mmap
+do
+    (cat argon_78732.inp; echo "restart $parser") > bench-restart.inp
+    ./ljmd-cl $device $threads < bench-restart.inp > bench-restart.out
+    echo "$(grep 'Restart:' bench-restart.out)" >> $benchfile
+done
+rm -f bench-restart.inp bench-restart.out
+cat $benchfile
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+#utility to bench the analytic LJ force kernel against the tabulated potentials
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+potentials=("potential lj" \
+	    "potential table 1000 linear" \
+	    "potential table 4000 linear" \
+	    "potential table 1000 cubic" \
+	    "potential table 1000 cubic shift")
+
+rm -f $benchfile
+for pot in "${potentials[@]}"
+do
+    ( cat $infile; echo "$pot" ) > bench-table.inp
+    echo "$pot: $(./ljmd-cl $device $threads < bench-table.inp | grep 'Time of execution')" >> $benchfile
+done
+rm -f bench-table.inp
+cat $benchfile
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+#utility to bench the cost of the device thermostats over plain NVE steps
+#the executable ljmd-cl (built with -D__PROFILING) must be in the current directory, test/
+#berendsen and vrescale add the kinetic energy partials to verlet_second and their
+#sum to every work-item of verlet_first, langevin draws three random numbers per atom.
+#none of them launches a kernel of its own. the optional nsteps replaces the number
+#of steps of the input
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+nsteps=$5
+echo "device $device threads $threads infile $infile benchfile $benchfile nsteps $nsteps"
+
+rm -f $benchfile
+if [ -n "$nsteps" ]; then sed -e "10s/.*/$nsteps/" $infile > bench-nve.inp; else cp $infile bench-nve.inp; fi
+for run in berendsen vrescale langevin
+do
+    (cat bench-nve.inp; echo "thermostat $run 100.0 100.0") > bench-$run.inp
+done
+for run in nve berendsen vrescale langevin
+do
+    ./ljmd-cl $device $threads < bench-$run.inp > bench-$run.out
+    echo "$run: $(grep 'MD loop' bench-$run.out)" >> $benchfile
+    rm -f bench-$run.inp bench-$run.out
+done
+cat $benchfile
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+#utility to bench the print-step overhead of the blocking and non blocking (-D_UNBLOCK) builds
+#both executables must be in the current directory: ljmd-cl and ljmd-cl.unblock
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+for exe in ljmd-cl ljmd-cl.unblock
+do
+    ./$exe $device $threads < $infile > bench-unblock.out
+    echo "$exe: $(grep 'Time of execution' bench-unblock.out)" >> $benchfile
+    echo "$exe: $(grep 'Print-step transfers' bench-unblock.out)" >> $benchfile
+done
+rm -f bench-unblock.out
+cat $benchfile
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+#utility to bench the vector force kernel of the CPU devices against the generic one
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+echo "device $device threads $threads infile $infile benchfile $benchfile"
+
+rm -f $benchfile
+for vec in off 8 16
+do
+    ( cat $infile; echo "vector $vec" ) > bench-vector.inp
+    echo "vector $vec: $(./ljmd-cl $device $threads < bench-vector.inp | grep 'lanes\|Time of execution' | tr '\n' ' ')" >> $benchfile
+done
+rm -f bench-vector.inp
+cat $benchfile
@@ -0,0 +1,26 @@
+#!/bin/bash
+
+#utility to check that the force time does not grow over a long run, now that the
+#positions are wrapped into the box and the minimum image is branchless, while the
+#atoms diffuse away from the box of the restart. it prints the force kernel time of
+#device 0 from the live metrics against the step, and the mean of the second half
+#of the run over the one of the first half, that should stay close to 1
+
+device=$1
+threads=$2
+infile=$3
+benchfile=$4
+nsteps=${5:-1000000}
+echo "device $device threads $threads infile $infile benchfile $benchfile nsteps $nsteps"
+
+rm -f $benchfile bench-wrap.json
+( sed -e "8s/.*/none/" -e "10s/.*/$nsteps/" -e "12s/.*/$(( nsteps / 100 ))/" $infile
+  echo "metrics json bench-wrap.json 5" ) > bench-wrap.inp
+./ljmd-cl $device $threads < bench-wrap.inp > bench-wrap.out
+sed -e 's/.*"step": \([0-9]*\).*"force_kernel_seconds": \[\([0-9.e+-]*\).*/\1 \2/' bench-wrap.json |
+    awk '{ print "step " $1 " force " $2 " s"; f[NR] = $2 }
+         END { for (i = 1; i <= NR; i++) if (2 * i <= NR) a += f[i]; else b += f[i]
+               if (NR > 1) printf "second half/first half force time %.3f\n", ( b / (NR - int(NR / 2)) ) / ( a / int(NR / 2) ) }' > $benchfile
+grep 'MD loop' bench-wrap.out >> $benchfile
+rm -f bench-wrap.inp bench-wrap.out bench-wrap.json
+cat $benchfile
@@ -10,12 +10,12 @@ def main():
   
   print("OpenCL on cpu")
   reference_data = np.genfromtxt('argon_108.dat.base')
-  test_data	 = np.genfromtxt('argon_108.dat.ljmd-cl')
+  test_data	 = np.genfromtxt('argon_108.dat.ljmd-cl')[:,:5]
   print(abs(reference_data-test_data)[:,4])
 
   print("OpenCL on cpu OpenMP")
   reference_data = np.genfromtxt('argon_108.dat.base')
-  test_data	 = np.genfromtxt('argon_108.dat.ljmd-cl.opti')
+  test_data	 = np.genfromtxt('argon_108.dat.ljmd-cl.opti')[:,:5]
   print(abs(reference_data-test_data)[:,4])
 
 if __name__ == "__main__":